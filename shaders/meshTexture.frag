@@ -3,9 +3,8 @@
 
 layout (binding = 1) uniform sampler2D texSampler;
 
-layout (location = 0) in vec3 fragPosition;
-layout (location = 1) in vec3 fragNormal;
-layout (location = 2) in vec2 fragTexCoord;
+layout (location = 0) in vec3 fragNormal;
+layout (location = 1) in vec2 fragTexCoord;
 
 layout (location = 0) out vec4 outColor;
 
@@ -1,24 +1,43 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// --per_vertex_matrices: build the model matrix and invert it for every vertex, the way this shader did before the
+// per-object constants. The same id as in textured.vert.
+layout(constant_id = 3) const bool PER_VERTEX_MATRICES = false;
+
 layout(std140, binding = 0) uniform UBO {
     mat4 model;
-    mat4 view;
-    mat4 proj;
+    mat4 viewproj;
 } ubo;
 
+// Final transforms of every object, computed once per object per frame on the CPU instead of inverting the model
+// matrix for every vertex. Each draw's firstInstance is the object's index. With PER_VERTEX_MATRICES mvp only holds
+// the object's placement.
+struct ObjectConstants {
+    mat4 mvp;
+    mat3 normal;
+};
+
+layout(std430, binding = 2) readonly buffer Objects {
+    ObjectConstants objects[];
+};
+
 layout (location = 0) in vec3 inPosition;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec2 inTexCoord;
 
-layout (location = 0) out vec3 fragPosition;
-layout (location = 1) out vec3 fragNormal;
-layout (location = 2) out vec2 fragTexCoord;
+layout (location = 0) out vec3 fragNormal;
+layout (location = 1) out vec2 fragTexCoord;
 
 void main() {
-    fragPosition = vec3(ubo.model * vec4(inPosition, 1.0));
-    fragNormal = mat3(transpose(inverse(ubo.model))) * inNormal;
     fragTexCoord = inTexCoord;
 
-    gl_Position = ubo.proj * ubo.view * vec4(fragPosition, 1.0);
+    if (PER_VERTEX_MATRICES) {
+        mat4 model = ubo.model * objects[gl_InstanceIndex].mvp;
+        fragNormal = mat3(transpose(inverse(model))) * inNormal;
+        gl_Position = ubo.viewproj * model * vec4(inPosition, 1.0);
+    } else {
+        fragNormal = objects[gl_InstanceIndex].normal * inNormal;
+        gl_Position = objects[gl_InstanceIndex].mvp * vec4(inPosition, 1.0);
+    }
 }
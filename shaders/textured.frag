@@ -1,6 +1,14 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Variant switches, fixed per pipeline through specialization constants so the driver folds the unused paths away.
+// The ids match TexturedVariant in DemoScene.h.
+layout(constant_id = 0) const bool ALPHA_TEST = false;
+// The cube has no color attribute, its color comes from the interpolated object space position
+layout(constant_id = 1) const bool VERTEX_COLOR = false;
+// 0 skips the texture fetch, the stand-in drawn while the textured variants compile
+layout(constant_id = 2) const int TEXTURE_COUNT = 1;
+
 layout(location = 0) in VS_OUT
 {
     vec3 pos;
@@ -13,5 +21,15 @@ layout(location = 0) out vec4 outColor;
 
 void main()
 {
-    outColor = texture(texSampler, ps_in.texcoord);
+    vec4 color = vec4(1.0);
+    if (TEXTURE_COUNT > 0) {
+        color = texture(texSampler, ps_in.texcoord);
+    }
+    if (VERTEX_COLOR) {
+        color.rgb *= ps_in.pos * 0.5 + 0.5;
+    }
+    if (ALPHA_TEST && color.a < 0.5) {
+        discard;
+    }
+    outColor = color;
 }
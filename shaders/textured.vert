@@ -1,11 +1,26 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// --per_vertex_matrices: multiply the view-projection, the spin and the object's placement for every vertex, the way
+// this shader did before the per-object constants, to compare the two. The id follows TexturedVariant's in DemoScene.h.
+layout(constant_id = 3) const bool PER_VERTEX_MATRICES = false;
+
 layout(std140, binding = 0) uniform UBO {
-        mat4 M;
-        mat4 VP;
+        mat4 model;
+        mat4 viewproj;
 } ubo;
 
+// Final transforms of every object, computed once per object per frame on the CPU. Each draw's firstInstance is
+// the object's index. With PER_VERTEX_MATRICES mvp only holds the object's placement on the turntable.
+struct ObjectConstants {
+        mat4 mvp;
+        mat3 normal;
+};
+
+layout(std430, binding = 2) readonly buffer Objects {
+        ObjectConstants objects[];
+};
+
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec2 in_texcoord;
 
@@ -24,5 +39,9 @@ void main()
     vs_out.pos = in_position;
     vs_out.texcoord = in_texcoord;
 
-    gl_Position = ubo.VP * ubo.M * vec4(in_position, 1.0f);
+    if (PER_VERTEX_MATRICES) {
+        gl_Position = ubo.viewproj * ubo.model * objects[gl_InstanceIndex].mvp * vec4(in_position, 1.0f);
+    } else {
+        gl_Position = objects[gl_InstanceIndex].mvp * vec4(in_position, 1.0f);
+    }
 }
@@ -0,0 +1,10 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// --bench_geometry: every point is clipped, this only completes the pipeline
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    outColor = vec4(1.0f);
+}
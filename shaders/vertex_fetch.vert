@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// --bench_geometry: reads every attribute of the standard vertex so the vertex input stage fetches all of it, then
+// puts the point behind the far plane. Nothing is rasterized, the draw's cost is the fetch.
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec2 in_texcoord;
+
+out gl_PerVertex{
+    vec4 gl_Position;
+    float gl_PointSize;
+};
+
+void main() 
+{
+    gl_Position = vec4(in_position.xy + in_texcoord, 2.0f + abs(in_position.z), 1.0f);
+    gl_PointSize = 1.0f;
+}
@@ -0,0 +1,308 @@
+#include "BufferFactory.h"
+#include "GpuTimeline.h"
+
+// Heaps larger than the legacy 256 MiB BAR window mean resizable BAR is enabled
+constexpr vk::DeviceSize LEGACY_BAR_SIZE = 256ull * 1024 * 1024;
+
+vk::PhysicalDevice BufferFactory::Gpu;
+vk::Device BufferFactory::Device;
+uint32_t BufferFactory::QueueFamilyIndex = 0;
+vk::CommandPool BufferFactory::CommandPool;
+vk::PhysicalDeviceMemoryProperties BufferFactory::MemoryProperties;
+vk::PhysicalDeviceProperties BufferFactory::GpuProperties;
+std::array<uint32_t, 3> BufferFactory::PlacementTypeBits = {};
+
+BufferFactory::BufferFactory() {}
+BufferFactory::~BufferFactory() {}
+
+void BufferFactory::Init(vk::PhysicalDevice InGpu, vk::Device InDevice, uint32_t InQueueFamilyIndex)
+{
+	Gpu = InGpu;
+	Device = InDevice;
+	QueueFamilyIndex = InQueueFamilyIndex;
+	MemoryProperties = Gpu.getMemoryProperties();
+	GpuProperties = Gpu.getProperties();
+	PlacementTypeBits = {};
+
+	const bool is_uma = GpuProperties.deviceType == vk::PhysicalDeviceType::eIntegratedGpu ||
+						GpuProperties.deviceType == vk::PhysicalDeviceType::eCpu;
+
+	for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+		const auto flags = MemoryProperties.memoryTypes[i].propertyFlags;
+		const auto& heap = MemoryProperties.memoryHeaps[MemoryProperties.memoryTypes[i].heapIndex];
+
+		const bool device_local = static_cast<bool>(flags & vk::MemoryPropertyFlagBits::eDeviceLocal);
+		const bool host_visible = static_cast<bool>(flags & vk::MemoryPropertyFlagBits::eHostVisible);
+		const bool host_coherent = static_cast<bool>(flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+		// Writes go through a plain memcpy, so the direct path sticks to coherent memory
+		if (device_local && host_visible && host_coherent && (is_uma || heap.size > LEGACY_BAR_SIZE)) {
+			PlacementTypeBits[static_cast<size_t>(BufferPlacement::DirectDeviceLocal)] |= 1u << i;
+		}
+		if (device_local) {
+			PlacementTypeBits[static_cast<size_t>(BufferPlacement::StagedDeviceLocal)] |= 1u << i;
+		}
+		if (!device_local && host_visible && host_coherent) {
+			PlacementTypeBits[static_cast<size_t>(BufferPlacement::HostVisible)] |= 1u << i;
+		}
+	}
+
+	if (PlacementTypeBits[static_cast<size_t>(BufferPlacement::StagedDeviceLocal)] == 0) {
+		ERR_EXIT("No device-local memory type found for static buffers", "Memory Classification Failure");
+	}
+
+	printf("Static buffer placement: %s\n", PlacementName(GetDefaultPlacement()));
+
+	auto cmd_pool_return = Device.createCommandPool(vk::CommandPoolCreateInfo()
+														.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+														.setQueueFamilyIndex(QueueFamilyIndex));
+	VERIFY(cmd_pool_return.result == vk::Result::eSuccess);
+	CommandPool = cmd_pool_return.value;
+}
+
+void BufferFactory::Shutdown()
+{
+	Device.destroyCommandPool(CommandPool);
+	CommandPool = vk::CommandPool();
+}
+
+bool BufferFactory::IsPlacementAvailable(BufferPlacement Placement)
+{
+	return PlacementTypeBits[static_cast<size_t>(Placement)] != 0;
+}
+
+BufferPlacement BufferFactory::GetDefaultPlacement()
+{
+	return IsPlacementAvailable(BufferPlacement::DirectDeviceLocal) ? BufferPlacement::DirectDeviceLocal : BufferPlacement::StagedDeviceLocal;
+}
+
+const char* BufferFactory::PlacementName(BufferPlacement Placement)
+{
+	switch (Placement) {
+	case BufferPlacement::DirectDeviceLocal:
+		return "direct device-local (host-visible VRAM)";
+	case BufferPlacement::StagedDeviceLocal:
+		return "staged device-local";
+	default:
+		return "host-visible";
+	}
+}
+
+uint32_t BufferFactory::FindMemoryType(uint32_t TypeBits, BufferPlacement Placement)
+{
+	uint32_t candidates = TypeBits & PlacementTypeBits[static_cast<size_t>(Placement)];
+
+	// For the staged path prefer device-local types the host can't see, host-visible VRAM is a scarcer resource
+	if (Placement == BufferPlacement::StagedDeviceLocal) {
+		for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+			if ((candidates & (1u << i)) && !(MemoryProperties.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)) {
+				return i;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+		if (candidates & (1u << i)) {
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
+uint32_t BufferFactory::FindStagingMemoryType(uint32_t TypeBits)
+{
+	uint32_t fallback = UINT32_MAX;
+	for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+		const auto flags = MemoryProperties.memoryTypes[i].propertyFlags;
+		if (!(TypeBits & (1u << i)) || !(flags & vk::MemoryPropertyFlagBits::eHostVisible) || !(flags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+			continue;
+		}
+		// Keep staging data out of VRAM when possible
+		if (!(flags & vk::MemoryPropertyFlagBits::eDeviceLocal)) {
+			return i;
+		}
+		if (fallback == UINT32_MAX) {
+			fallback = i;
+		}
+	}
+	return fallback;
+}
+
+StaticBuffer BufferFactory::AllocateBuffer(vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, BufferPlacement Placement, const char* Tag)
+{
+	StaticBuffer Out;
+	Out.size = Size;
+	Out.placement = Placement;
+
+	// Transfer usage lets the defragmenter copy the buffer when it compacts the pool
+	auto const buffer_info = vk::BufferCreateInfo()
+								 .setSize(Size)
+								 .setUsage(Usage | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst)
+								 .setSharingMode(vk::SharingMode::eExclusive);
+	vk::Buffer buffer;
+	auto Result = Device.createBuffer(&buffer_info, nullptr, &buffer);
+	VERIFY(Result == vk::Result::eSuccess);
+
+	vk::MemoryRequirements mem_reqs;
+	Device.getBufferMemoryRequirements(buffer, &mem_reqs);
+
+	uint32_t type_index = FindMemoryType(mem_reqs.memoryTypeBits, Placement);
+	if (type_index == UINT32_MAX) {
+		Device.destroyBuffer(buffer);
+		return StaticBuffer();
+	}
+
+	Out.allocation = DeviceMemoryPool::BindBuffer(buffer, buffer_info, type_index, Category, Tag);
+	VERIFY(Out.allocation.IsValid());
+
+	return Out;
+}
+
+StaticBuffer BufferFactory::CreateStaticBuffer(const void* Data, vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, const char* Tag)
+{
+	return CreateStaticBuffer(Data, Size, Usage, Category, GetDefaultPlacement(), Tag);
+}
+
+StaticBuffer BufferFactory::CreateStaticBuffer(const void* Data, vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, BufferPlacement Placement, const char* Tag)
+{
+	assert(CommandPool && Size > 0);
+
+	if (!IsPlacementAvailable(Placement)) {
+		return StaticBuffer();
+	}
+
+	if (Placement != BufferPlacement::StagedDeviceLocal) {
+		// Host can write the final memory directly
+		StaticBuffer Out = AllocateBuffer(Size, Usage, Category, Placement, Tag);
+		if (!Out.IsValid() && Placement == BufferPlacement::DirectDeviceLocal) {
+			// This buffer's usage can't live in host-visible VRAM, take the staged path instead
+			return CreateStaticBuffer(Data, Size, Usage, Category, BufferPlacement::StagedDeviceLocal, Tag);
+		}
+		if (Out.IsValid() && Data != nullptr) {
+			// Pool blocks of host-visible types stay mapped
+			void* mapped = DeviceMemoryPool::GetMappedPointer(Out.allocation);
+			VERIFY(mapped != nullptr);
+			memcpy(mapped, Data, static_cast<size_t>(Size));
+		}
+		return Out;
+	}
+
+	StaticBuffer Out = AllocateBuffer(Size, Usage, Category, Placement, Tag);
+	if (Data == nullptr) {
+		return Out;
+	}
+
+	// Stage through host memory and copy on the GPU
+	vk::Buffer staging_buffer;
+	vk::DeviceMemory staging_memory;
+
+	auto const staging_info = vk::BufferCreateInfo().setSize(Size).setUsage(vk::BufferUsageFlagBits::eTransferSrc).setSharingMode(vk::SharingMode::eExclusive);
+	auto Result = Device.createBuffer(&staging_info, nullptr, &staging_buffer);
+	VERIFY(Result == vk::Result::eSuccess);
+
+	vk::MemoryRequirements mem_reqs;
+	Device.getBufferMemoryRequirements(staging_buffer, &mem_reqs);
+
+	uint32_t staging_type = FindStagingMemoryType(mem_reqs.memoryTypeBits);
+	VERIFY(staging_type != UINT32_MAX);
+
+	auto const staging_alloc = vk::MemoryAllocateInfo().setAllocationSize(mem_reqs.size).setMemoryTypeIndex(staging_type);
+	Result = MemoryTracker::Allocate(staging_alloc, MemoryCategory::Staging, staging_memory, Tag);
+	VERIFY(Result == vk::Result::eSuccess);
+
+	Result = Device.bindBufferMemory(staging_buffer, staging_memory, 0);
+	VERIFY(Result == vk::Result::eSuccess);
+
+	auto mapped = Device.mapMemory(staging_memory, 0, Size);
+	VERIFY(mapped.result == vk::Result::eSuccess);
+	memcpy(mapped.value, Data, static_cast<size_t>(Size));
+	Device.unmapMemory(staging_memory);
+
+	SubmitAndWait([&](vk::CommandBuffer cmd) {
+		cmd.copyBuffer(staging_buffer, Out.GetBuffer(), vk::BufferCopy(0, 0, Size));
+	});
+
+	Device.destroyBuffer(staging_buffer);
+	MemoryTracker::Free(staging_memory);
+
+	return Out;
+}
+
+void BufferFactory::DestroyBuffer(StaticBuffer& Buffer)
+{
+	DeviceMemoryPool::Destroy(Buffer.allocation);
+	Buffer = StaticBuffer();
+}
+
+void BufferFactory::SubmitAndWait(const std::function<void(vk::CommandBuffer)>& Record)
+{
+	auto cmd_return = Device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+														.setCommandPool(CommandPool)
+														.setLevel(vk::CommandBufferLevel::ePrimary)
+														.setCommandBufferCount(1));
+	VERIFY(cmd_return.result == vk::Result::eSuccess);
+	auto cmd = cmd_return.value[0];
+
+	auto result = cmd.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	VERIFY(result == vk::Result::eSuccess);
+
+	Record(cmd);
+
+	result = cmd.end();
+	VERIFY(result == vk::Result::eSuccess);
+
+	GpuTimeline::Wait(GpuTimeline::Submit(vk::SubmitInfo().setCommandBuffers(cmd)));
+	Device.freeCommandBuffers(CommandPool, cmd);
+}
+
+void BufferFactory::BenchmarkPlacements(vk::DeviceSize Size, uint32_t Iterations, const RecordFetchFn& RecordFetch)
+{
+	auto queue_props = Gpu.getQueueFamilyProperties();
+	const uint32_t valid_bits = queue_props[QueueFamilyIndex].timestampValidBits;
+	if (valid_bits == 0 || GpuProperties.limits.timestampPeriod == 0.0f) {
+		printf("Vertex fetch benchmark skipped: device doesn't support timestamp queries\n");
+		return;
+	}
+	// Bits above timestampValidBits are undefined
+	const uint64_t timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+	auto query_pool_return = Device.createQueryPool(vk::QueryPoolCreateInfo().setQueryType(vk::QueryType::eTimestamp).setQueryCount(2));
+	VERIFY(query_pool_return.result == vk::Result::eSuccess);
+	auto query_pool = query_pool_return.value;
+
+	std::vector<uint8_t> data(static_cast<size_t>(Size), 0x5a);
+
+	printf("Vertex fetch benchmark: %" PRIu64 " KiB of vertices drawn %u times per placement\n", static_cast<uint64_t>(Size / 1024), Iterations);
+	for (auto placement : {BufferPlacement::DirectDeviceLocal, BufferPlacement::StagedDeviceLocal, BufferPlacement::HostVisible}) {
+		if (!IsPlacementAvailable(placement)) {
+			printf("  %-42s not available on this device\n", PlacementName(placement));
+			continue;
+		}
+
+		StaticBuffer source = CreateStaticBuffer(data.data(), Size, vk::BufferUsageFlagBits::eVertexBuffer, MemoryCategory::Mesh, placement,
+			"benchmark vertices");
+
+		SubmitAndWait([&](vk::CommandBuffer cmd) {
+			cmd.resetQueryPool(query_pool, 0, 2);
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, query_pool, 0);
+			RecordFetch(cmd, source.GetBuffer());
+			cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, query_pool, 1);
+		});
+
+		std::array<uint64_t, 2> timestamps = {};
+		auto result = Device.getQueryPoolResults(query_pool, 0, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+			vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+		VERIFY(result == vk::Result::eSuccess);
+
+		const uint64_t ticks = (timestamps[1] - timestamps[0]) & timestamp_mask;
+		const double total_ms = static_cast<double>(ticks) * GpuProperties.limits.timestampPeriod / 1.0e6;
+		const double per_draw_ms = total_ms / Iterations;
+		const double gib_per_s = (static_cast<double>(Size) * Iterations / (1024.0 * 1024.0 * 1024.0)) / (total_ms / 1000.0);
+		printf("  %-42s %8.3f ms per draw  %8.2f GiB/s\n", PlacementName(placement), per_draw_ms, gib_per_s);
+
+		DestroyBuffer(source);
+	}
+	fflush(stdout);
+
+	Device.destroyQueryPool(query_pool);
+}
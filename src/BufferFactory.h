@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.h"
+#include "MemoryTracker.h"
+#include "DeviceMemoryPool.h"
+
+#include <functional>
+
+// Where a static buffer's memory ended up
+enum class BufferPlacement : uint32_t {
+	// Device-local memory the host can write directly (resizable BAR or UMA), no copy needed
+	DirectDeviceLocal,
+	// Pure device-local memory filled through a staging buffer and a GPU copy
+	StagedDeviceLocal,
+	// Host memory read over the bus, only used to compare against in the benchmark
+	HostVisible,
+};
+
+struct StaticBuffer {
+	// Memory comes from DeviceMemoryPool, so the buffer may be moved by the defragmenter
+	PoolHandle allocation;
+	vk::DeviceSize size = 0;
+	BufferPlacement placement = BufferPlacement::StagedDeviceLocal;
+
+	// Look the buffer up when recording commands rather than caching it
+	vk::Buffer GetBuffer() const { return DeviceMemoryPool::GetBuffer(allocation); }
+	bool IsValid() const { return allocation.IsValid(); }
+};
+
+// Buffer creation policy for geometry and other data that is written once and read by the GPU every frame.
+// Memory types are classified once at startup:
+// * if a device-local + host-visible type backs a large heap (resizable BAR) or the GPU is integrated (UMA),
+//   the data is written straight into VRAM,
+// * otherwise it is staged and copied into pure device-local memory,
+// * host-only memory is never used for static buffers.
+class BufferFactory
+{
+public:
+	// Classify memory types and create the upload command pool, called once after device creation.
+	// Uploads are submitted through GpuTimeline, QueueFamilyIndex must be its queue's family.
+	static void Init(vk::PhysicalDevice Gpu, vk::Device Device, uint32_t QueueFamilyIndex);
+	static void Shutdown();
+
+	static StaticBuffer CreateStaticBuffer(const void* Data, vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, const char* Tag = nullptr);
+	// Same as above but forces a placement, returns an empty buffer if the placement isn't available on this device
+	static StaticBuffer CreateStaticBuffer(const void* Data, vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, BufferPlacement Placement, const char* Tag = nullptr);
+	static void DestroyBuffer(StaticBuffer& Buffer);
+
+	static bool IsPlacementAvailable(BufferPlacement Placement);
+	static BufferPlacement GetDefaultPlacement();
+	static const char* PlacementName(BufferPlacement Placement);
+
+	// Record commands into a one-off command buffer, submit them and wait for completion
+	static void SubmitAndWait(const std::function<void(vk::CommandBuffer)>& Record);
+
+	// Records the draws BenchmarkPlacements() times, each reading every vertex of Vertices through the vertex input stage
+	using RecordFetchFn = std::function<void(vk::CommandBuffer Cmd, vk::Buffer Vertices)>;
+	// Measures the per-frame vertex fetch cost of a static mesh of Size bytes in each placement. RecordFetch draws from
+	// it Iterations times, timestamps bracket those draws.
+	static void BenchmarkPlacements(vk::DeviceSize Size, uint32_t Iterations, const RecordFetchFn& RecordFetch);
+
+private:
+	static uint32_t FindMemoryType(uint32_t TypeBits, BufferPlacement Placement);
+	static uint32_t FindStagingMemoryType(uint32_t TypeBits);
+	static StaticBuffer AllocateBuffer(vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, BufferPlacement Placement, const char* Tag);
+
+	static vk::PhysicalDevice Gpu;
+	static vk::Device Device;
+	static uint32_t QueueFamilyIndex;
+	static vk::CommandPool CommandPool;
+	static vk::PhysicalDeviceMemoryProperties MemoryProperties;
+	static vk::PhysicalDeviceProperties GpuProperties;
+
+	// Memory types usable for each placement, one bit per memory type index
+	static std::array<uint32_t, 3> PlacementTypeBits;
+
+	BufferFactory();
+	~BufferFactory();
+};
@@ -1,54 +1,64 @@
 #include "DemoScene.h"
 #include "ShaderLoader.h"
 #include "DemoCube.h"
+#include "MemoryTracker.h"
+#include "BufferFactory.h"
+#include "DeviceMemoryPool.h"
 
-static uint32_t FindMemoryType(vk::PhysicalDevice PhysDevice, uint32_t TypeFilter, vk::MemoryPropertyFlags Properties)
+#include <filesystem>
+
+void DemoScene::cleanup_scene()
 {
-    vk::PhysicalDeviceMemoryProperties MemProperties;
-    PhysDevice.getMemoryProperties(&MemProperties);
+    BufferFactory::DestroyBuffer(vertex_buffer);
+
+    // Release the models now, their buffers must be gone before the device is destroyed
+    m_model.reset();
+    streamed_models.clear();
+}
 
-    for (uint32_t i = 0; i < MemProperties.memoryTypeCount; i++) {
-        if (TypeFilter & (1 << i) && (MemProperties.memoryTypes[i].propertyFlags & Properties) == Properties) {
-            return i;
+void DemoScene::load_streamed_models()
+{
+    // Every model in the sub folders of PATH_MODELS, each call adds another copy of the set
+    size_t loaded = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(PATH_MODELS)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".obj" || entry.path().parent_path() == std::filesystem::path(PATH_MODELS).parent_path()) {
+            continue;
         }
+        streamed_models.push_back(std::make_unique<MeshModel>(device, gpu, cmd_pool, graphics_queue, glm::vec3(0.0f), glm::vec3(0.0f),
+            glm::vec3(1.0f), entry.path().string()));
+        loaded++;
     }
-
-    throw std::runtime_error("Failed to find a suitable memory type");
+    content_version++;
+    printf("Loaded %zu models, %zu resident\n", loaded, streamed_models.size());
+    DeviceMemoryPool::PrintStats("after load");
 }
 
-void DemoScene::cleanup_scene()
+void DemoScene::unload_streamed_models()
 {
-    device.destroyBuffer(vertex_buffer);
-    device.freeMemory(vertex_buffer_memory);
+    // Drop every other model so the freed ranges are scattered over all blocks
+    size_t kept = 0;
+    for (size_t i = 0; i < streamed_models.size(); i++) {
+        if (i % 2 == 0) {
+            streamed_models[kept++] = std::move(streamed_models[i]);
+        }
+    }
+    printf("Unloaded %zu models, %zu resident\n", streamed_models.size() - kept, kept);
+    streamed_models.resize(kept);
+    content_version++;
+
+    // Compact over the next frames, the scene steps the defragmenter and switches over when done
+    if (!DeviceMemoryPool::BeginDefragment()) {
+        DeviceMemoryPool::PrintStats("nothing worth defragmenting");
+    }
 }
 
 void DemoScene::init_scene()
 {
-    // Create vertex buffer
-    vk::BufferCreateInfo bufferInfo = vk::BufferCreateInfo().setSize(sizeof(VertexStandard) * demo_cube.size()).setUsage(vk::BufferUsageFlagBits::eVertexBuffer);
-
-    auto result = device.createBuffer(&bufferInfo, nullptr, &vertex_buffer);
-    VERIFY(result == vk::Result::eSuccess);
-
-    vk::MemoryRequirements memRequirements = device.getBufferMemoryRequirements(vertex_buffer);
-    vk::MemoryAllocateInfo allocInfo = vk::MemoryAllocateInfo().setAllocationSize(memRequirements.size).setMemoryTypeIndex(FindMemoryType(gpu, memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent));
-
-    result = device.allocateMemory(&allocInfo, nullptr, &vertex_buffer_memory);
-    VERIFY(result == vk::Result::eSuccess);
-
-    result = device.bindBufferMemory(vertex_buffer, vertex_buffer_memory, 0);
-    VERIFY(result == vk::Result::eSuccess);
-
-    void* VertexData;
-    result = device.mapMemory(vertex_buffer_memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &VertexData);
-    VERIFY(result == vk::Result::eSuccess);
-
-    memcpy(VertexData, demo_cube.data(), sizeof(VertexStandard) * demo_cube.size());
-    device.unmapMemory(vertex_buffer_memory);
+    // Create vertex buffer, static geometry goes to device-local memory
+    vertex_buffer = BufferFactory::CreateStaticBuffer(demo_cube.data(), sizeof(VertexStandard) * demo_cube.size(),
+        vk::BufferUsageFlagBits::eVertexBuffer, MemoryCategory::Mesh, "demo cube vertices");
 
     // Setup scene data
-    spin_speed = 40.0f;
-    spin_control = 120.0f;
     m_model = std::make_unique<MeshModel>(
         device,                    // vk::Device
         gpu,                      // vk::PhysicalDevice
@@ -57,9 +67,11 @@ void DemoScene::init_scene()
         glm::vec3(0.0f),         // position
         glm::vec3(0.0f),         // rotation
         glm::vec3(1.0f),         // scale
-        "Resources/Models/AncientEmpire/SM_Prop_Statue_01.obj"  // model path
+        std::string(PATH_MODELS) + "cube.obj"  // model path
     );
 
+    build_object_grid();
+
     // Setup scene data
     projection_matrix = glm::perspective(glm::radians(45.0f), aspect_ratio, 0.1f, 100.0f);
     view_matrix = glm::lookAt(eye, origin, up);
@@ -69,107 +81,170 @@ void DemoScene::init_scene()
     projection_matrix[1][1] *= -1.0f;
 }
 
-void DemoScene::create_graphics_pipelines()
+void DemoScene::build_object_grid()
 {
-    auto attributeDescriptions = VertexStandard::GetAttributeDescriptions();
-    auto bindingDescriptions = VertexStandard::GetBindingDescription();
-
-    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescriptions;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-    auto const inputAssemblyInfo = vk::PipelineInputAssemblyStateCreateInfo().setTopology(vk::PrimitiveTopology::eTriangleList);
-
-    auto const viewportInfo = vk::PipelineViewportStateCreateInfo().setViewportCount(1).setScissorCount(1);
-
-    auto const rasterizationInfo = vk::PipelineRasterizationStateCreateInfo()
-                                       .setDepthClampEnable(VK_FALSE)
-                                       .setRasterizerDiscardEnable(VK_FALSE)
-                                       .setPolygonMode(vk::PolygonMode::eFill)
-                                       .setCullMode(vk::CullModeFlagBits::eBack)
-                                       .setFrontFace(vk::FrontFace::eCounterClockwise)
-                                       .setDepthBiasEnable(VK_FALSE)
-                                       .setLineWidth(1.0f);
-
-    auto const multisampleInfo = vk::PipelineMultisampleStateCreateInfo();
-
-    auto const stencilOp = vk::StencilOpState().setFailOp(vk::StencilOp::eKeep).setPassOp(vk::StencilOp::eKeep).setCompareOp(vk::CompareOp::eAlways);
-
-    auto const depthStencilInfo = vk::PipelineDepthStencilStateCreateInfo()
-                                      .setDepthTestEnable(VK_TRUE)
-                                      .setDepthWriteEnable(VK_TRUE)
-                                      .setDepthCompareOp(vk::CompareOp::eLessOrEqual)
-                                      .setDepthBoundsTestEnable(VK_FALSE)
-                                      .setStencilTestEnable(VK_FALSE)
-                                      .setFront(stencilOp)
-                                      .setBack(stencilOp);
-
-    std::array<vk::PipelineColorBlendAttachmentState, 1> const colorBlendAttachments = {
-        vk::PipelineColorBlendAttachmentState().setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)
-    };
-
-    auto const colorBlendInfo = vk::PipelineColorBlendStateCreateInfo().setAttachments(colorBlendAttachments);
-
-    std::array<vk::DynamicState, 2> const dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    // A single cube stays at the origin, more are laid out on a square grid in the XZ plane that fits the same view.
+    // Either way they turn with the turntable they are children of.
+    scene_graph.Clear();
+    content_version++;
+    turntable_node = scene_graph.Add(SceneGraph::NoParent, glm::vec3(0.0f));
+    if (object_count == 1) {
+        first_object_node = scene_graph.Add(turntable_node, glm::vec3(0.0f));
+        return;
+    }
 
-    auto const dynamicStateInfo = vk::PipelineDynamicStateCreateInfo().setDynamicStates(dynamicStates);
+    uint32_t side = 1;
+    while (side * side < object_count) {
+        side++;
+    }
+    const float extent = 4.0f;
+    const float cell = extent / static_cast<float>(side);
+    for (uint32_t i = 0; i < object_count; i++) {
+        const float x = (static_cast<float>(i % side) + 0.5f) * cell - extent * 0.5f;
+        const float z = (static_cast<float>(i / side) + 0.5f) * cell - extent * 0.5f;
+        // Demo cube spans [-1, 1], leave a gap between neighbours
+        const uint32_t node = scene_graph.Add(turntable_node, glm::vec3(x, 0.0f, z), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(cell * 0.35f));
+        if (i == 0) {
+            first_object_node = node;
+        }
+    }
+}
 
-    // PipelineCache allows pipeline construction to be reused between pipelines and app runs.
-    // Pass the same pipeline cache when creating multiple related pipelines.
-    vk::PipelineCacheCreateInfo const pipelineCacheInfo;
-    auto result = device.createPipelineCache(&pipelineCacheInfo, nullptr, &pipelineCache);
-    VERIFY(result == vk::Result::eSuccess);
+std::vector<std::string> DemoScene::get_pipeline_shaders()
+{
+    return { "textured.vert.spv", "textured.frag.spv" };
+}
 
-    vk::ShaderModule vert_shader_module = ShaderLoader::CreateShader("textured.vert.spv");
-    vk::ShaderModule frag_shader_module = ShaderLoader::CreateShader("textured.frag.spv");
+std::string TexturedVariant::get_name() const
+{
+    std::string name = texture_count > 0 ? "textured" : "untextured";
+    const char* separator = "[";
+    if (alpha_test) {
+        name += separator;
+        name += "alpha_test";
+        separator = ",";
+    }
+    if (vertex_color) {
+        name += separator;
+        name += "vertex_color";
+        separator = ",";
+    }
+    if (separator[0] == ',') {
+        name += "]";
+    }
+    return name;
+}
 
-    std::array<vk::PipelineShaderStageCreateInfo, 2> const shaderStageInfo = {
-        vk::PipelineShaderStageCreateInfo().setStage(vk::ShaderStageFlagBits::eVertex).setModule(vert_shader_module).setPName("main"),
-        vk::PipelineShaderStageCreateInfo().setStage(vk::ShaderStageFlagBits::eFragment).setModule(frag_shader_module).setPName("main")
-    };
+void DemoScene::create_graphics_pipelines()
+{
+    // Only the attributes the vertex shader reads are bound, checked against its inputs here on the main thread so a
+    // mismatch exits before anything is built
+    const auto vertex_attributes = VertexStandard::GetAttributeDescriptions();
+
+    textured_state = PipelineStateKey();
+    textured_state.vertex_shader = "textured.vert.spv";
+    textured_state.fragment_shader = "textured.frag.spv";
+    textured_state.vertex_binding = VertexStandard::GetBindingDescription();
+    textured_state.vertex_attributes = ShaderLoader::GetVertexAttributes(textured_state.vertex_shader,
+        std::vector<vk::VertexInputAttributeDescription>(vertex_attributes.begin(), vertex_attributes.end()));
+    set_render_target(textured_state);
+    textured_state.layout = pipeline_layout;
+
+    // The untextured variant is cheap and ready before the first frame, the cubes draw with it until the textured
+    // ones have compiled
+    TexturedVariant untextured;
+    untextured.vertex_color = true;
+    untextured.texture_count = 0;
+    untextured_pipeline = request_variant(untextured, false);
+
+    textured_pipeline = request_variant(TexturedVariant(), true, untextured_pipeline);
+
+    TexturedVariant tinted;
+    tinted.alpha_test = true;
+    tinted.vertex_color = true;
+    tinted_pipeline = request_variant(tinted, true, untextured_pipeline);
+
+    if (is_headless()) {
+        check_variants();
+    }
+}
 
-    auto pipline_return = device.createGraphicsPipelines(pipelineCache, vk::GraphicsPipelineCreateInfo().setStages(shaderStageInfo).setPVertexInputState(&vertexInputInfo).setPInputAssemblyState(&inputAssemblyInfo).setPViewportState(&viewportInfo).setPRasterizationState(&rasterizationInfo).setPMultisampleState(&multisampleInfo).setPDepthStencilState(&depthStencilInfo).setPColorBlendState(&colorBlendInfo).setPDynamicState(&dynamicStateInfo).setLayout(pipeline_layout).setRenderPass(render_pass));
-    VERIFY(pipline_return.result == vk::Result::eSuccess);
-    pipeline = pipline_return.value.at(0);
+uint32_t DemoScene::request_variant(const TexturedVariant& variant, bool async, uint32_t fallback)
+{
+    PipelineStateKey key = textured_state;
+    key.specialization = variant.get_specialization();
+    key.specialization.push_back(per_vertex_matrices ? 1u : 0u);
+    return pipeline_compiler.Request(variant.get_name().c_str(), key, async, fallback);
+}
 
-    device.destroyShaderModule(frag_shader_module);
-    device.destroyShaderModule(vert_shader_module);
+void DemoScene::check_variants()
+{
+    // Three of these are already in use, the rest are new
+    const uint32_t misses = pipeline_compiler.GetStateMisses();
+    std::vector<uint32_t> ids;
+    for (uint32_t bits = 0; bits < 8; bits++) {
+        TexturedVariant variant;
+        variant.alpha_test = (bits & 1) != 0;
+        variant.vertex_color = (bits & 2) != 0;
+        variant.texture_count = (bits & 4) != 0 ? 0 : 1;
+        ids.push_back(request_variant(variant, true));
+    }
+    pipeline_compiler.WaitIdle();
+
+    // Every variant its own pipeline, and asking again for one returns it instead of building another
+    const uint32_t hits = pipeline_compiler.GetStateHits();
+    bool distinct = request_variant(TexturedVariant(), true) == textured_pipeline && pipeline_compiler.GetStateHits() == hits + 1;
+    for (size_t i = 0; i < ids.size() && distinct; i++) {
+        const vk::Pipeline pipeline = pipeline_compiler.Resolve(ids[i]);
+        distinct = static_cast<bool>(pipeline);
+        for (size_t j = 0; j < i && distinct; j++) {
+            distinct = ids[i] != ids[j] && pipeline != pipeline_compiler.Resolve(ids[j]);
+        }
+    }
+    if (!distinct) {
+        ERR_EXIT("Shader variants didn't get distinct pipelines", "Pipeline Variants Failed");
+    }
+    printf("Pipeline variants: %zu requested, %u built here, all distinct\n", ids.size(), pipeline_compiler.GetStateMisses() - misses);
+    fflush(stdout);
 }
 
 void DemoScene::populate_command_buffer(const vk::CommandBuffer& commandBuffer, const FrameResources& frame, uint32_t width, uint32_t height)
 {
     // Populate the command buffer
-    vk::ClearValue const clearValues[2] = { vk::ClearColorValue(std::array<float, 4>({ { 0.2f, 0.2f, 0.2f, 0.2f } })),
-        vk::ClearDepthStencilValue(1.0f, 0u) };
-    
-    commandBuffer.beginRenderPass(vk::RenderPassBeginInfo()
-                                      .setRenderPass(render_pass)
-                                      .setFramebuffer(frame.framebuffer)
-                                      .setRenderArea(vk::Rect2D(vk::Offset2D {}, vk::Extent2D(width, height)))
-                                      .setClearValueCount(2)
-                                      .setPClearValues(clearValues),
-        vk::SubpassContents::eInline);
-
-    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, frame.descriptor_set,
-        {});
-
-    commandBuffer.setViewport(0, vk::Viewport().setX(0.0f).setY(0.0f).setWidth(static_cast<float>(width)).setHeight(static_cast<float>(height)).setMinDepth(0.0f).setMaxDepth(1.0f));
-
-    commandBuffer.setScissor(0, vk::Rect2D(vk::Offset2D {}, vk::Extent2D(width, height)));
-    //commandBuffer.draw(12 * 3, 1, 0, 0);
-
-    vk::Buffer VertexBuffers[] = {vertex_buffer};
-    vk::DeviceSize Offsets[] = {0};
-    commandBuffer.bindVertexBuffers(0, VertexBuffers, Offsets);
-
-    commandBuffer.draw(static_cast<uint32_t>(demo_cube.size()), 1, 0, 0);
-  
-    // Note that ending the renderpass changes the image's layout from
-    // COLOR_ATTACHMENT_OPTIMAL to PRESENT_SRC_KHR
-    commandBuffer.endRenderPass();
+    begin_rendering(commandBuffer, frame, width, height, vk::ClearColorValue(std::array<float, 4>({ { 0.2f, 0.2f, 0.2f, 0.2f } })));
+
+    // The variants, or their fallback while they compile. Resolved once here on the main thread, the ranges below may
+    // record on other threads. Nothing to draw with skips the draws.
+    const std::array<vk::Pipeline, 2> draw_pipelines = { pipeline_compiler.Resolve(textured_pipeline),
+        pipeline_compiler.Resolve(tinted_pipeline) };
+    const bool can_draw = draw_pipelines[0] && draw_pipelines[1];
+
+    // Secondary command buffers inherit no state, so every range binds its own
+    record_parallel(commandBuffer, frame, can_draw ? object_count : 0,
+        [this, &frame, width, height, draw_pipelines](const vk::CommandBuffer& cmd, uint32_t first, uint32_t count) {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, frame.descriptor_set, {});
+
+            cmd.setViewport(0, vk::Viewport().setX(0.0f).setY(0.0f).setWidth(static_cast<float>(width)).setHeight(static_cast<float>(height)).setMinDepth(0.0f).setMaxDepth(1.0f));
+            cmd.setScissor(0, vk::Rect2D(vk::Offset2D {}, vk::Extent2D(width, height)));
+
+            vk::Buffer VertexBuffers[] = {vertex_buffer.GetBuffer()};
+            vk::DeviceSize Offsets[] = {0};
+            cmd.bindVertexBuffers(0, VertexBuffers, Offsets);
+
+            vk::Pipeline bound_pipeline;
+            for (uint32_t i = first; i < first + count; i++) {
+                // Same layout for every variant, the descriptor set stays bound across the switch
+                const vk::Pipeline object_pipeline = draw_pipelines[i % 2];
+                if (object_pipeline != bound_pipeline) {
+                    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, object_pipeline);
+                    bound_pipeline = object_pipeline;
+                }
+                // The instance index selects the object's constants
+                cmd.draw(static_cast<uint32_t>(demo_cube.size()), 1, 0, i);
+            }
+        });
+
+    end_rendering(commandBuffer, frame);
 }
 
 std::pair<void*, size_t> DemoScene::create_uniform_data()
@@ -185,14 +260,21 @@ void DemoScene::new_frame() {
     controls.on_new_frame();
 }
 
-void DemoScene::update(float dt, void* uniform_memory_ptr)
+void DemoScene::init_sim_state(void* sim_state)
 {
-    // Process input
-    if (glfwGetKey(window_handle, GLFW_KEY_ESCAPE)) {
+    auto& state = *static_cast<DemoSimState*>(sim_state);
+    state = DemoSimState();
+    state.spin_speed = 40.0f;
+}
+
+void DemoScene::process_input(float dt, void* sim_input)
+{
+    // Process input, headless runs have no window and every control stays released
+    if (window_handle && glfwGetKey(window_handle, GLFW_KEY_ESCAPE)) {
         glfwSetWindowShouldClose(window_handle, true);
     }
     auto update_control = [this](int& out_control_state, int keycode) {
-        if (glfwGetKey(this->window_handle, keycode) == GLFW_PRESS) {
+        if (this->window_handle && glfwGetKey(this->window_handle, keycode) == GLFW_PRESS) {
             out_control_state++;
         } else if (out_control_state > 0) {
             out_control_state = -1;
@@ -201,19 +283,69 @@ void DemoScene::update(float dt, void* uniform_memory_ptr)
     update_control(controls.left, GLFW_KEY_LEFT);
     update_control(controls.right, GLFW_KEY_RIGHT);
     update_control(controls.space, GLFW_KEY_SPACE);
+    update_control(controls.memory_stats, GLFW_KEY_M);
+    update_control(controls.load_assets, GLFW_KEY_L);
+    update_control(controls.unload_assets, GLFW_KEY_U);
     
     // Handle inputs
     if (controls.space == -1) {
         pause = !pause;
     }
-    if (!pause) {
-        if (controls.left > 0) {
-            spin_speed -= spin_control * dt;
-        }
-        if (controls.right > 0) {
-            spin_speed += spin_control * dt;
-        }
+    if (controls.memory_stats == -1) {
+        MemoryTracker::PrintStats();
+        DeviceMemoryPool::PrintStats("current");
+    }
+    if (controls.load_assets == -1) {
+        load_streamed_models();
     }
+    if (controls.unload_assets == -1) {
+        unload_streamed_models();
+    }
+
+    auto& input = *static_cast<DemoSimInput*>(sim_input);
+    input.spin_left = controls.left > 0;
+    input.spin_right = controls.right > 0;
+}
+
+void DemoScene::merge_sim_input(void* pending_input, const void* latest_input)
+{
+    // A key held during any of the merged frames still spins for their steps, so a short tap isn't dropped
+    auto& pending = *static_cast<DemoSimInput*>(pending_input);
+    const auto& latest = *static_cast<const DemoSimInput*>(latest_input);
+    pending.spin_left = pending.spin_left || latest.spin_left;
+    pending.spin_right = pending.spin_right || latest.spin_right;
+}
+
+void DemoScene::simulate(float step_dt, const void* sim_input, void* sim_state)
+{
+    const auto& input = *static_cast<const DemoSimInput*>(sim_input);
+    auto& state = *static_cast<DemoSimState*>(sim_state);
+
+    state.previous_spin = state.current_spin;
+
+    // Held keys act once per step, so the result doesn't depend on the frame rate
+    if (input.spin_left) {
+        state.spin_speed -= spin_control * step_dt;
+    }
+    if (input.spin_right) {
+        state.spin_speed += spin_control * step_dt;
+    }
+
+    // Rotate around the Y axis
+    state.current_spin.angle += glm::radians(state.spin_speed) * step_dt;
+
+    // Wrap both states by the same amount so interpolating between them stays continuous
+    const float turn = glm::two_pi<float>();
+    if (state.current_spin.angle > turn || state.current_spin.angle < -turn) {
+        const float wrap = state.current_spin.angle > 0.0f ? turn : -turn;
+        state.current_spin.angle -= wrap;
+        state.previous_spin.angle -= wrap;
+    }
+}
+
+void DemoScene::update(float dt, float alpha, const void* sim_state, void* uniform_memory_ptr)
+{
+    const auto& state = *static_cast<const DemoSimState*>(sim_state);
 
     // Recalculate projection matrix to handle window resize
     projection_matrix = glm::perspective(glm::radians(45.0f), aspect_ratio, 0.1f, 100.0f);
@@ -222,21 +354,36 @@ void DemoScene::update(float dt, void* uniform_memory_ptr)
 
     glm::mat4 VP = projection_matrix * view_matrix;
 
-    // Rotate around the Y axis
-    model_matrix = glm::rotate(model_matrix, glm::radians(spin_speed) * dt, glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // Orthonormalize rotation part of matrix (optional)
-    glm::vec3 xAxis = glm::normalize(glm::vec3(model_matrix[0]));
-    glm::vec3 yAxis = glm::normalize(glm::vec3(model_matrix[1]));
-    glm::vec3 zAxis = glm::normalize(glm::vec3(model_matrix[2]));
-
-    model_matrix[0] = glm::vec4(xAxis, 0.0f);
-    model_matrix[1] = glm::vec4(yAxis, 0.0f);
-    model_matrix[2] = glm::vec4(zAxis, 0.0f);
+    // Render between the last two simulation steps
+    const float angle = glm::mix(state.previous_spin.angle, state.current_spin.angle, alpha);
+    scene_graph.SetRotation(turntable_node, glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f)));
+    // Recomputes the turntable's subtree, anything not below a changed node keeps its world matrix
+    scene_graph.Update();
+    model_matrix = scene_graph.GetWorldMatrix(turntable_node);
 
     uniform_data.model = model_matrix;
+    // write_object_constants() builds every object's mvp from it, with --per_vertex_matrices the vertex shader does
     uniform_data.viewproj = VP;
 
-    // Update mapped memory with uniform_data
-    memcpy(uniform_memory_ptr, &uniform_data, sizeof(UBO_Textured));
-}
\ No newline at end of file
+    // Null when no shader reads the uniform buffer
+    if (uniform_memory_ptr) {
+        memcpy(uniform_memory_ptr, &uniform_data, sizeof(UBO_Textured));
+    }
+}
+
+void DemoScene::write_object_constants(void* object_memory_ptr)
+{
+    if (per_vertex_matrices) {
+        // Only the placement on the turntable, the vertex shader applies the spin and the camera itself
+        const glm::mat4* locals = scene_graph.GetLocalMatrices() + first_object_node;
+        auto* constants = static_cast<ObjectConstants*>(object_memory_ptr);
+        for (uint32_t i = 0; i < object_count; i++) {
+            constants[i].mvp = locals[i];
+        }
+        return;
+    }
+
+    // One batch over every object, straight into the mapped buffer. The spin is already in their world matrices.
+    TransformBatch::ComputeObjectConstants(uniform_data.viewproj, glm::mat4(1.0f), scene_graph.GetWorldMatrices() + first_object_node, object_count,
+        static_cast<ObjectConstants*>(object_memory_ptr));
+}
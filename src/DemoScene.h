@@ -1,6 +1,9 @@
 #pragma once
 
 #include "scene.h"
+#include "BufferFactory.h"
+#include "TransformBatch.h"
+#include "SceneGraph.h"
 
 struct UBO_Textured {
     glm::mat4 model;
@@ -8,6 +11,18 @@ struct UBO_Textured {
 };
 
 
+// Feature switches of textured.frag, each combination in use is a pipeline of its own
+struct TexturedVariant {
+    bool alpha_test = false;
+    bool vertex_color = false;
+    uint32_t texture_count = 1;
+
+    // The shader's constant_id 0, 1 and 2, request_variant() adds 3 for --per_vertex_matrices
+    std::vector<uint32_t> get_specialization() const { return { alpha_test ? 1u : 0u, vertex_color ? 1u : 0u, texture_count }; }
+    // For the pipeline stats, e.g. "textured[alpha_test]"
+    std::string get_name() const;
+};
+
 // Input structure
 // key that isn't down or released has a value of 0
 // when key is pressed, its value is incremented every frame.
@@ -16,6 +31,9 @@ struct SceneControls {
     int left = 0;
     int right = 0;
     int space = 0;
+    int memory_stats = 0;
+    int load_assets = 0;
+    int unload_assets = 0;
 
     // called in main loop to reset state, clears released state (-1) from last frame
     void on_new_frame()
@@ -29,9 +47,36 @@ struct SceneControls {
         if (space == -1) {
             space = 0;
         }
+        if (memory_stats == -1) {
+            memory_stats = 0;
+        }
+        if (load_assets == -1) {
+            load_assets = 0;
+        }
+        if (unload_assets == -1) {
+            unload_assets = 0;
+        }
     }
 };
 
+// What the simulation reads from the main thread each frame
+struct DemoSimInput {
+    bool spin_left = false;
+    bool spin_right = false;
+};
+
+struct SpinState {
+    // Radians around the Y axis, kept within one turn
+    float angle = 0.0f;
+};
+
+// Everything simulate() advances. Rendering interpolates between the previous and current step.
+struct DemoSimState {
+    float spin_speed = 0.0f;
+    SpinState previous_spin;
+    SpinState current_spin;
+};
+
 class DemoScene : public Scene {
 protected:
     virtual void init_scene() override;
@@ -41,28 +86,64 @@ protected:
     
     // Called N times. each frame in-flight has its own command buffer that needs to be populated
     virtual void populate_command_buffer(const vk::CommandBuffer& cmd, const FrameResources& frame, uint32_t width, uint32_t height) override;
+    virtual uint64_t get_content_version() override { return content_version; }
 
     virtual std::pair<void*, size_t> create_uniform_data() override;
     virtual size_t get_uniform_buffer_size() override { return sizeof UBO_Textured; }
+    virtual size_t get_object_buffer_size() override { return object_count * sizeof(ObjectConstants); }
+    virtual void write_object_constants(void* object_memory_ptr) override;
+    virtual std::vector<std::string> get_pipeline_shaders() override;
 
     virtual void new_frame() override;
-    virtual void update(float dt, void* uniform_memory_ptr) override;
+    virtual size_t get_sim_input_size() override { return sizeof(DemoSimInput); }
+    virtual size_t get_sim_state_size() override { return sizeof(DemoSimState); }
+    virtual void init_sim_state(void* sim_state) override;
+    virtual void process_input(float dt, void* sim_input) override;
+    virtual void merge_sim_input(void* pending_input, const void* latest_input) override;
+    virtual void simulate(float step_dt, const void* sim_input, void* sim_state) override;
+    virtual void update(float dt, float alpha, const void* sim_state, void* uniform_memory_ptr) override;
 
 private:
-    // Staging uniform data, will be copied to device-mapped memory ptr to update uniform data
+    // Staging uniform data, copied to device-mapped memory when a shader reads the uniform buffer
     UBO_Textured uniform_data;
     
-    vk::Buffer          vertex_buffer;
-    vk::DeviceMemory    vertex_buffer_memory;
+    StaticBuffer        vertex_buffer;
+
+    // Everything but the variant, filled in by create_graphics_pipelines()
+    PipelineStateKey    textured_state;
+    uint32_t request_variant(const TexturedVariant& variant, bool async, uint32_t fallback = PipelineCompiler::NoPipeline);
+    // Headless: build every variant and confirm each got a pipeline of its own
+    void check_variants();
+
+    // Pipeline compiler ids, re-created with the render pass. Every other object draws alpha tested and tinted.
+    uint32_t            untextured_pipeline = PipelineCompiler::NoPipeline;
+    uint32_t            textured_pipeline = PipelineCompiler::NoPipeline;
+    uint32_t            tinted_pipeline = PipelineCompiler::NoPipeline;
+
+    // The cubes are children of a turntable node carrying the spin, placed on a grid. Only the subtrees that changed
+    // are recomputed and combined with the camera into each object's constants every frame. Draws only carry the
+    // object index, so recorded commands stay valid.
+    SceneGraph scene_graph;
+    uint32_t turntable_node = SceneGraph::NoParent;
+    // Added one after the other, so the cubes' world matrices are contiguous from here
+    uint32_t first_object_node = 0;
+    void build_object_grid();
 
 private:
     SceneControls controls;
 
-    float spin_speed = 0.0f;
-    float spin_control = 0.0f;
+    // Spin acceleration while an arrow key is held, degrees per second squared
+    static constexpr float spin_control = 120.0f;
 
     std::unique_ptr<MeshModel> m_model;
 
+    // Loaded and unloaded at runtime to exercise the memory pool and its defragmenter
+    std::vector<std::unique_ptr<MeshModel>> streamed_models;
+    void load_streamed_models();
+    void unload_streamed_models();
+    // Bumped whenever the objects or the models change, so commands recorded once are recorded again
+    uint64_t content_version = 0;
+
     // Camera
     glm::vec3 eye { 0.0f, 3.0f, 5.0f };
     glm::vec3 origin { 0, 0, 0 };
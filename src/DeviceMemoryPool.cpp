@@ -0,0 +1,792 @@
+#include "DeviceMemoryPool.h"
+#include "GpuTimeline.h"
+
+#include <algorithm>
+
+vk::PhysicalDevice DeviceMemoryPool::Gpu;
+vk::Device DeviceMemoryPool::Device;
+vk::CommandPool DeviceMemoryPool::CommandPool;
+vk::PhysicalDeviceMemoryProperties DeviceMemoryPool::MemoryProperties;
+
+std::recursive_mutex DeviceMemoryPool::Mutex;
+std::vector<DeviceMemoryPool::Block> DeviceMemoryPool::Blocks;
+std::vector<DeviceMemoryPool::Allocation> DeviceMemoryPool::Allocations;
+std::vector<uint32_t> DeviceMemoryPool::FreeAllocationSlots;
+
+bool DeviceMemoryPool::Defragmenting = false;
+std::vector<uint32_t> DeviceMemoryPool::MoveQueue;
+size_t DeviceMemoryPool::NextMove = 0;
+std::vector<DeviceMemoryPool::PendingMove> DeviceMemoryPool::PendingMoves;
+vk::CommandBuffer DeviceMemoryPool::BatchCmd;
+uint64_t DeviceMemoryPool::BatchValue = 0;
+uint32_t DeviceMemoryPool::DefragmentFrames = 0;
+
+DeviceMemoryPool::DeviceMemoryPool() {}
+DeviceMemoryPool::~DeviceMemoryPool() {}
+
+static vk::DeviceSize AlignUp(vk::DeviceSize Value, vk::DeviceSize Alignment)
+{
+	return (Value + Alignment - 1) / Alignment * Alignment;
+}
+
+static bool IsMovable(vk::BufferUsageFlags Usage)
+{
+	return (Usage & vk::BufferUsageFlagBits::eTransferSrc) && (Usage & vk::BufferUsageFlagBits::eTransferDst);
+}
+
+static bool IsMovable(vk::ImageUsageFlags Usage)
+{
+	return (Usage & vk::ImageUsageFlagBits::eTransferSrc) && (Usage & vk::ImageUsageFlagBits::eTransferDst);
+}
+
+void DeviceMemoryPool::Init(vk::PhysicalDevice InGpu, vk::Device InDevice, uint32_t QueueFamilyIndex)
+{
+	Gpu = InGpu;
+	Device = InDevice;
+	MemoryProperties = Gpu.getMemoryProperties();
+
+	auto cmd_pool_return = Device.createCommandPool(vk::CommandPoolCreateInfo()
+														.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+														.setQueueFamilyIndex(QueueFamilyIndex));
+	VERIFY(cmd_pool_return.result == vk::Result::eSuccess);
+	CommandPool = cmd_pool_return.value;
+}
+
+void DeviceMemoryPool::Shutdown()
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+	if (BatchCmd) {
+		GpuTimeline::Wait(BatchValue);
+		Device.freeCommandBuffers(CommandPool, BatchCmd);
+		BatchCmd = vk::CommandBuffer();
+	}
+	while (!PendingMoves.empty()) {
+		CancelMove(PendingMoves.back().index);
+	}
+	MoveQueue.clear();
+	Defragmenting = false;
+
+	for (uint32_t i = 0; i < Allocations.size(); i++) {
+		auto& Entry = Allocations[i];
+		if (!Entry.live) {
+			continue;
+		}
+		fprintf(stderr, "Pooled resource was never destroyed: %" PRIu64 " bytes%s%s\n", static_cast<uint64_t>(Entry.size),
+			Entry.tag.empty() ? "" : ", tag ", Entry.tag.c_str());
+		PoolHandle Handle { i, Entry.generation };
+		Destroy(Handle);
+	}
+	// Destroy() only queues the release, run it and anything else still waiting on the GPU
+	GpuTimeline::WaitIdle();
+
+	// Empty blocks are released as they empty, this only catches what Destroy() couldn't
+	for (uint32_t i = 0; i < Blocks.size(); i++) {
+		if (Blocks[i].memory) {
+			ReleaseBlock(i);
+		}
+	}
+	Blocks.clear();
+	Allocations.clear();
+	FreeAllocationSlots.clear();
+
+	Device.destroyCommandPool(CommandPool);
+	CommandPool = vk::CommandPool();
+}
+
+uint32_t DeviceMemoryPool::CreateBlock(vk::DeviceSize Size, uint32_t MemoryTypeIndex, MemoryCategory Category, ResourceKind Kind, bool Dedicated)
+{
+	Block NewBlock;
+	NewBlock.size = Size;
+	NewBlock.memory_type = MemoryTypeIndex;
+	NewBlock.category = Category;
+	NewBlock.kind = Kind;
+	NewBlock.dedicated = Dedicated;
+	NewBlock.free_ranges.push_back({ 0, Size });
+
+	auto const mem_alloc = vk::MemoryAllocateInfo().setAllocationSize(Size).setMemoryTypeIndex(MemoryTypeIndex);
+	auto result = MemoryTracker::Allocate(mem_alloc, Category, NewBlock.memory, Dedicated ? "pool dedicated block" : "pool block");
+	if (result != vk::Result::eSuccess) {
+		return UINT32_MAX;
+	}
+
+	// Host-visible blocks stay mapped for their whole lifetime
+	if (MemoryProperties.memoryTypes[MemoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+		void* mapped = nullptr;
+		result = Device.mapMemory(NewBlock.memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &mapped);
+		VERIFY(result == vk::Result::eSuccess);
+		NewBlock.mapped = static_cast<uint8_t*>(mapped);
+	}
+
+	// Reuse the slot of a released block so block indices stored in allocations stay small
+	for (uint32_t i = 0; i < Blocks.size(); i++) {
+		if (!Blocks[i].memory) {
+			Blocks[i] = std::move(NewBlock);
+			return i;
+		}
+	}
+	Blocks.push_back(std::move(NewBlock));
+	return static_cast<uint32_t>(Blocks.size() - 1);
+}
+
+void DeviceMemoryPool::ReleaseBlock(uint32_t BlockIndex)
+{
+	auto& Target = Blocks[BlockIndex];
+	if (Target.mapped) {
+		Device.unmapMemory(Target.memory);
+	}
+	MemoryTracker::Free(Target.memory);
+	Target = Block();
+}
+
+bool DeviceMemoryPool::AllocateRange(const vk::MemoryRequirements& Requirements, uint32_t MemoryTypeIndex, MemoryCategory Category, ResourceKind Kind, bool AllowNewBlock, uint32_t& OutBlock, vk::DeviceSize& OutOffset)
+{
+	if (Requirements.size > POOL_BLOCK_SIZE / 2) {
+		if (!AllowNewBlock) {
+			return false;
+		}
+		// Large resources would waste most of a shared block, give them their own
+		OutBlock = CreateBlock(Requirements.size, MemoryTypeIndex, Category, Kind, true);
+		if (OutBlock == UINT32_MAX) {
+			return false;
+		}
+		OutOffset = 0;
+		Blocks[OutBlock].free_ranges.clear();
+		Blocks[OutBlock].used = Requirements.size;
+		Blocks[OutBlock].allocation_count = 1;
+		return true;
+	}
+
+	// Best fit over every compatible block: the smallest free range the resource fits in
+	uint32_t best_block = UINT32_MAX;
+	size_t best_range = 0;
+	vk::DeviceSize best_size = 0;
+	for (uint32_t b = 0; b < Blocks.size(); b++) {
+		const auto& Candidate = Blocks[b];
+		if (!Candidate.memory || Candidate.dedicated || Candidate.evacuating || Candidate.memory_type != MemoryTypeIndex ||
+			Candidate.category != Category || Candidate.kind != Kind) {
+			continue;
+		}
+		for (size_t r = 0; r < Candidate.free_ranges.size(); r++) {
+			const auto& Range = Candidate.free_ranges[r];
+			const vk::DeviceSize aligned = AlignUp(Range.offset, Requirements.alignment);
+			if (aligned + Requirements.size > Range.offset + Range.size) {
+				continue;
+			}
+			if (best_block == UINT32_MAX || Range.size < best_size) {
+				best_block = b;
+				best_range = r;
+				best_size = Range.size;
+			}
+		}
+	}
+
+	if (best_block == UINT32_MAX) {
+		if (!AllowNewBlock) {
+			return false;
+		}
+		best_block = CreateBlock(POOL_BLOCK_SIZE, MemoryTypeIndex, Category, Kind, false);
+		if (best_block == UINT32_MAX) {
+			return false;
+		}
+		best_range = 0;
+	}
+
+	auto& Target = Blocks[best_block];
+	const FreeRange Range = Target.free_ranges[best_range];
+	const vk::DeviceSize aligned = AlignUp(Range.offset, Requirements.alignment);
+	const vk::DeviceSize end = aligned + Requirements.size;
+
+	// Split the range, keeping the alignment padding and the tail free
+	Target.free_ranges.erase(Target.free_ranges.begin() + best_range);
+	if (end < Range.offset + Range.size) {
+		Target.free_ranges.insert(Target.free_ranges.begin() + best_range, FreeRange { end, Range.offset + Range.size - end });
+	}
+	if (aligned > Range.offset) {
+		Target.free_ranges.insert(Target.free_ranges.begin() + best_range, FreeRange { Range.offset, aligned - Range.offset });
+	}
+
+	Target.used += Requirements.size;
+	Target.allocation_count++;
+
+	OutBlock = best_block;
+	OutOffset = aligned;
+	return true;
+}
+
+void DeviceMemoryPool::FreeRangeInBlock(uint32_t BlockIndex, vk::DeviceSize Offset, vk::DeviceSize Size)
+{
+	auto& Target = Blocks[BlockIndex];
+	assert(Target.allocation_count > 0 && Target.used >= Size);
+	Target.used -= Size;
+	Target.allocation_count--;
+
+	if (Target.allocation_count == 0 && !Target.evacuating) {
+		// Nothing left in it, hand the memory back right away. Evacuated blocks are released by CommitDefragment().
+		ReleaseBlock(BlockIndex);
+		return;
+	}
+
+	auto It = std::lower_bound(Target.free_ranges.begin(), Target.free_ranges.end(), Offset,
+		[](const FreeRange& Range, vk::DeviceSize Value) { return Range.offset < Value; });
+	It = Target.free_ranges.insert(It, FreeRange { Offset, Size });
+
+	// Merge with the following range, then with the previous one
+	auto Next = It + 1;
+	if (Next != Target.free_ranges.end() && It->offset + It->size == Next->offset) {
+		It->size += Next->size;
+		Target.free_ranges.erase(Next);
+	}
+	if (It != Target.free_ranges.begin()) {
+		auto Prev = It - 1;
+		if (Prev->offset + Prev->size == It->offset) {
+			Prev->size += It->size;
+			Target.free_ranges.erase(It);
+		}
+	}
+}
+
+PoolHandle DeviceMemoryPool::Bind(Allocation&& Entry, const vk::MemoryRequirements& Requirements, uint32_t MemoryTypeIndex, MemoryCategory Category)
+{
+	uint32_t block = 0;
+	vk::DeviceSize offset = 0;
+	if (!AllocateRange(Requirements, MemoryTypeIndex, Category, Entry.kind, true, block, offset)) {
+		return PoolHandle();
+	}
+
+	vk::Result result;
+	if (Entry.kind == ResourceKind::Buffer) {
+		result = Device.bindBufferMemory(Entry.buffer, Blocks[block].memory, offset);
+	} else {
+		result = Device.bindImageMemory(Entry.image, Blocks[block].memory, offset);
+	}
+	VERIFY(result == vk::Result::eSuccess);
+
+	Entry.live = true;
+	Entry.block = block;
+	Entry.offset = offset;
+	Entry.size = Requirements.size;
+
+	uint32_t index;
+	if (!FreeAllocationSlots.empty()) {
+		index = FreeAllocationSlots.back();
+		FreeAllocationSlots.pop_back();
+		Entry.generation = Allocations[index].generation + 1;
+		Allocations[index] = std::move(Entry);
+	} else {
+		index = static_cast<uint32_t>(Allocations.size());
+		Entry.generation = 0;
+		Allocations.push_back(std::move(Entry));
+	}
+
+	return PoolHandle { index, Allocations[index].generation };
+}
+
+PoolHandle DeviceMemoryPool::BindBuffer(vk::Buffer Buffer, const vk::BufferCreateInfo& Info, uint32_t MemoryTypeIndex, MemoryCategory Category, const char* Tag)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+	vk::MemoryRequirements mem_reqs;
+	Device.getBufferMemoryRequirements(Buffer, &mem_reqs);
+
+	Allocation Entry;
+	Entry.kind = ResourceKind::Buffer;
+	Entry.buffer = Buffer;
+	Entry.buffer_info = Info;
+	Entry.buffer_info.setPNext(nullptr);
+	Entry.movable = IsMovable(Info.usage) && Info.sharingMode == vk::SharingMode::eExclusive;
+	Entry.tag = Tag ? Tag : "";
+
+	return Bind(std::move(Entry), mem_reqs, MemoryTypeIndex, Category);
+}
+
+PoolHandle DeviceMemoryPool::BindImage(vk::Image Image, const vk::ImageCreateInfo& Info, uint32_t MemoryTypeIndex, MemoryCategory Category, const char* Tag)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+	vk::MemoryRequirements mem_reqs;
+	Device.getImageMemoryRequirements(Image, &mem_reqs);
+
+	Allocation Entry;
+	Entry.kind = Info.tiling == vk::ImageTiling::eLinear ? ResourceKind::LinearImage : ResourceKind::OptimalImage;
+	Entry.image = Image;
+	Entry.image_info = Info;
+	Entry.image_info.setPNext(nullptr);
+	Entry.layout = Info.initialLayout;
+	// Only color images are moved, the copy doesn't deal with depth/stencil aspects
+	Entry.movable = IsMovable(Info.usage) && Info.sharingMode == vk::SharingMode::eExclusive && Info.samples == vk::SampleCountFlagBits::e1 &&
+					!(Info.usage & vk::ImageUsageFlagBits::eDepthStencilAttachment);
+	Entry.tag = Tag ? Tag : "";
+
+	return Bind(std::move(Entry), mem_reqs, MemoryTypeIndex, Category);
+}
+
+DeviceMemoryPool::Allocation* DeviceMemoryPool::Resolve(PoolHandle Handle)
+{
+	if (!Handle.IsValid() || Handle.index >= Allocations.size()) {
+		return nullptr;
+	}
+	auto& Entry = Allocations[Handle.index];
+	if (!Entry.live || Entry.generation != Handle.generation) {
+		return nullptr;
+	}
+	return &Entry;
+}
+
+void DeviceMemoryPool::Destroy(PoolHandle& Handle)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+	auto* Entry = Resolve(Handle);
+	if (Entry == nullptr) {
+		Handle = PoolHandle();
+		return;
+	}
+
+	if (Defragmenting) {
+		CancelMove(Handle.index);
+	}
+
+	// Frames in flight may still read the resource, keep it and its range until the GPU is past them.
+	// The handle dies right away.
+	const vk::Buffer buffer = Entry->buffer;
+	const vk::Image image = Entry->image;
+	const uint32_t block = Entry->block;
+	const vk::DeviceSize offset = Entry->offset;
+	const vk::DeviceSize size = Entry->size;
+	GpuTimeline::DeferRelease([buffer, image, block, offset, size]() {
+		std::lock_guard<std::recursive_mutex> Lock(Mutex);
+		Device.destroyBuffer(buffer);
+		Device.destroyImage(image);
+		FreeRangeInBlock(block, offset, size);
+	});
+
+	const uint32_t generation = Entry->generation;
+	*Entry = Allocation();
+	Entry->generation = generation;
+	FreeAllocationSlots.push_back(Handle.index);
+
+	Handle = PoolHandle();
+}
+
+vk::Buffer DeviceMemoryPool::GetBuffer(PoolHandle Handle)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+	auto* Entry = Resolve(Handle);
+	return Entry ? Entry->buffer : vk::Buffer();
+}
+
+vk::Image DeviceMemoryPool::GetImage(PoolHandle Handle)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+	auto* Entry = Resolve(Handle);
+	return Entry ? Entry->image : vk::Image();
+}
+
+void* DeviceMemoryPool::GetMappedPointer(PoolHandle Handle)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+	auto* Entry = Resolve(Handle);
+	if (Entry == nullptr || Blocks[Entry->block].mapped == nullptr) {
+		return nullptr;
+	}
+	return Blocks[Entry->block].mapped + Entry->offset;
+}
+
+void DeviceMemoryPool::SetImageLayout(PoolHandle Handle, vk::ImageLayout Layout)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+	auto* Entry = Resolve(Handle);
+	assert(Entry && Entry->kind != ResourceKind::Buffer);
+	Entry->layout = Layout;
+}
+
+void DeviceMemoryPool::SetMoveCallback(PoolHandle Handle, PoolMoveCallback Callback)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+	auto* Entry = Resolve(Handle);
+	assert(Entry);
+	Entry->on_moved = std::move(Callback);
+}
+
+bool DeviceMemoryPool::BeginDefragment()
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+	if (Defragmenting) {
+		return true;
+	}
+
+	// Blocks holding a resource that can't be copied can never be emptied. Images also need a known resting layout
+	// to be copied and handed back in.
+	std::vector<bool> pinned(Blocks.size(), false);
+	for (const auto& Entry : Allocations) {
+		const bool layout_known = Entry.kind == ResourceKind::Buffer ||
+								  (Entry.layout != vk::ImageLayout::eUndefined && Entry.layout != vk::ImageLayout::ePreinitialized);
+		if (Entry.live && (!Entry.movable || !layout_known)) {
+			pinned[Entry.block] = true;
+		}
+	}
+
+	bool any_evacuating = false;
+	std::vector<bool> visited(Blocks.size(), false);
+	for (uint32_t first = 0; first < Blocks.size(); first++) {
+		if (!Blocks[first].memory || Blocks[first].dedicated || visited[first]) {
+			continue;
+		}
+
+		// Gather every block sharing this block's memory type, category and kind
+		std::vector<uint32_t> group;
+		for (uint32_t b = first; b < Blocks.size(); b++) {
+			const auto& Candidate = Blocks[b];
+			if (Candidate.memory && !Candidate.dedicated && Candidate.memory_type == Blocks[first].memory_type &&
+				Candidate.category == Blocks[first].category && Candidate.kind == Blocks[first].kind) {
+				group.push_back(b);
+				visited[b] = true;
+			}
+		}
+		if (group.size() < 2) {
+			continue;
+		}
+
+		vk::DeviceSize free_in_kept = 0;
+		std::vector<uint32_t> sparse;
+		for (uint32_t b : group) {
+			const auto& Candidate = Blocks[b];
+			free_in_kept += Candidate.size - Candidate.used;
+			if (!pinned[b] && static_cast<float>(Candidate.used) < DEFRAG_SPARSE_OCCUPANCY * static_cast<float>(Candidate.size)) {
+				sparse.push_back(b);
+			}
+		}
+
+		// Empty the sparsest blocks first, as long as what's left of the group can take their contents. Only an
+		// estimate: it counts free bytes, not ranges, so with fragmented receivers some moves may not fit. RecordMove()
+		// leaves those where they are and their block isn't released.
+		std::sort(sparse.begin(), sparse.end(), [](uint32_t a, uint32_t b) { return Blocks[a].used < Blocks[b].used; });
+		vk::DeviceSize moving = 0;
+		size_t kept = group.size();
+		for (uint32_t b : sparse) {
+			const auto& Candidate = Blocks[b];
+			const vk::DeviceSize free_after = free_in_kept - (Candidate.size - Candidate.used);
+			if (kept <= 1 || free_after < moving + Candidate.used) {
+				break;
+			}
+			free_in_kept = free_after;
+			moving += Candidate.used;
+			kept--;
+			Blocks[b].evacuating = true;
+			any_evacuating = true;
+		}
+	}
+
+	if (!any_evacuating) {
+		return false;
+	}
+
+	PrintStats("before defragmentation");
+
+	MoveQueue.clear();
+	for (uint32_t i = 0; i < Allocations.size(); i++) {
+		if (Allocations[i].live && Blocks[Allocations[i].block].evacuating) {
+			MoveQueue.push_back(i);
+		}
+	}
+	// Largest first packs the receiving blocks tighter
+	std::sort(MoveQueue.begin(), MoveQueue.end(), [](uint32_t a, uint32_t b) { return Allocations[a].size > Allocations[b].size; });
+
+	NextMove = 0;
+	DefragmentFrames = 0;
+	Defragmenting = true;
+	return true;
+}
+
+void DeviceMemoryPool::RecordMove(uint32_t Index, vk::CommandBuffer Cmd)
+{
+	auto& Entry = Allocations[Index];
+
+	PendingMove Move;
+	Move.index = Index;
+
+	vk::MemoryRequirements mem_reqs;
+	vk::Result result;
+	if (Entry.kind == ResourceKind::Buffer) {
+		result = Device.createBuffer(&Entry.buffer_info, nullptr, &Move.buffer);
+		VERIFY(result == vk::Result::eSuccess);
+		Device.getBufferMemoryRequirements(Move.buffer, &mem_reqs);
+	} else {
+		// The copy overwrites the whole image, its previous contents don't matter
+		auto image_info = Entry.image_info;
+		image_info.setInitialLayout(vk::ImageLayout::eUndefined);
+		result = Device.createImage(&image_info, nullptr, &Move.image);
+		VERIFY(result == vk::Result::eSuccess);
+		Device.getImageMemoryRequirements(Move.image, &mem_reqs);
+	}
+
+	// Only into free ranges of the blocks that are kept, a new block would grow the pool instead of compacting it
+	const auto& Source = Blocks[Entry.block];
+	if (!AllocateRange(mem_reqs, Source.memory_type, Source.category, Entry.kind, false, Move.block, Move.offset)) {
+		// No free range fits, leave this one where it is
+		Device.destroyBuffer(Move.buffer);
+		Device.destroyImage(Move.image);
+		return;
+	}
+	Move.size = mem_reqs.size;
+
+	if (Entry.kind == ResourceKind::Buffer) {
+		result = Device.bindBufferMemory(Move.buffer, Blocks[Move.block].memory, Move.offset);
+		VERIFY(result == vk::Result::eSuccess);
+
+		Cmd.copyBuffer(Entry.buffer, Move.buffer, vk::BufferCopy(0, 0, Entry.buffer_info.size));
+	} else {
+		result = Device.bindImageMemory(Move.image, Blocks[Move.block].memory, Move.offset);
+		VERIFY(result == vk::Result::eSuccess);
+
+		const auto& info = Entry.image_info;
+		auto const range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, info.mipLevels, 0, info.arrayLayers);
+
+		// Frames still in flight keep sampling the old copy, hand it back in its resting layout afterwards
+		std::array<vk::ImageMemoryBarrier, 2> const to_transfer = {
+			vk::ImageMemoryBarrier()
+				.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+				.setOldLayout(Entry.layout)
+				.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(Entry.image)
+				.setSubresourceRange(range),
+			vk::ImageMemoryBarrier()
+				.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setOldLayout(vk::ImageLayout::eUndefined)
+				.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(Move.image)
+				.setSubresourceRange(range)
+		};
+		Cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), {}, {}, to_transfer);
+
+		std::vector<vk::ImageCopy> regions;
+		for (uint32_t mip = 0; mip < info.mipLevels; mip++) {
+			auto const layers = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, mip, 0, info.arrayLayers);
+			auto const extent = vk::Extent3D((info.extent.width >> mip) > 0 ? info.extent.width >> mip : 1,
+				(info.extent.height >> mip) > 0 ? info.extent.height >> mip : 1, (info.extent.depth >> mip) > 0 ? info.extent.depth >> mip : 1);
+			regions.push_back(vk::ImageCopy(layers, vk::Offset3D(), layers, vk::Offset3D(), extent));
+		}
+		Cmd.copyImage(Entry.image, vk::ImageLayout::eTransferSrcOptimal, Move.image, vk::ImageLayout::eTransferDstOptimal, regions);
+
+		std::array<vk::ImageMemoryBarrier, 2> const to_resting = {
+			vk::ImageMemoryBarrier()
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferRead)
+				.setDstAccessMask(vk::AccessFlagBits::eMemoryRead)
+				.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+				.setNewLayout(Entry.layout)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(Entry.image)
+				.setSubresourceRange(range),
+			vk::ImageMemoryBarrier()
+				.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+				.setDstAccessMask(vk::AccessFlagBits::eMemoryRead)
+				.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+				.setNewLayout(Entry.layout)
+				.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+				.setImage(Move.image)
+				.setSubresourceRange(range)
+		};
+		Cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), {}, {}, to_resting);
+	}
+
+	PendingMoves.push_back(Move);
+}
+
+void DeviceMemoryPool::CancelMove(uint32_t Index)
+{
+	// Still queued: just drop it
+	for (size_t i = NextMove; i < MoveQueue.size(); i++) {
+		if (MoveQueue[i] == Index) {
+			MoveQueue.erase(MoveQueue.begin() + i);
+			return;
+		}
+	}
+
+	// Already copied: throw the new copy away. Its copy may still be executing if the batch hasn't completed.
+	auto It = std::find_if(PendingMoves.begin(), PendingMoves.end(), [Index](const PendingMove& Move) { return Move.index == Index; });
+	if (It == PendingMoves.end()) {
+		return;
+	}
+	if (BatchCmd) {
+		GpuTimeline::Wait(BatchValue);
+	}
+	Device.destroyBuffer(It->buffer);
+	Device.destroyImage(It->image);
+	FreeRangeInBlock(It->block, It->offset, It->size);
+	PendingMoves.erase(It);
+}
+
+bool DeviceMemoryPool::DefragmentStep(vk::DeviceSize ByteBudget)
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+	if (!Defragmenting) {
+		return false;
+	}
+	DefragmentFrames++;
+
+	if (BatchCmd) {
+		// Don't stall the frame on the copies, check again next frame
+		if (!GpuTimeline::IsComplete(BatchValue)) {
+			return false;
+		}
+		Device.freeCommandBuffers(CommandPool, BatchCmd);
+		BatchCmd = vk::CommandBuffer();
+	}
+
+	if (NextMove >= MoveQueue.size()) {
+		return true;
+	}
+
+	auto cmd_return = Device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+														.setCommandPool(CommandPool)
+														.setLevel(vk::CommandBufferLevel::ePrimary)
+														.setCommandBufferCount(1));
+	VERIFY(cmd_return.result == vk::Result::eSuccess);
+	BatchCmd = cmd_return.value[0];
+
+	auto result = BatchCmd.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	VERIFY(result == vk::Result::eSuccess);
+
+	// Always move at least one resource so a resource larger than the budget still makes progress
+	vk::DeviceSize copied = 0;
+	while (NextMove < MoveQueue.size() && (copied == 0 || copied + Allocations[MoveQueue[NextMove]].size <= ByteBudget)) {
+		const uint32_t index = MoveQueue[NextMove++];
+		copied += Allocations[index].size;
+		RecordMove(index, BatchCmd);
+	}
+
+	// Make the buffer copies visible to whatever reads the new copies later
+	BatchCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(),
+		vk::MemoryBarrier().setSrcAccessMask(vk::AccessFlagBits::eTransferWrite).setDstAccessMask(vk::AccessFlagBits::eMemoryRead), {}, {});
+
+	result = BatchCmd.end();
+	VERIFY(result == vk::Result::eSuccess);
+
+	BatchValue = GpuTimeline::Submit(vk::SubmitInfo().setCommandBuffers(BatchCmd));
+
+	return false;
+}
+
+void DeviceMemoryPool::CommitDefragment()
+{
+	std::vector<std::pair<PoolHandle, PoolMoveCallback>> callbacks;
+	{
+		std::lock_guard<std::recursive_mutex> Lock(Mutex);
+
+		if (!Defragmenting) {
+			return;
+		}
+		if (BatchCmd) {
+			GpuTimeline::Wait(BatchValue);
+			Device.freeCommandBuffers(CommandPool, BatchCmd);
+			BatchCmd = vk::CommandBuffer();
+		}
+		// Anything not copied yet stays where it is, its block just isn't released
+		MoveQueue.clear();
+		NextMove = 0;
+
+		vk::DeviceSize moved_bytes = 0;
+		for (const auto& Move : PendingMoves) {
+			auto& Entry = Allocations[Move.index];
+
+			// Swap in the new copy and retire the old one
+			if (Entry.kind == ResourceKind::Buffer) {
+				Device.destroyBuffer(Entry.buffer);
+				Entry.buffer = Move.buffer;
+			} else {
+				Device.destroyImage(Entry.image);
+				Entry.image = Move.image;
+			}
+			FreeRangeInBlock(Entry.block, Entry.offset, Entry.size);
+			Entry.block = Move.block;
+			Entry.offset = Move.offset;
+			Entry.size = Move.size;
+			moved_bytes += Move.size;
+
+			if (Entry.on_moved) {
+				callbacks.emplace_back(PoolHandle { Move.index, Entry.generation }, Entry.on_moved);
+			}
+		}
+
+		uint32_t released_blocks = 0;
+		for (uint32_t b = 0; b < Blocks.size(); b++) {
+			if (!Blocks[b].memory || !Blocks[b].evacuating) {
+				continue;
+			}
+			Blocks[b].evacuating = false;
+			if (Blocks[b].allocation_count == 0) {
+				ReleaseBlock(b);
+				released_blocks++;
+			}
+		}
+
+		printf("Defragmentation moved %zu resources (%" PRIu64 " KiB) over %u frames and released %u blocks\n", PendingMoves.size(),
+			static_cast<uint64_t>(moved_bytes / 1024), DefragmentFrames, released_blocks);
+		PrintStats("after defragmentation");
+
+		PendingMoves.clear();
+		Defragmenting = false;
+	}
+
+	// Outside the lock, callbacks are free to query the pool
+	for (const auto& [Handle, Callback] : callbacks) {
+		Callback(Handle);
+	}
+}
+
+PoolStats DeviceMemoryPool::ComputeStats()
+{
+	PoolStats Stats;
+	vk::DeviceSize free_bytes = 0;
+	for (const auto& Candidate : Blocks) {
+		if (!Candidate.memory) {
+			continue;
+		}
+		Stats.block_count++;
+		Stats.allocation_count += Candidate.allocation_count;
+		Stats.reserved_bytes += Candidate.size;
+		Stats.used_bytes += Candidate.used;
+		if (!Candidate.dedicated && static_cast<float>(Candidate.used) < DEFRAG_SPARSE_OCCUPANCY * static_cast<float>(Candidate.size)) {
+			Stats.sparse_block_count++;
+		}
+		for (const auto& Range : Candidate.free_ranges) {
+			Stats.free_range_count++;
+			free_bytes += Range.size;
+			if (Range.size > Stats.largest_free_range) {
+				Stats.largest_free_range = Range.size;
+			}
+		}
+	}
+	if (free_bytes > 0) {
+		Stats.fragmentation = 1.0f - static_cast<float>(Stats.largest_free_range) / static_cast<float>(free_bytes);
+	}
+	return Stats;
+}
+
+PoolStats DeviceMemoryPool::GetStats()
+{
+	std::lock_guard<std::recursive_mutex> Lock(Mutex);
+	return ComputeStats();
+}
+
+void DeviceMemoryPool::PrintStats(const char* Label)
+{
+	const PoolStats Stats = GetStats();
+	const double used_percent = Stats.reserved_bytes > 0 ? 100.0 * static_cast<double>(Stats.used_bytes) / static_cast<double>(Stats.reserved_bytes) : 0.0;
+
+	printf("Memory pool (%s): %u blocks (%u sparse), %u resources, %.2f MiB used of %.2f MiB reserved (%.1f%%), "
+		   "%u free ranges, largest %" PRIu64 " KiB, fragmentation %.1f%%\n",
+		Label, Stats.block_count, Stats.sparse_block_count, Stats.allocation_count, static_cast<double>(Stats.used_bytes) / (1024.0 * 1024.0),
+		static_cast<double>(Stats.reserved_bytes) / (1024.0 * 1024.0), used_percent, Stats.free_range_count,
+		static_cast<uint64_t>(Stats.largest_free_range / 1024), 100.0f * Stats.fragmentation);
+	fflush(stdout);
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "common.h"
+#include "MemoryTracker.h"
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Reference to a pooled buffer or image. Unlike vk::Buffer/vk::Image it stays valid when the defragmenter moves the
+// resource, the current Vulkan handle is looked up through the pool.
+struct PoolHandle {
+	uint32_t index = UINT32_MAX;
+	uint32_t generation = 0;
+
+	bool IsValid() const { return index != UINT32_MAX; }
+};
+
+// Called once a resource has moved, so whoever cached its Vulkan handle (image views, descriptors) can re-point it
+using PoolMoveCallback = std::function<void(PoolHandle)>;
+
+struct PoolStats {
+	uint32_t block_count = 0;
+	uint32_t sparse_block_count = 0;
+	uint32_t allocation_count = 0;
+	vk::DeviceSize reserved_bytes = 0;
+	vk::DeviceSize used_bytes = 0;
+	uint32_t free_range_count = 0;
+	vk::DeviceSize largest_free_range = 0;
+	// 0 when the free space of every block is one contiguous range, approaches 1 as it splits into small holes
+	float fragmentation = 0.0f;
+};
+
+// Sub-allocates static buffers and textures from per (memory type, category) blocks of POOL_BLOCK_SIZE.
+// Unloading assets leaves blocks partially empty, the incremental defragmenter empties sparse blocks by copying
+// their resources into the remaining blocks on the GPU, a few MiB per frame, then releases them:
+// 1. BeginDefragment() picks the sparse blocks and queues their resources,
+// 2. DefragmentStep() is called once per frame and copies up to the byte budget, returning true when all copies landed,
+// 3. once the GPU no longer uses the old copies, CommitDefragment() switches handles over, runs the move callbacks and
+//    frees the old copies and emptied blocks.
+// Only resources created with transfer src and dst usage can move, anything else pins its block.
+// Pooled resources are treated as read-only by the host once written, host writes during a defragmentation pass are lost.
+class DeviceMemoryPool
+{
+public:
+	// Copies are submitted through GpuTimeline, QueueFamilyIndex must be its queue's family
+	static void Init(vk::PhysicalDevice Gpu, vk::Device Device, uint32_t QueueFamilyIndex);
+	// Destroys anything still alive (reporting it) and frees every block
+	static void Shutdown();
+
+	// Bind a freshly created buffer or image to pooled memory of the given type, the pool owns it from then on.
+	// Info must be the create info the resource was made with, it's used to re-create the resource when moving it.
+	static PoolHandle BindBuffer(vk::Buffer Buffer, const vk::BufferCreateInfo& Info, uint32_t MemoryTypeIndex, MemoryCategory Category, const char* Tag = nullptr);
+	static PoolHandle BindImage(vk::Image Image, const vk::ImageCreateInfo& Info, uint32_t MemoryTypeIndex, MemoryCategory Category, const char* Tag = nullptr);
+	// Resets the handle. The resource is destroyed and its range given back once the GPU finished all work submitted so far.
+	static void Destroy(PoolHandle& Handle);
+
+	static vk::Buffer GetBuffer(PoolHandle Handle);
+	static vk::Image GetImage(PoolHandle Handle);
+	// Host pointer to the resource's memory, nullptr unless the memory type is host visible. Changes when the resource moves.
+	static void* GetMappedPointer(PoolHandle Handle);
+
+	// Layout the image rests in between uses, the defragmenter leaves the moved copy in it
+	static void SetImageLayout(PoolHandle Handle, vk::ImageLayout Layout);
+	static void SetMoveCallback(PoolHandle Handle, PoolMoveCallback Callback);
+
+	// Select sparse blocks and queue their resources for relocation, returns false if nothing is worth moving
+	static bool BeginDefragment();
+	// Submit copies for up to ByteBudget bytes of queued resources. Never waits on the GPU, returns true once every copy has completed.
+	static bool DefragmentStep(vk::DeviceSize ByteBudget);
+	// Switch handles over to the moved copies. The caller guarantees the GPU is done with the old copies (e.g. device idle).
+	static void CommitDefragment();
+	static bool IsDefragmenting() { return Defragmenting; }
+
+	static PoolStats GetStats();
+	static void PrintStats(const char* Label);
+
+private:
+	enum class ResourceKind : uint32_t {
+		Buffer,
+		LinearImage,
+		OptimalImage,
+	};
+
+	struct FreeRange {
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+	};
+
+	struct Block {
+		vk::DeviceMemory memory;
+		vk::DeviceSize size = 0;
+		vk::DeviceSize used = 0;
+		uint32_t memory_type = 0;
+		MemoryCategory category = MemoryCategory::Other;
+		// Buffers and linear/optimal images never share a block, so bufferImageGranularity never applies
+		ResourceKind kind = ResourceKind::Buffer;
+		uint8_t* mapped = nullptr;
+		uint32_t allocation_count = 0;
+		// Sized for a single large resource, never worth defragmenting
+		bool dedicated = false;
+		// Being emptied, receives no new allocations
+		bool evacuating = false;
+		// Sorted by offset, neighbours are always merged
+		std::vector<FreeRange> free_ranges;
+	};
+
+	struct Allocation {
+		uint32_t generation = 0;
+		bool live = false;
+		ResourceKind kind = ResourceKind::Buffer;
+		vk::Buffer buffer;
+		vk::Image image;
+		vk::BufferCreateInfo buffer_info;
+		vk::ImageCreateInfo image_info;
+		vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+		uint32_t block = 0;
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+		bool movable = false;
+		std::string tag;
+		PoolMoveCallback on_moved;
+	};
+
+	// A resource copied to its new location, waiting for CommitDefragment()
+	struct PendingMove {
+		uint32_t index = 0;
+		vk::Buffer buffer;
+		vk::Image image;
+		uint32_t block = 0;
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+	};
+
+	static PoolHandle Bind(Allocation&& Entry, const vk::MemoryRequirements& Requirements, uint32_t MemoryTypeIndex, MemoryCategory Category);
+	// Without AllowNewBlock only free ranges of existing blocks are used, false if none fits
+	static bool AllocateRange(const vk::MemoryRequirements& Requirements, uint32_t MemoryTypeIndex, MemoryCategory Category, ResourceKind Kind, bool AllowNewBlock, uint32_t& OutBlock, vk::DeviceSize& OutOffset);
+	static void FreeRangeInBlock(uint32_t BlockIndex, vk::DeviceSize Offset, vk::DeviceSize Size);
+	static uint32_t CreateBlock(vk::DeviceSize Size, uint32_t MemoryTypeIndex, MemoryCategory Category, ResourceKind Kind, bool Dedicated);
+	static void ReleaseBlock(uint32_t BlockIndex);
+	static Allocation* Resolve(PoolHandle Handle);
+	static void RecordMove(uint32_t Index, vk::CommandBuffer Cmd);
+	static void CancelMove(uint32_t Index);
+	static PoolStats ComputeStats();
+
+	static vk::PhysicalDevice Gpu;
+	static vk::Device Device;
+	static vk::CommandPool CommandPool;
+	static vk::PhysicalDeviceMemoryProperties MemoryProperties;
+
+	static std::recursive_mutex Mutex;
+	static std::vector<Block> Blocks;
+	static std::vector<Allocation> Allocations;
+	static std::vector<uint32_t> FreeAllocationSlots;
+
+	// Defragmentation state
+	static bool Defragmenting;
+	static std::vector<uint32_t> MoveQueue;
+	static size_t NextMove;
+	static std::vector<PendingMove> PendingMoves;
+	static vk::CommandBuffer BatchCmd;
+	// Timeline value the batch signals, see GpuTimeline
+	static uint64_t BatchValue;
+	static uint32_t DefragmentFrames;
+
+	DeviceMemoryPool();
+	~DeviceMemoryPool();
+};
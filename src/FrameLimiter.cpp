@@ -0,0 +1,36 @@
+#include "FrameLimiter.h"
+#include "gettime.h"
+
+#include <thread>
+
+void FrameLimiter::SetTargetFps(double Fps)
+{
+	m_periodNs = Fps > 0.0 ? static_cast<uint64_t>(1e9 / Fps) : 0;
+	m_nextFrameNs = 0;
+}
+
+void FrameLimiter::Wait()
+{
+	if (m_periodNs == 0) {
+		return;
+	}
+
+	uint64_t now_ns = getTimeInNanoseconds();
+	if (m_nextFrameNs == 0 || now_ns > m_nextFrameNs + m_periodNs) {
+		// First frame, or more than a frame late (window dragged, breakpoint): restart the schedule instead of
+		// rushing through the missed frames
+		m_nextFrameNs = now_ns + m_periodNs;
+		return;
+	}
+
+	if (m_nextFrameNs > now_ns + m_sleepSlack.Get()) {
+		now_ns = m_sleepSlack.Sleep(now_ns, m_nextFrameNs - now_ns - m_sleepSlack.Get());
+	}
+
+	while (now_ns < m_nextFrameNs) {
+		std::this_thread::yield();
+		now_ns = getTimeInNanoseconds();
+	}
+
+	m_nextFrameNs += m_periodNs;
+}
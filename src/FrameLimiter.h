@@ -0,0 +1,24 @@
+#pragma once
+
+#include "SleepSlack.h"
+
+#include <cstdint>
+
+// Paces frames to a target rate when the present mode doesn't (MAILBOX, IMMEDIATE). The OS sleep is only accurate to
+// a millisecond or worse, so Wait() sleeps for most of the remaining time and spins on the clock for the rest.
+class FrameLimiter
+{
+public:
+	// 0 disables the limiter
+	void SetTargetFps(double Fps);
+	bool IsEnabled() const { return m_periodNs != 0; }
+
+	// Block until the next frame is due, call once per frame
+	void Wait();
+
+private:
+	uint64_t m_periodNs = 0;
+	uint64_t m_nextFrameNs = 0;
+	// Starts pessimistic and settles within a few frames
+	SleepSlack m_sleepSlack{2000000};
+};
@@ -0,0 +1,76 @@
+#include "FramePacer.h"
+#include "GpuTimeline.h"
+#include "gettime.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+void FramePacer::WaitForGpu(uint64_t Value)
+{
+	m_frames++;
+	uint64_t now_ns = getTimeInNanoseconds();
+	if (GpuTimeline::IsComplete(Value)) {
+		// CPU bound, nothing to wait for and nothing learned about the GPU
+		m_lastDoneNs = 0;
+		return;
+	}
+
+	const uint64_t start_ns = now_ns;
+	if (m_enabled && m_gpuFrameNs > 0 && m_lastDoneNs > 0) {
+		// Keep an eighth of a frame in reserve besides the learned oversleep, a late wake costs frame rate
+		const uint64_t predicted_ns = m_lastDoneNs + m_gpuFrameNs;
+		const uint64_t margin_ns = m_sleepSlack.Get() + m_gpuFrameNs / 8;
+		if (predicted_ns > now_ns + margin_ns) {
+			now_ns = m_sleepSlack.Sleep(now_ns, predicted_ns - now_ns - margin_ns);
+			m_sleepTotalNs += now_ns - start_ns;
+		}
+	}
+
+	bool overslept = now_ns != start_ns && GpuTimeline::IsComplete(Value);
+	if (overslept) {
+		m_overslept++;
+	} else {
+		GpuTimeline::Wait(Value);
+	}
+	const uint64_t done_ns = getTimeInNanoseconds();
+	const uint64_t busy_ns = done_ns - now_ns;
+	m_busyWaitTotalNs += busy_ns;
+	if (busy_ns > m_busyWaitMaxNs) {
+		m_busyWaitMaxNs = busy_ns;
+	}
+
+	if (overslept) {
+		// The real completion time is unknown, only that it was earlier. Drift the prediction down so the next sleeps
+		// end sooner, and don't measure an interval from this frame.
+		m_gpuFrameNs -= m_gpuFrameNs / 16;
+		m_lastDoneNs = 0;
+		return;
+	}
+
+	if (m_lastDoneNs > 0) {
+		const uint64_t interval_ns = done_ns - m_lastDoneNs;
+		if (m_gpuFrameNs == 0) {
+			m_gpuFrameNs = interval_ns;
+		} else if (interval_ns > m_gpuFrameNs * 4) {
+			// A stall (resize, breakpoint, throttled while minimized), not the GPU's pace. Start measuring again.
+			m_gpuFrameNs = 0;
+		} else {
+			m_gpuFrameNs = (m_gpuFrameNs * 7 + interval_ns) / 8;
+		}
+	}
+	m_lastDoneNs = done_ns;
+}
+
+void FramePacer::PrintStats() const
+{
+	if (m_frames == 0) {
+		return;
+	}
+	const double frames = static_cast<double>(m_frames);
+	printf("Frame pacing (%s): %" PRIu64 " frames, slept avg %.3f ms, busy-wait avg %.3f ms, max %.3f ms, acquire wait avg %.3f ms "
+		   "(%" PRIu64 " timeouts), %" PRIu64 " overslept\n",
+		m_enabled ? "predictive" : "off", m_frames, static_cast<double>(m_sleepTotalNs) / frames / 1e6,
+		static_cast<double>(m_busyWaitTotalNs) / frames / 1e6, static_cast<double>(m_busyWaitMaxNs) / 1e6,
+		static_cast<double>(m_acquireWaitTotalNs) / frames / 1e6, m_acquireTimeouts, m_overslept);
+	fflush(stdout);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "SleepSlack.h"
+
+#include <cstdint>
+
+// Paces the CPU against the GPU instead of blocking in the driver for the full wait. Learns how often frames complete
+// on the graphics timeline, sleeps until shortly before the frame being waited for is predicted to finish and only
+// waits on the timeline for the rest. Drivers may spin inside that wait, so the time spent there is reported as the
+// frame's busy-wait time.
+class FramePacer
+{
+public:
+	// Disabled, WaitForGpu() goes straight to the timeline wait but still keeps stats
+	void SetEnabled(bool Enable) { m_enabled = Enable; }
+	bool IsEnabled() const { return m_enabled; }
+
+	// Block until the graphics timeline reaches Value, call at most once per frame
+	void WaitForGpu(uint64_t Value);
+	// Time blocked in vkAcquireNextImageKHR this frame, only counted
+	void AddAcquireWait(uint64_t Ns) { m_acquireWaitTotalNs += Ns; }
+	// An acquire that ran into its timeout and was retried
+	void AddAcquireTimeout() { m_acquireTimeouts++; }
+
+	void PrintStats() const;
+
+private:
+	bool m_enabled = true;
+
+	// Predicted time between two frames completing on the GPU, 0 until measured
+	uint64_t m_gpuFrameNs = 0;
+	// When the last waited for frame completed, 0 if it had already completed before the wait, the interval to the
+	// next one then says nothing about the GPU
+	uint64_t m_lastDoneNs = 0;
+	// Margin left before the predicted completion, covers the OS oversleeping
+	SleepSlack m_sleepSlack{1000000};
+
+	uint64_t m_frames = 0;
+	uint64_t m_sleepTotalNs = 0;
+	uint64_t m_busyWaitTotalNs = 0;
+	uint64_t m_busyWaitMaxNs = 0;
+	uint64_t m_acquireWaitTotalNs = 0;
+	uint64_t m_acquireTimeouts = 0;
+	// Frames that were already complete when the sleep ended, the sleep ran past the GPU
+	uint64_t m_overslept = 0;
+};
@@ -0,0 +1,125 @@
+#include "GpuTimeline.h"
+
+vk::Device GpuTimeline::Device;
+vk::Queue GpuTimeline::Queue;
+vk::Semaphore GpuTimeline::Semaphore;
+
+std::mutex GpuTimeline::Mutex;
+uint64_t GpuTimeline::LastSubmitted = 0;
+std::vector<GpuTimeline::PendingRelease> GpuTimeline::PendingReleases;
+
+GpuTimeline::GpuTimeline() {}
+GpuTimeline::~GpuTimeline() {}
+
+void GpuTimeline::Init(vk::Device InDevice, vk::Queue InQueue)
+{
+	Device = InDevice;
+	Queue = InQueue;
+	LastSubmitted = 0;
+
+	auto type_info = vk::SemaphoreTypeCreateInfo().setSemaphoreType(vk::SemaphoreType::eTimeline).setInitialValue(0);
+	auto semaphore_return = Device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&type_info));
+	VERIFY(semaphore_return.result == vk::Result::eSuccess);
+	Semaphore = semaphore_return.value;
+}
+
+void GpuTimeline::Shutdown()
+{
+	WaitIdle();
+
+	Device.destroySemaphore(Semaphore);
+	Semaphore = vk::Semaphore();
+	LastSubmitted = 0;
+}
+
+uint64_t GpuTimeline::Submit(const vk::SubmitInfo& Info)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	const uint64_t value = LastSubmitted + 1;
+
+	std::vector<vk::Semaphore> signal_semaphores(Info.pSignalSemaphores, Info.pSignalSemaphores + Info.signalSemaphoreCount);
+	signal_semaphores.push_back(Semaphore);
+	// Values of binary semaphores are ignored but the arrays must match the semaphore counts
+	std::vector<uint64_t> signal_values(signal_semaphores.size(), 0);
+	signal_values.back() = value;
+	std::vector<uint64_t> wait_values(Info.waitSemaphoreCount, 0);
+
+	auto timeline_info = vk::TimelineSemaphoreSubmitInfo().setWaitSemaphoreValues(wait_values).setSignalSemaphoreValues(signal_values);
+	auto submit_info = Info;
+	submit_info.setSignalSemaphores(signal_semaphores).setPNext(&timeline_info);
+
+	auto result = Queue.submit(submit_info, vk::Fence());
+	VERIFY(result == vk::Result::eSuccess);
+
+	LastSubmitted = value;
+	return value;
+}
+
+uint64_t GpuTimeline::GetLastSubmitted()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return LastSubmitted;
+}
+
+uint64_t GpuTimeline::GetCompleted()
+{
+	auto value_return = Device.getSemaphoreCounterValue(Semaphore);
+	VERIFY(value_return.result == vk::Result::eSuccess);
+	return value_return.value;
+}
+
+bool GpuTimeline::IsComplete(uint64_t Value)
+{
+	// 0 is the initial value, nothing ever has to wait for it
+	return Value == 0 || GetCompleted() >= Value;
+}
+
+void GpuTimeline::Wait(uint64_t Value)
+{
+	if (Value == 0) {
+		return;
+	}
+	auto const wait_info = vk::SemaphoreWaitInfo().setSemaphores(Semaphore).setValues(Value);
+	auto result = Device.waitSemaphores(wait_info, UINT64_MAX);
+	VERIFY(result == vk::Result::eSuccess);
+}
+
+void GpuTimeline::WaitIdle()
+{
+	Wait(GetLastSubmitted());
+	// Releases may defer further releases, those are already complete too
+	while (CollectReleases() > 0) {
+	}
+}
+
+void GpuTimeline::DeferRelease(std::function<void()> Release)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	PendingReleases.push_back({ LastSubmitted, std::move(Release) });
+}
+
+uint32_t GpuTimeline::CollectReleases()
+{
+	std::vector<std::function<void()>> ready;
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		if (PendingReleases.empty()) {
+			return 0;
+		}
+
+		const uint64_t completed = GetCompleted();
+		size_t count = 0;
+		while (count < PendingReleases.size() && PendingReleases[count].value <= completed) {
+			ready.push_back(std::move(PendingReleases[count].release));
+			count++;
+		}
+		PendingReleases.erase(PendingReleases.begin(), PendingReleases.begin() + count);
+	}
+
+	// Outside the lock, releases may defer more releases
+	for (auto& release : ready) {
+		release();
+	}
+	return static_cast<uint32_t>(ready.size());
+}
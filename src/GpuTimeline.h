@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+
+#include <functional>
+#include <mutex>
+
+// Monotonic clock of the graphics queue: one timeline semaphore that every submission to the queue signals with the
+// next value. "Has the GPU finished X" becomes "has the counter reached the value X was submitted with", which covers
+// frame throttling, upload completion and deferred destruction without fences.
+class GpuTimeline
+{
+public:
+	static void Init(vk::Device Device, vk::Queue Queue);
+	// Waits for all submitted work, runs every pending release and destroys the semaphore
+	static void Shutdown();
+
+	// Submits Info with the timeline signal appended to its signal semaphores, returns the value signaled once the
+	// work completes. Info's other semaphores must be binary and it must not chain a pNext of its own.
+	static uint64_t Submit(const vk::SubmitInfo& Info);
+
+	static uint64_t GetLastSubmitted();
+	static uint64_t GetCompleted();
+	static bool IsComplete(uint64_t Value);
+	static void Wait(uint64_t Value);
+	// Wait for everything submitted so far and run the releases it unblocks
+	static void WaitIdle();
+
+	// Run Release once everything submitted so far has completed, e.g. to destroy a resource the GPU may still read
+	static void DeferRelease(std::function<void()> Release);
+	// Run the releases whose work has completed, returns how many ran. Called once per frame.
+	static uint32_t CollectReleases();
+
+private:
+	struct PendingRelease {
+		uint64_t value = 0;
+		std::function<void()> release;
+	};
+
+	static vk::Device Device;
+	static vk::Queue Queue;
+	static vk::Semaphore Semaphore;
+
+	static std::mutex Mutex;
+	static uint64_t LastSubmitted;
+	// In submission order, so the values never decrease
+	static std::vector<PendingRelease> PendingReleases;
+
+	GpuTimeline();
+	~GpuTimeline();
+};
@@ -0,0 +1,151 @@
+#include "MappedBuffer.h"
+
+#include <algorithm>
+
+std::mutex MappedBuffer::PendingMutex;
+std::vector<vk::MappedMemoryRange> MappedBuffer::PendingRanges;
+
+uint32_t MappedBuffer::FindMemoryType(uint32_t TypeBits, const vk::PhysicalDeviceMemoryProperties& MemoryProperties, HostAccess Access)
+{
+	// Any host-visible type will do. Uploads rank device-local first and cached next, readbacks the other way around.
+	// Coherency doesn't matter since we flush and invalidate explicitly.
+	const bool readback = Access == HostAccess::Readback;
+	uint32_t best_index = UINT32_MAX;
+	int best_score = -1;
+	for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+		const auto flags = MemoryProperties.memoryTypes[i].propertyFlags;
+		if (!(TypeBits & (1u << i)) || !(flags & vk::MemoryPropertyFlagBits::eHostVisible)) {
+			continue;
+		}
+
+		int score = 0;
+		if (flags & vk::MemoryPropertyFlagBits::eDeviceLocal) {
+			score += readback ? 1 : 2;
+		}
+		if (flags & vk::MemoryPropertyFlagBits::eHostCached) {
+			score += readback ? 2 : 1;
+		}
+		if (score > best_score) {
+			best_score = score;
+			best_index = i;
+		}
+	}
+	return best_index;
+}
+
+void MappedBuffer::Create(vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, const char* Tag, HostAccess Access)
+{
+	assert(GVulkanObjects.initialized && !m_buffer);
+
+	const auto memory_properties = GVulkanObjects.gpu.getMemoryProperties();
+	m_atomSize = GVulkanObjects.gpu.getProperties().limits.nonCoherentAtomSize;
+	m_size = Size;
+
+	auto const buffer_info = vk::BufferCreateInfo().setSize(Size).setUsage(Usage).setSharingMode(vk::SharingMode::eExclusive);
+	auto result = GVulkanObjects.device.createBuffer(&buffer_info, nullptr, &m_buffer);
+	VERIFY(result == vk::Result::eSuccess);
+
+	vk::MemoryRequirements mem_reqs;
+	GVulkanObjects.device.getBufferMemoryRequirements(m_buffer, &mem_reqs);
+
+	uint32_t type_index = FindMemoryType(mem_reqs.memoryTypeBits, memory_properties, Access);
+	VERIFY(type_index != UINT32_MAX);
+	m_coherent = static_cast<bool>(memory_properties.memoryTypes[type_index].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+	// Round the allocation up to a whole number of atoms so an aligned flush range never runs past its end
+	m_allocationSize = (mem_reqs.size + m_atomSize - 1) / m_atomSize * m_atomSize;
+
+	auto const mem_alloc = vk::MemoryAllocateInfo().setAllocationSize(m_allocationSize).setMemoryTypeIndex(type_index);
+	result = MemoryTracker::Allocate(mem_alloc, Category, m_memory, Tag);
+	VERIFY(result == vk::Result::eSuccess);
+
+	result = GVulkanObjects.device.bindBufferMemory(m_buffer, m_memory, 0);
+	VERIFY(result == vk::Result::eSuccess);
+
+	// Mapped once, stays mapped until Destroy()
+	result = GVulkanObjects.device.mapMemory(m_memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &m_mapped);
+	VERIFY(result == vk::Result::eSuccess);
+}
+
+void MappedBuffer::Destroy()
+{
+	if (!m_buffer) {
+		return;
+	}
+
+	{
+		// Don't leave ranges of freed memory behind for the next flush
+		std::lock_guard<std::mutex> Lock(PendingMutex);
+		PendingRanges.erase(std::remove_if(PendingRanges.begin(), PendingRanges.end(),
+								[this](const vk::MappedMemoryRange& range) { return range.memory == m_memory; }),
+			PendingRanges.end());
+	}
+
+	GVulkanObjects.device.unmapMemory(m_memory);
+	GVulkanObjects.device.destroyBuffer(m_buffer);
+	MemoryTracker::Free(m_memory);
+
+	*this = MappedBuffer();
+}
+
+void MappedBuffer::Write(vk::DeviceSize Offset, const void* Data, vk::DeviceSize Size)
+{
+	assert(m_mapped && Offset + Size <= m_size);
+	memcpy(static_cast<uint8_t*>(m_mapped) + Offset, Data, static_cast<size_t>(Size));
+	MarkDirty(Offset, Size);
+}
+
+void MappedBuffer::MarkDirty(vk::DeviceSize Offset, vk::DeviceSize Size)
+{
+	if (m_coherent || Size == 0) {
+		return;
+	}
+
+	const vk::DeviceSize begin = Offset / m_atomSize * m_atomSize;
+	const vk::DeviceSize end = (Offset + Size + m_atomSize - 1) / m_atomSize * m_atomSize;
+
+	std::lock_guard<std::mutex> Lock(PendingMutex);
+
+	// Merge with an overlapping or touching range of the same allocation
+	for (auto& range : PendingRanges) {
+		if (range.memory != m_memory) {
+			continue;
+		}
+		const vk::DeviceSize range_end = range.offset + range.size;
+		if (begin <= range_end && range.offset <= end) {
+			const vk::DeviceSize new_begin = begin < range.offset ? begin : range.offset;
+			const vk::DeviceSize new_end = end > range_end ? end : range_end;
+			range.setOffset(new_begin).setSize(new_end - new_begin);
+			return;
+		}
+	}
+
+	PendingRanges.push_back(vk::MappedMemoryRange().setMemory(m_memory).setOffset(begin).setSize(end - begin));
+}
+
+void MappedBuffer::Invalidate()
+{
+	if (m_coherent) {
+		return;
+	}
+
+	auto result = GVulkanObjects.device.invalidateMappedMemoryRanges(
+		vk::MappedMemoryRange().setMemory(m_memory).setOffset(0).setSize(VK_WHOLE_SIZE));
+	VERIFY(result == vk::Result::eSuccess);
+}
+
+uint32_t MappedBuffer::FlushPending()
+{
+	std::lock_guard<std::mutex> Lock(PendingMutex);
+
+	if (PendingRanges.empty()) {
+		return 0;
+	}
+
+	auto result = GVulkanObjects.device.flushMappedMemoryRanges(PendingRanges);
+	VERIFY(result == vk::Result::eSuccess);
+
+	uint32_t flushed = static_cast<uint32_t>(PendingRanges.size());
+	PendingRanges.clear();
+	return flushed;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+#include "MemoryTracker.h"
+
+#include <mutex>
+
+// Host-writable buffer that stays mapped for the lifetime of its allocation.
+// Non-coherent (e.g. cached) memory types are accepted: writes record a dirty range, rounded out to
+// nonCoherentAtomSize, and all dirty ranges of all mapped buffers are flushed with a single
+// vkFlushMappedMemoryRanges call per frame through FlushPending().
+
+// What the host does with the mapping, picks the memory type
+enum class HostAccess
+{
+	// The host writes, the GPU reads: device-local first, the GPU reads it every frame
+	Upload,
+	// The GPU writes, the host reads: cached first, uncached reads are many times slower
+	Readback,
+};
+
+class MappedBuffer
+{
+public:
+	void Create(vk::DeviceSize Size, vk::BufferUsageFlags Usage, MemoryCategory Category, const char* Tag = nullptr,
+		HostAccess Access = HostAccess::Upload);
+	void Destroy();
+
+	// Copy data into the mapping and mark the range dirty
+	void Write(vk::DeviceSize Offset, const void* Data, vk::DeviceSize Size);
+	// For callers that wrote through GetMappedPointer() themselves
+	void MarkDirty(vk::DeviceSize Offset, vk::DeviceSize Size);
+	// Make GPU writes visible to the host before reading them back, a no-op on coherent memory
+	void Invalidate();
+
+	void* GetMappedPointer() const { return m_mapped; }
+	vk::Buffer GetBuffer() const { return m_buffer; }
+	vk::DeviceSize GetSize() const { return m_size; }
+	bool IsCoherent() const { return m_coherent; }
+
+	// Flush every dirty range recorded since the last call, returns the number of ranges flushed
+	static uint32_t FlushPending();
+
+private:
+	static uint32_t FindMemoryType(uint32_t TypeBits, const vk::PhysicalDeviceMemoryProperties& MemoryProperties, HostAccess Access);
+
+	vk::Buffer m_buffer;
+	vk::DeviceMemory m_memory;
+	void* m_mapped = nullptr;
+	vk::DeviceSize m_size = 0;
+	vk::DeviceSize m_allocationSize = 0;
+	vk::DeviceSize m_atomSize = 1;
+	bool m_coherent = true;
+
+	static std::mutex PendingMutex;
+	static std::vector<vk::MappedMemoryRange> PendingRanges;
+};
@@ -0,0 +1,233 @@
+#include "MemoryTracker.h"
+
+std::mutex MemoryTracker::Mutex;
+bool MemoryTracker::HasMemoryProperties = false;
+vk::PhysicalDeviceMemoryProperties MemoryTracker::MemoryProperties;
+std::unordered_map<VkDeviceMemory, MemoryTracker::AllocationRecord> MemoryTracker::Allocations;
+std::array<MemoryCounters, static_cast<size_t>(MemoryCategory::Count)> MemoryTracker::CategoryCounters;
+std::array<MemoryCounters, VK_MAX_MEMORY_TYPES> MemoryTracker::TypeCounters;
+std::array<MemoryCounters, VK_MAX_MEMORY_HEAPS> MemoryTracker::HeapCounters;
+MemoryCounters MemoryTracker::TotalCounters;
+
+MemoryTracker::MemoryTracker() {}
+MemoryTracker::~MemoryTracker() {}
+
+vk::Result MemoryTracker::Allocate(const vk::MemoryAllocateInfo& AllocInfo, MemoryCategory Category, vk::DeviceMemory& OutMemory, const char* Tag)
+{
+	assert(GVulkanObjects.initialized);
+
+	auto Result = GVulkanObjects.device.allocateMemory(&AllocInfo, nullptr, &OutMemory);
+	if (Result != vk::Result::eSuccess) {
+		return Result;
+	}
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	if (!HasMemoryProperties) {
+		MemoryProperties = GVulkanObjects.gpu.getMemoryProperties();
+		HasMemoryProperties = true;
+	}
+
+	AllocationRecord Record;
+	Record.size = AllocInfo.allocationSize;
+	Record.memory_type = AllocInfo.memoryTypeIndex;
+	Record.category = Category;
+	Record.tag = Tag ? Tag : "";
+
+	AddToCounters(CategoryCounters[static_cast<size_t>(Category)], Record.size);
+	AddToCounters(TypeCounters[Record.memory_type], Record.size);
+	AddToCounters(HeapCounters[MemoryProperties.memoryTypes[Record.memory_type].heapIndex], Record.size);
+	AddToCounters(TotalCounters, Record.size);
+
+	Allocations[static_cast<VkDeviceMemory>(OutMemory)] = std::move(Record);
+	return Result;
+}
+
+void MemoryTracker::Free(vk::DeviceMemory Memory)
+{
+	if (!Memory) {
+		return;
+	}
+
+	GVulkanObjects.device.freeMemory(Memory);
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	auto It = Allocations.find(static_cast<VkDeviceMemory>(Memory));
+	if (It == Allocations.end()) {
+		// Allocated behind our back, nothing to account for
+		return;
+	}
+
+	const auto& Record = It->second;
+	RemoveFromCounters(CategoryCounters[static_cast<size_t>(Record.category)], Record.size);
+	RemoveFromCounters(TypeCounters[Record.memory_type], Record.size);
+	RemoveFromCounters(HeapCounters[MemoryProperties.memoryTypes[Record.memory_type].heapIndex], Record.size);
+	RemoveFromCounters(TotalCounters, Record.size);
+
+	Allocations.erase(It);
+}
+
+MemoryCounters MemoryTracker::GetCategoryStats(MemoryCategory Category)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return CategoryCounters[static_cast<size_t>(Category)];
+}
+
+MemoryCounters MemoryTracker::GetMemoryTypeStats(uint32_t TypeIndex)
+{
+	assert(TypeIndex < VK_MAX_MEMORY_TYPES);
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return TypeCounters[TypeIndex];
+}
+
+MemoryCounters MemoryTracker::GetHeapStats(uint32_t HeapIndex)
+{
+	assert(HeapIndex < VK_MAX_MEMORY_HEAPS);
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return HeapCounters[HeapIndex];
+}
+
+MemoryCounters MemoryTracker::GetTotalStats()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return TotalCounters;
+}
+
+const char* MemoryTracker::CategoryName(MemoryCategory Category)
+{
+	switch (Category) {
+	case MemoryCategory::Texture:
+		return "texture";
+	case MemoryCategory::Mesh:
+		return "mesh";
+	case MemoryCategory::Depth:
+		return "depth";
+	case MemoryCategory::Uniform:
+		return "uniform";
+	case MemoryCategory::Staging:
+		return "staging";
+	default:
+		return "other";
+	}
+}
+
+void MemoryTracker::PrintStats()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	auto PrintCounters = [](const char* Name, const MemoryCounters& Counters) {
+		printf("  %-12s live %10" PRIu64 " B  peak %10" PRIu64 " B  allocs %" PRIu64 " (%" PRIu64 " live)\n", Name,
+			Counters.live_bytes, Counters.peak_bytes, Counters.total_allocations, Counters.live_allocations);
+	};
+
+	printf("Device memory usage:\n");
+	for (size_t i = 0; i < CategoryCounters.size(); i++) {
+		PrintCounters(CategoryName(static_cast<MemoryCategory>(i)), CategoryCounters[i]);
+	}
+	PrintCounters("total", TotalCounters);
+
+	if (HasMemoryProperties) {
+		for (uint32_t i = 0; i < MemoryProperties.memoryHeapCount; i++) {
+			std::string Name = "heap " + std::to_string(i);
+			PrintCounters(Name.c_str(), HeapCounters[i]);
+		}
+		for (uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+			if (TypeCounters[i].total_allocations == 0) {
+				continue;
+			}
+			std::string Name = "type " + std::to_string(i);
+			PrintCounters(Name.c_str(), TypeCounters[i]);
+		}
+	}
+	fflush(stdout);
+}
+
+bool MemoryTracker::DumpJson(const std::string& FilePath)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	std::ofstream File(FilePath, std::ios::trunc);
+	if (!File.is_open()) {
+		fprintf(stderr, "Failed to write memory report: %s\n", FilePath.c_str());
+		return false;
+	}
+
+	auto WriteCounters = [&File](const MemoryCounters& Counters) {
+		File << "\"live_bytes\": " << Counters.live_bytes << ", \"peak_bytes\": " << Counters.peak_bytes
+			 << ", \"live_allocations\": " << Counters.live_allocations << ", \"total_allocations\": " << Counters.total_allocations;
+	};
+
+	File << "{\n  \"categories\": {\n";
+	for (size_t i = 0; i < CategoryCounters.size(); i++) {
+		File << "    \"" << CategoryName(static_cast<MemoryCategory>(i)) << "\": { ";
+		WriteCounters(CategoryCounters[i]);
+		File << " }" << (i + 1 < CategoryCounters.size() ? "," : "") << "\n";
+	}
+	File << "  },\n  \"heaps\": [\n";
+
+	uint32_t HeapCount = HasMemoryProperties ? MemoryProperties.memoryHeapCount : 0;
+	for (uint32_t i = 0; i < HeapCount; i++) {
+		const auto& Heap = MemoryProperties.memoryHeaps[i];
+		File << "    { \"index\": " << i << ", \"size\": " << Heap.size << ", \"device_local\": "
+			 << ((Heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? "true" : "false") << ", ";
+		WriteCounters(HeapCounters[i]);
+		File << " }" << (i + 1 < HeapCount ? "," : "") << "\n";
+	}
+	File << "  ],\n  \"memory_types\": [\n";
+
+	uint32_t TypeCount = HasMemoryProperties ? MemoryProperties.memoryTypeCount : 0;
+	for (uint32_t i = 0; i < TypeCount; i++) {
+		const auto& Type = MemoryProperties.memoryTypes[i];
+		File << "    { \"index\": " << i << ", \"heap\": " << Type.heapIndex << ", \"flags\": \""
+			 << vk::to_string(Type.propertyFlags) << "\", ";
+		WriteCounters(TypeCounters[i]);
+		File << " }" << (i + 1 < TypeCount ? "," : "") << "\n";
+	}
+	File << "  ],\n  \"total\": { ";
+	WriteCounters(TotalCounters);
+	File << " }\n}\n";
+
+	return File.good();
+}
+
+size_t MemoryTracker::ReportLeaks()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	for (const auto& [Memory, Record] : Allocations) {
+		fprintf(stderr, "Leaked device memory: %" PRIu64 " bytes, category %s, memory type %u%s%s\n",
+			static_cast<uint64_t>(Record.size), CategoryName(Record.category), Record.memory_type,
+			Record.tag.empty() ? "" : ", tag ", Record.tag.c_str());
+	}
+	return Allocations.size();
+}
+
+void MemoryTracker::Reset()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	Allocations.clear();
+	CategoryCounters = {};
+	TypeCounters = {};
+	HeapCounters = {};
+	TotalCounters = {};
+	HasMemoryProperties = false;
+}
+
+void MemoryTracker::AddToCounters(MemoryCounters& Counters, vk::DeviceSize Size)
+{
+	Counters.live_bytes += Size;
+	if (Counters.live_bytes > Counters.peak_bytes) {
+		Counters.peak_bytes = Counters.live_bytes;
+	}
+	Counters.live_allocations++;
+	Counters.total_allocations++;
+}
+
+void MemoryTracker::RemoveFromCounters(MemoryCounters& Counters, vk::DeviceSize Size)
+{
+	assert(Counters.live_bytes >= Size && Counters.live_allocations > 0);
+	Counters.live_bytes -= Size;
+	Counters.live_allocations--;
+}
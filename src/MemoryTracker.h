@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Every device memory allocation is tagged with one of these so we can tell what is eating VRAM
+enum class MemoryCategory : uint32_t {
+	Texture,
+	Mesh,
+	Depth,
+	Uniform,
+	Staging,
+	Other,
+	Count
+};
+
+struct MemoryCounters {
+	uint64_t live_bytes = 0;
+	uint64_t peak_bytes = 0;
+	uint64_t live_allocations = 0;
+	uint64_t total_allocations = 0;
+};
+
+// Accounts for device memory allocated through vkAllocateMemory.
+// Counters are kept per category, per memory type and per memory heap (heaps tell device-local VRAM apart from
+// host memory), so the per-heap numbers double as the host memory accounting for host-visible allocations.
+class MemoryTracker
+{
+public:
+	// Drop-in replacement for device.allocateMemory(), records the allocation on success
+	static vk::Result Allocate(const vk::MemoryAllocateInfo& AllocInfo, MemoryCategory Category, vk::DeviceMemory& OutMemory, const char* Tag = nullptr);
+	// Drop-in replacement for device.freeMemory(), null handles are ignored like Vulkan does
+	static void Free(vk::DeviceMemory Memory);
+
+	// Query API
+	static MemoryCounters GetCategoryStats(MemoryCategory Category);
+	static MemoryCounters GetMemoryTypeStats(uint32_t TypeIndex);
+	static MemoryCounters GetHeapStats(uint32_t HeapIndex);
+	static MemoryCounters GetTotalStats();
+
+	static const char* CategoryName(MemoryCategory Category);
+
+	// Print current watermarks to stdout
+	static void PrintStats();
+	// Write current watermarks as JSON, returns false if the file couldn't be written
+	static bool DumpJson(const std::string& FilePath);
+	// Print every allocation that is still alive, returns the number of leaked allocations
+	static size_t ReportLeaks();
+	// Forget everything, called once the device is destroyed
+	static void Reset();
+
+private:
+	struct AllocationRecord {
+		vk::DeviceSize size = 0;
+		uint32_t memory_type = 0;
+		MemoryCategory category = MemoryCategory::Other;
+		std::string tag;
+	};
+
+	static void AddToCounters(MemoryCounters& Counters, vk::DeviceSize Size);
+	static void RemoveFromCounters(MemoryCounters& Counters, vk::DeviceSize Size);
+
+	static std::mutex Mutex;
+	static bool HasMemoryProperties;
+	static vk::PhysicalDeviceMemoryProperties MemoryProperties;
+	static std::unordered_map<VkDeviceMemory, AllocationRecord> Allocations;
+	static std::array<MemoryCounters, static_cast<size_t>(MemoryCategory::Count)> CategoryCounters;
+	static std::array<MemoryCounters, VK_MAX_MEMORY_TYPES> TypeCounters;
+	static std::array<MemoryCounters, VK_MAX_MEMORY_HEAPS> HeapCounters;
+	static MemoryCounters TotalCounters;
+
+	MemoryTracker();
+	~MemoryTracker();
+};
@@ -6,16 +6,14 @@
 MeshModel::MeshModel(vk::Device device, vk::PhysicalDevice physicalDevice, vk::CommandPool commandPool, vk::Queue graphicsQueue,
     glm::vec3 position, glm::vec3 rotation, glm::vec3 scale, const std::string& modelFilePath)
     : m_device(device), m_physicalDevice(physicalDevice), m_commandPool(commandPool), m_graphicsQueue(graphicsQueue),
-    m_position(position), m_rotation(rotation), m_scale(scale) {
+    m_position(position), m_scale(scale) {
+    SetRotation(rotation);
     LoadModel(modelFilePath);
-    m_modelMatrix = CalculateModelMatrix();
 }
 
 MeshModel::~MeshModel() {
-    m_device.destroyBuffer(m_vertexBuffer);
-    m_device.freeMemory(m_vertexBufferMemory);
-    m_device.destroyBuffer(m_indexBuffer);
-    m_device.freeMemory(m_indexBufferMemory);
+    BufferFactory::DestroyBuffer(m_vertexBuffer);
+    BufferFactory::DestroyBuffer(m_indexBuffer);
 }
 
 void MeshModel::Update(float deltaTime) {
@@ -27,27 +25,37 @@ void MeshModel::Render(vk::CommandBuffer commandBuffer, vk::Pipeline pipeline, v
     commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
     commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
-    vk::Buffer vertexBuffers[] = { m_vertexBuffer };
+    vk::Buffer vertexBuffers[] = { m_vertexBuffer.GetBuffer() };
     vk::DeviceSize offsets[] = { 0 };
     commandBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
-    commandBuffer.bindIndexBuffer(m_indexBuffer, 0, vk::IndexType::eUint32);
+    commandBuffer.bindIndexBuffer(m_indexBuffer.GetBuffer(), 0, vk::IndexType::eUint32);
 
     commandBuffer.drawIndexed(m_indexCount, 1, 0, 0, 0);
 }
 
 void MeshModel::SetPosition(const glm::vec3& newPos) {
     m_position = newPos;
-    m_modelMatrix = CalculateModelMatrix();
+    m_modelMatrixDirty = true;
 }
 
 void MeshModel::SetRotation(const glm::vec3& newRot) {
-    m_rotation = newRot;
-    m_modelMatrix = CalculateModelMatrix();
+    // Same order the three rotations were multiplied in, as one quaternion
+    m_rotation = glm::angleAxis(glm::radians(newRot.y), glm::vec3(0, 1, 0)) * glm::angleAxis(glm::radians(newRot.x), glm::vec3(1, 0, 0)) *
+        glm::angleAxis(glm::radians(newRot.z), glm::vec3(0, 0, 1));
+    m_modelMatrixDirty = true;
 }
 
 void MeshModel::SetScale(const glm::vec3& newScale) {
     m_scale = newScale;
-    m_modelMatrix = CalculateModelMatrix();
+    m_modelMatrixDirty = true;
+}
+
+const glm::mat4& MeshModel::GetModelMatrix() {
+    if (m_modelMatrixDirty) {
+        m_modelMatrix = TransformStore::Compose(m_position, m_rotation, m_scale);
+        m_modelMatrixDirty = false;
+    }
+    return m_modelMatrix;
 }
 
 void MeshModel::SetTexture(vk::ImageView textureImageView, vk::Sampler textureSampler) {
@@ -55,11 +63,9 @@ void MeshModel::SetTexture(vk::ImageView textureImageView, vk::Sampler textureSa
     m_textureSampler = textureSampler;
 }
 
-void MeshModel::UpdateUniformBuffer(vk::DeviceMemory uniformMemory, const Utils::UniformBufferObject& ubo) {
-    void* data;
-    m_device.mapMemory(uniformMemory, 0, sizeof(Utils::UniformBufferObject), vk::MemoryMapFlags(), &data);
-    memcpy(data, &ubo, sizeof(Utils::UniformBufferObject));
-    m_device.unmapMemory(uniformMemory);
+void MeshModel::UpdateUniformBuffer(MappedBuffer& uniformBuffer, const Utils::UniformBufferObject& ubo) {
+    // The buffer stays mapped, this only records a dirty range that gets flushed with the rest of the frame
+    uniformBuffer.Write(0, &ubo, sizeof(Utils::UniformBufferObject));
 }
 
 void MeshModel::LoadModel(const std::string& modelFilePath) {
@@ -75,6 +81,37 @@ void MeshModel::LoadModel(const std::string& modelFilePath) {
     std::vector<Utils::Vertex> vertices;
     std::vector<uint32_t> indices;
 
+    // Flatten every shape into one vertex stream, each face corner becomes its own vertex
+    for (const auto& shape : shapes) {
+        for (const auto& index : shape.mesh.indices) {
+            Utils::Vertex vertex{};
+            vertex.pos = {
+                attrib.vertices[3 * index.vertex_index + 0],
+                attrib.vertices[3 * index.vertex_index + 1],
+                attrib.vertices[3 * index.vertex_index + 2]
+            };
+            vertex.color = {
+                attrib.colors[3 * index.vertex_index + 0],
+                attrib.colors[3 * index.vertex_index + 1],
+                attrib.colors[3 * index.vertex_index + 2]
+            };
+            if (index.texcoord_index >= 0) {
+                // OBJ texture origin is bottom-left, Vulkan's is top-left
+                vertex.texCoord = {
+                    attrib.texcoords[2 * index.texcoord_index + 0],
+                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+                };
+            }
+
+            indices.push_back(static_cast<uint32_t>(vertices.size()));
+            vertices.push_back(vertex);
+        }
+    }
+
+    if (vertices.empty()) {
+        throw std::runtime_error("Model has no geometry: " + modelFilePath);
+    }
+
     CreateVertexBuffer(vertices);
     CreateIndexBuffer(indices);
 }
@@ -83,55 +120,15 @@ void MeshModel::CreateVertexBuffer(const std::vector<Utils::Vertex>& vertices) {
     m_vertexCount = static_cast<uint32_t>(vertices.size());
     vk::DeviceSize bufferSize = sizeof(vertices[0]) * m_vertexCount;
 
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    Utils::createBuffer(m_device, m_physicalDevice, bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    void* data; 
-    m_device.mapMemory(stagingBufferMemory, 0, bufferSize, vk::MemoryMapFlags(), &data);
-    memcpy(data, vertices.data(), bufferSize);
-    m_device.unmapMemory(stagingBufferMemory);
-
-    Utils::createBuffer(m_device, m_physicalDevice, bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-        vk::MemoryPropertyFlagBits::eDeviceLocal, m_vertexBuffer, m_vertexBufferMemory);
-
-    Utils::copyBuffer(m_device, m_graphicsQueue, stagingBuffer, m_vertexBuffer, bufferSize);
-
-    m_device.destroyBuffer(stagingBuffer);
-    m_device.freeMemory(stagingBufferMemory);
+    // Writes straight into VRAM when the device allows it, otherwise stages and copies
+    m_vertexBuffer = BufferFactory::CreateStaticBuffer(vertices.data(), bufferSize, vk::BufferUsageFlagBits::eVertexBuffer, MemoryCategory::Mesh, "model vertices");
 }
 
 void MeshModel::CreateIndexBuffer(const std::vector<uint32_t>& indices) {
     m_indexCount = static_cast<uint32_t>(indices.size());
     vk::DeviceSize bufferSize = sizeof(indices[0]) * m_indexCount;
 
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingBufferMemory;
-    Utils::createBuffer(m_device, m_physicalDevice, bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    m_device.mapMemory(stagingBufferMemory, 0, bufferSize, vk::MemoryMapFlags(), &data);
-    memcpy(data, indices.data(), bufferSize);
-    m_device.unmapMemory(stagingBufferMemory);
-
-    Utils::createBuffer(m_device, m_physicalDevice, bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-        vk::MemoryPropertyFlagBits::eDeviceLocal, m_indexBuffer, m_indexBufferMemory);
-
-    Utils::copyBuffer(m_device, m_graphicsQueue, stagingBuffer, m_indexBuffer, bufferSize);
-
-    m_device.destroyBuffer(stagingBuffer);
-    m_device.freeMemory(stagingBufferMemory);
+    m_indexBuffer = BufferFactory::CreateStaticBuffer(indices.data(), bufferSize, vk::BufferUsageFlagBits::eIndexBuffer, MemoryCategory::Mesh, "model indices");
 }
 
-glm::mat4 MeshModel::CalculateModelMatrix() {
-    glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), m_position);
-    glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(m_rotation.y), glm::vec3(0, 1, 0))
-        * glm::rotate(glm::mat4(1.0f), glm::radians(m_rotation.x), glm::vec3(1, 0, 0))
-        * glm::rotate(glm::mat4(1.0f), glm::radians(m_rotation.z), glm::vec3(0, 0, 1));
-    glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), m_scale);
-
-    return translationMatrix * rotationMatrix * scaleMatrix;
-}
 
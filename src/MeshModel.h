@@ -8,6 +8,9 @@
 #include "VertexStandard.h"
 #include "Camera.h"
 #include "Utils.h"
+#include "BufferFactory.h"
+#include "MappedBuffer.h"
+#include "TransformStore.h"
 //#include "Light.h"
 
 class MeshModel {
@@ -20,14 +23,17 @@ public:
     void Update(float deltaTime);
     void Render(vk::CommandBuffer commandBuffer, vk::Pipeline pipeline, vk::PipelineLayout pipelineLayout, vk::DescriptorSet descriptorSet);
 
+    // Setters only store the value, the model matrix is recomposed once when next asked for
     void SetPosition(const glm::vec3& newPos);
+    // Euler angles in degrees, applied Y then X then Z
     void SetRotation(const glm::vec3& newRot);
     void SetScale(const glm::vec3& newScale);
+    const glm::mat4& GetModelMatrix();
 
     void SetTexture(vk::ImageView textureImageView, vk::Sampler textureSampler);
   //  void SetMaterial(const Material& material);
 
-    void UpdateUniformBuffer(vk::DeviceMemory uniformMemory, const Utils::UniformBufferObject& ubo);
+    void UpdateUniformBuffer(MappedBuffer& uniformBuffer, const Utils::UniformBufferObject& ubo);
     void CreateVertexBuffer(const std::vector<Utils::Vertex>& vertices);
 
 private:
@@ -36,13 +42,11 @@ private:
     vk::CommandPool m_commandPool;
     vk::Queue m_graphicsQueue;
 
-    vk::Buffer m_vertexBuffer;
-    vk::DeviceMemory m_vertexBufferMemory;
-    uint32_t m_vertexCount;
+    StaticBuffer m_vertexBuffer;
+    uint32_t m_vertexCount = 0;
 
-    vk::Buffer m_indexBuffer;
-    vk::DeviceMemory m_indexBufferMemory;
-    uint32_t m_indexCount;
+    StaticBuffer m_indexBuffer;
+    uint32_t m_indexCount = 0;
 
     vk::ImageView m_textureImageView;
     vk::Sampler m_textureSampler;
@@ -51,12 +55,12 @@ private:
     vk::PipelineLayout m_pipelineLayout;
 
     glm::vec3 m_position;
-    glm::vec3 m_rotation;
+    glm::quat m_rotation;
     glm::vec3 m_scale;
     glm::mat4 m_modelMatrix;
+    bool m_modelMatrixDirty = true;
 
     void LoadModel(const std::string& modelFilePath);
     void CreateVertexBuffer(const std::vector<VertexStandard>& vertices);
     void CreateIndexBuffer(const std::vector<uint32_t>& indices);
-    glm::mat4 CalculateModelMatrix();
 };
@@ -0,0 +1,181 @@
+#include "PipelineCacheFile.h"
+#include "gettime.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+vk::Device PipelineCacheFile::Device;
+vk::PhysicalDeviceProperties PipelineCacheFile::Properties;
+std::string PipelineCacheFile::Path;
+vk::PipelineCache PipelineCacheFile::Cache;
+
+bool PipelineCacheFile::Warm = false;
+uint64_t PipelineCacheFile::LoadedBytes = 0;
+std::atomic<uint32_t> PipelineCacheFile::PipelinesCreated { 0 };
+std::atomic<uint64_t> PipelineCacheFile::CreationTotalNs { 0 };
+
+PipelineCacheFile::PipelineCacheFile() {}
+PipelineCacheFile::~PipelineCacheFile() {}
+
+void PipelineCacheFile::Init(vk::Device InDevice, const vk::PhysicalDeviceProperties& InProperties, const char* InPath)
+{
+	Device = InDevice;
+	Properties = InProperties;
+	Path = InPath;
+	PipelinesCreated = 0;
+	CreationTotalNs = 0;
+
+	std::vector<uint8_t> data;
+	Warm = LoadFile(data) && IsCompatible(data);
+	if (!Warm) {
+		data.clear();
+	}
+	LoadedBytes = data.size();
+
+	auto cache_return = Device.createPipelineCache(vk::PipelineCacheCreateInfo().setInitialDataSize(data.size()).setPInitialData(data.data()));
+	if (cache_return.result != vk::Result::eSuccess && Warm) {
+		// Valid header but the driver still refused it, start cold rather than fail
+		fprintf(stderr, "Pipeline cache %s was rejected by the driver, starting empty\n", Path.c_str());
+		Warm = false;
+		LoadedBytes = 0;
+		cache_return = Device.createPipelineCache(vk::PipelineCacheCreateInfo());
+	}
+	VERIFY(cache_return.result == vk::Result::eSuccess);
+	Cache = cache_return.value;
+}
+
+void PipelineCacheFile::Shutdown()
+{
+	if (!Cache) {
+		return;
+	}
+
+	if (PipelinesCreated > 0) {
+		const uint32_t created = PipelinesCreated.load();
+		const double total_ms = static_cast<double>(CreationTotalNs.load()) / 1e6;
+		printf("Pipeline cache (%s, %" PRIu64 " bytes loaded): %u pipeline(s) created in %.3f ms, avg %.3f ms\n", Warm ? "warm" : "cold",
+			LoadedBytes, created, total_ms, total_ms / static_cast<double>(created));
+		fflush(stdout);
+	}
+
+	Save();
+	Device.destroyPipelineCache(Cache);
+	Cache = vk::PipelineCache();
+}
+
+bool PipelineCacheFile::Save()
+{
+	auto data_return = Device.getPipelineCacheData(Cache);
+	VERIFY(data_return.result == vk::Result::eSuccess);
+	const auto& data = data_return.value;
+	if (data.empty()) {
+		return true;
+	}
+
+	FileHeader header;
+	header.magic = FileMagic;
+	header.version = FileVersion;
+	header.data_size = data.size();
+	header.data_hash = Hash(data.data(), data.size());
+
+	const std::string temp_path = Path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Failed to write pipeline cache %s\n", temp_path.c_str());
+		return false;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+	written = fflush(file) == 0 && written;
+#if !defined(_WIN32)
+	// On disk before the rename makes it visible
+	written = fsync(fileno(file)) == 0 && written;
+#endif
+	written = fclose(file) == 0 && written;
+
+	if (written) {
+#if defined(_WIN32)
+		written = MoveFileExA(temp_path.c_str(), Path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		written = rename(temp_path.c_str(), Path.c_str()) == 0;
+#endif
+	}
+	if (!written) {
+		fprintf(stderr, "Failed to write pipeline cache %s\n", Path.c_str());
+		remove(temp_path.c_str());
+	}
+	return written;
+}
+
+vk::Pipeline PipelineCacheFile::CreateGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& Info)
+{
+	const uint64_t start_ns = getTimeInNanoseconds();
+	auto pipeline_return = Device.createGraphicsPipelines(Cache, Info);
+	VERIFY(pipeline_return.result == vk::Result::eSuccess);
+	CreationTotalNs += getTimeInNanoseconds() - start_ns;
+	PipelinesCreated++;
+	return pipeline_return.value.at(0);
+}
+
+bool PipelineCacheFile::LoadFile(std::vector<uint8_t>& OutData)
+{
+	std::ifstream File(Path, std::ios::ate | std::ios::binary);
+	if (!File.is_open()) {
+		// First run
+		return false;
+	}
+
+	const size_t file_size = static_cast<size_t>(File.tellg());
+	FileHeader header = {};
+	File.seekg(0);
+	if (file_size < sizeof(header) || !File.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		fprintf(stderr, "Pipeline cache %s is truncated, ignoring it\n", Path.c_str());
+		return false;
+	}
+	if (header.magic != FileMagic || header.version != FileVersion || header.data_size != file_size - sizeof(header)) {
+		fprintf(stderr, "Pipeline cache %s has an unknown format or size, ignoring it\n", Path.c_str());
+		return false;
+	}
+
+	OutData.resize(static_cast<size_t>(header.data_size));
+	if (!File.read(reinterpret_cast<char*>(OutData.data()), OutData.size()) || Hash(OutData.data(), OutData.size()) != header.data_hash) {
+		fprintf(stderr, "Pipeline cache %s is corrupted, ignoring it\n", Path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool PipelineCacheFile::IsCompatible(const std::vector<uint8_t>& Data)
+{
+	// VkPipelineCacheHeaderVersionOne: the driver's data is only valid for the exact device and driver build that
+	// wrote it, a driver update changes pipelineCacheUUID
+	VkPipelineCacheHeaderVersionOne header;
+	if (Data.size() < sizeof(header)) {
+		fprintf(stderr, "Pipeline cache %s has no valid header, ignoring it\n", Path.c_str());
+		return false;
+	}
+	memcpy(&header, Data.data(), sizeof(header));
+
+	if (header.headerSize < sizeof(header) || header.headerSize > Data.size() ||
+		header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+		fprintf(stderr, "Pipeline cache %s has no valid header, ignoring it\n", Path.c_str());
+		return false;
+	}
+	if (header.vendorID != Properties.vendorID || header.deviceID != Properties.deviceID ||
+		memcmp(header.pipelineCacheUUID, Properties.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0) {
+		fprintf(stderr, "Pipeline cache %s was written by another device or driver version, starting empty\n", Path.c_str());
+		return false;
+	}
+	return true;
+}
+
+uint64_t PipelineCacheFile::Hash(const uint8_t* Data, size_t Size)
+{
+	// FNV-1a, enough to notice a damaged file
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < Size; i++) {
+		hash ^= Data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
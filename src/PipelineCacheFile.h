@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+
+// The device's vk::PipelineCache, kept for the lifetime of the device and persisted to disk between runs so pipelines
+// compiled once are never compiled again. Data from another driver or device is detected before it reaches the
+// driver and thrown away, the cache then simply starts cold.
+class PipelineCacheFile
+{
+public:
+	// Creates the cache, seeded from Path when the file is intact and was written for this device and driver
+	static void Init(vk::Device Device, const vk::PhysicalDeviceProperties& Properties, const char* Path);
+	// Saves and destroys the cache, prints cold or warm creation times
+	static void Shutdown();
+
+	static vk::PipelineCache Get() { return Cache; }
+	// Replace the file with the cache's current contents, write to a temporary and rename so a crash never leaves a
+	// torn file behind. Returns false if the file couldn't be written.
+	static bool Save();
+
+	// createGraphicsPipelines() through the cache, timed for the cold/warm report. Pipeline library parts and links
+	// count too. Thread safe.
+	static vk::Pipeline CreateGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& Info);
+
+private:
+	// Prefixed to the driver's data so truncated or corrupted files are caught without the driver parsing them
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t data_size;
+		uint64_t data_hash;
+	};
+	static constexpr uint32_t FileMagic = 0x43504b56; // "VKPC"
+	static constexpr uint32_t FileVersion = 1;
+
+	static bool LoadFile(std::vector<uint8_t>& OutData);
+	static bool IsCompatible(const std::vector<uint8_t>& Data);
+	static uint64_t Hash(const uint8_t* Data, size_t Size);
+
+	static vk::Device Device;
+	static vk::PhysicalDeviceProperties Properties;
+	static std::string Path;
+	static vk::PipelineCache Cache;
+
+	// Whether the cache started from valid data on disk
+	static bool Warm;
+	static uint64_t LoadedBytes;
+	// Pipelines may be created on several threads at once
+	static std::atomic<uint32_t> PipelinesCreated;
+	static std::atomic<uint64_t> CreationTotalNs;
+
+	PipelineCacheFile();
+	~PipelineCacheFile();
+};
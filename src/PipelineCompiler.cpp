@@ -0,0 +1,345 @@
+#include "PipelineCompiler.h"
+#include "GpuTimeline.h"
+#include "PipelineLibrary.h"
+#include "gettime.h"
+
+#include <algorithm>
+
+PipelineCompiler::~PipelineCompiler()
+{
+	Stop();
+}
+
+void PipelineCompiler::Start(uint32_t ThreadCount)
+{
+	assert(m_threads.empty());
+	m_quit = false;
+	for (uint32_t i = 0; i < ThreadCount; i++) {
+		m_threads.emplace_back(&PipelineCompiler::WorkerMain, this);
+	}
+}
+
+void PipelineCompiler::Stop()
+{
+	Reset();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_jobReady.notify_all();
+	for (auto& thread : m_threads) {
+		thread.join();
+	}
+	m_threads.clear();
+}
+
+uint32_t PipelineCompiler::Compile(const char* Name, BuildFn Build)
+{
+	const uint32_t id = AddEntry(Name, std::move(Build), BuildFn(), NoPipeline, false);
+	BuildNow(id);
+	return id;
+}
+
+uint32_t PipelineCompiler::CompileAsync(const char* Name, BuildFn Build, uint32_t Fallback)
+{
+	if (m_threads.empty()) {
+		// No workers, the first frame stalls instead
+		return Compile(Name, std::move(Build));
+	}
+
+	const uint32_t id = AddEntry(Name, std::move(Build), BuildFn(), Fallback, true);
+	QueueJob(id, false);
+	return id;
+}
+
+void PipelineCompiler::QueueJob(uint32_t Id, bool Optimize)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.push_back({ Id, Optimize });
+	}
+	m_jobReady.notify_one();
+}
+
+uint32_t PipelineCompiler::Request(const char* Name, const PipelineStateKey& Key, bool Async, uint32_t Fallback)
+{
+	auto found = m_states.find(Key);
+	if (found != m_states.end()) {
+		m_stateHits++;
+		return found->second;
+	}
+
+	m_stateMisses++;
+	// The builds own a copy, the caller's key may be gone before a worker gets to it
+	BuildFn build = [Key]() { return Key.CreatePipeline(); };
+	BuildFn optimize;
+	if (PipelineLibrary::IsEnabled()) {
+		if (m_threads.empty()) {
+			// Nobody to relink in the background, link the final pipeline right away
+			build = [Key]() { return PipelineLibrary::Link(Key, true); };
+		} else {
+			build = [Key]() { return PipelineLibrary::Link(Key, false); };
+			optimize = [Key]() { return PipelineLibrary::Link(Key, true); };
+		}
+	}
+
+	// The entry is complete before any job for it is queued, a worker finishing the fast link has to see optimize
+	const bool async = Async && !m_threads.empty();
+	const bool queue_optimize = static_cast<bool>(optimize);
+	const uint32_t id = AddEntry(Name, std::move(build), std::move(optimize), async ? Fallback : NoPipeline, async);
+	m_states.emplace(Key, id);
+	if (async) {
+		// The worker queues the optimization once the fast link is done
+		QueueJob(id, false);
+	} else {
+		BuildNow(id);
+		if (queue_optimize) {
+			QueueJob(id, true);
+		}
+	}
+	return id;
+}
+
+uint32_t PipelineCompiler::Reload(const std::string& ShaderFile, uint64_t ChangedNs)
+{
+	uint32_t count = 0;
+	for (const auto& state : m_states) {
+		if (state.first.vertex_shader != ShaderFile && state.first.fragment_shader != ShaderFile) {
+			continue;
+		}
+		const uint32_t id = state.second;
+		count++;
+
+		if (!m_threads.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_entries[id].reload_changed_ns = ChangedNs;
+				m_queue.push_back({ id, false });
+			}
+			m_jobReady.notify_one();
+			continue;
+		}
+
+		// No workers: build right away, the swap still waits for PublishFinished()
+		BuildFn build;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_entries[id].reload_changed_ns = ChangedNs;
+			build = m_entries[id].build;
+		}
+		const vk::Pipeline pipeline = build();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		SetCompiled(m_entries[id], pipeline);
+		m_finished.push_back(id);
+	}
+	return count;
+}
+
+void PipelineCompiler::SetCompiled(Entry& Target, vk::Pipeline Pipeline)
+{
+	if (Target.compiled && Target.compiled != Target.published) {
+		// Superseded by a newer reload before it was ever published, the GPU never saw it
+		GVulkanObjects.device.destroyPipeline(Target.compiled);
+	}
+	Target.compiled = Pipeline;
+}
+
+uint32_t PipelineCompiler::AddEntry(const char* Name, BuildFn Build, BuildFn Optimize, uint32_t Fallback, bool Async)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Entry entry;
+	entry.stats.name = Name;
+	entry.stats.async = Async;
+	entry.build = std::move(Build);
+	entry.optimize = std::move(Optimize);
+	entry.fallback = Fallback;
+	m_entries.push_back(std::move(entry));
+	return static_cast<uint32_t>(m_entries.size() - 1);
+}
+
+void PipelineCompiler::BuildNow(uint32_t Id)
+{
+	BuildFn build;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		build = m_entries[Id].build;
+	}
+
+	const uint64_t start_ns = getTimeInNanoseconds();
+	const vk::Pipeline pipeline = build();
+	const uint64_t elapsed_ns = getTimeInNanoseconds() - start_ns;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& entry = m_entries[Id];
+	entry.compiled = pipeline;
+	entry.published = pipeline;
+	entry.stats.compile_ns = elapsed_ns;
+	entry.stats.stall_ns = elapsed_ns;
+}
+
+void PipelineCompiler::WorkerMain()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_jobReady.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+		if (m_quit) {
+			return;
+		}
+
+		const Job job = m_queue.front();
+		m_queue.pop_front();
+		m_running++;
+		BuildFn build = job.optimize ? m_entries[job.id].optimize : m_entries[job.id].build;
+		lock.unlock();
+
+		const uint64_t start_ns = getTimeInNanoseconds();
+		const vk::Pipeline pipeline = build();
+		const uint64_t elapsed_ns = getTimeInNanoseconds() - start_ns;
+
+		lock.lock();
+		auto& entry = m_entries[job.id];
+		SetCompiled(entry, pipeline);
+		if (job.optimize) {
+			entry.stats.optimize_ns = elapsed_ns;
+		} else {
+			if (entry.reload_changed_ns == 0) {
+				entry.stats.compile_ns = elapsed_ns;
+			}
+			if (entry.optimize) {
+				// Draw with the fast link meanwhile, reloads are relinked too
+				m_queue.push_back({ job.id, true });
+				m_jobReady.notify_one();
+			}
+		}
+		m_finished.push_back(job.id);
+		m_running--;
+		m_jobDone.notify_all();
+	}
+}
+
+uint32_t PipelineCompiler::PublishFinished()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (uint32_t id : m_finished) {
+		auto& entry = m_entries[id];
+		if (entry.published && entry.published != entry.compiled) {
+			// Frames in flight may still draw with the previous version
+			const vk::Pipeline previous = entry.published;
+			GpuTimeline::DeferRelease([previous]() { GVulkanObjects.device.destroyPipeline(previous); });
+		}
+		entry.published = entry.compiled;
+
+		if (entry.reload_changed_ns != 0) {
+			const uint64_t latency_ns = getTimeInNanoseconds() - entry.reload_changed_ns;
+			entry.stats.reloads++;
+			entry.stats.reload_total_ns += latency_ns;
+			entry.reload_changed_ns = 0;
+			printf("Reloaded pipeline %s, %.3f ms after the shader changed\n", entry.stats.name.c_str(), static_cast<double>(latency_ns) / 1e6);
+			fflush(stdout);
+		}
+	}
+	const uint32_t count = static_cast<uint32_t>(m_finished.size());
+	m_finished.clear();
+	return count;
+}
+
+vk::Pipeline PipelineCompiler::Resolve(uint32_t Id)
+{
+	if (Id == NoPipeline) {
+		return vk::Pipeline();
+	}
+
+	// Only the main thread adds entries or touches the published state, no lock needed
+	auto& entry = m_entries[Id];
+	const uint64_t now_ns = getTimeInNanoseconds();
+	if (entry.first_needed_ns == 0) {
+		entry.first_needed_ns = now_ns;
+	}
+
+	if (entry.published) {
+		if (!entry.stats.hitch_measured && entry.stats.async) {
+			// Visible for the first time, everything drawn so far was a stand-in. 0 if it was ready when first needed.
+			entry.stats.hitch_ns = now_ns - entry.first_needed_ns;
+			entry.stats.hitch_measured = true;
+		}
+		return entry.published;
+	}
+
+	const vk::Pipeline fallback = Resolve(entry.fallback);
+	if (entry.stand_in_frame != m_frame) {
+		entry.stand_in_frame = m_frame;
+		if (fallback) {
+			entry.stats.fallback_frames++;
+		} else {
+			entry.stats.skipped_frames++;
+		}
+	}
+	return fallback;
+}
+
+void PipelineCompiler::WaitIdle()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobDone.wait(lock, [this] { return m_queue.empty() && m_running == 0; });
+	}
+	PublishFinished();
+}
+
+void PipelineCompiler::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	// Queued builds never started, they are simply forgotten
+	m_queue.clear();
+	m_jobDone.wait(lock, [this] { return m_running == 0; });
+
+	for (auto& entry : m_entries) {
+		GVulkanObjects.device.destroyPipeline(entry.compiled);
+		if (entry.published != entry.compiled) {
+			// A reload that was never published
+			GVulkanObjects.device.destroyPipeline(entry.published);
+		}
+
+		auto previous = std::find_if(m_history.begin(), m_history.end(), [&entry](const Stats& stats) { return stats.name == entry.stats.name; });
+		if (previous != m_history.end()) {
+			previous->rebuilds++;
+			previous->reloads += entry.stats.reloads;
+			previous->reload_total_ns += entry.stats.reload_total_ns;
+		} else {
+			m_history.push_back(entry.stats);
+		}
+	}
+	m_entries.clear();
+	m_finished.clear();
+	m_states.clear();
+}
+
+void PipelineCompiler::PrintStats() const
+{
+	if (m_stateHits + m_stateMisses > 0) {
+		printf("Pipeline states: %u request(s), %u built, %u shared an existing pipeline\n", m_stateHits + m_stateMisses, m_stateMisses,
+			m_stateHits);
+	}
+	for (const auto& stats : m_history) {
+		printf("Pipeline %s (%s): compiled in %.3f ms, main thread stalled %.3f ms", stats.name.c_str(), stats.async ? "async" : "sync",
+			static_cast<double>(stats.compile_ns) / 1e6, static_cast<double>(stats.stall_ns) / 1e6);
+		if (stats.optimize_ns > 0) {
+			printf(", optimized in %.3f ms", static_cast<double>(stats.optimize_ns) / 1e6);
+		}
+		if (stats.async && stats.hitch_measured) {
+			printf(", first use hitch %.3f ms (%u frame(s) with fallback, %u skipped)", static_cast<double>(stats.hitch_ns) / 1e6,
+				stats.fallback_frames, stats.skipped_frames);
+		} else if (stats.async) {
+			printf(", never drawn (%u frame(s) with fallback, %u skipped)", stats.fallback_frames, stats.skipped_frames);
+		}
+		if (stats.rebuilds > 0) {
+			printf(", rebuilt %u time(s)", stats.rebuilds);
+		}
+		if (stats.reloads > 0) {
+			printf(", hot reloaded %u time(s) in %.3f ms avg", stats.reloads, static_cast<double>(stats.reload_total_ns) / 1e6 / stats.reloads);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
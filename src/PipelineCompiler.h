@@ -0,0 +1,138 @@
+#pragma once
+
+#include "common.h"
+#include "PipelineState.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Builds pipelines on background threads so startup and new materials never wait for the driver's compiler. Every
+// pipeline gets an id right away. Until it has compiled, Resolve() hands out its fallback instead, or a null pipeline
+// whose draws the caller skips. Builds share PipelineCacheFile's cache, which Vulkan synchronizes internally.
+class PipelineCompiler
+{
+public:
+	using BuildFn = std::function<vk::Pipeline()>;
+	static constexpr uint32_t NoPipeline = UINT32_MAX;
+
+	PipelineCompiler() = default;
+	~PipelineCompiler();
+
+	PipelineCompiler(const PipelineCompiler&) = delete;
+	PipelineCompiler& operator=(const PipelineCompiler&) = delete;
+
+	// 0 threads compiles every pipeline on the thread that asks for it
+	void Start(uint32_t ThreadCount);
+	// Drops queued builds, destroys every pipeline and joins the threads
+	void Stop();
+
+	// Compile on the calling thread, for fallbacks that have to be there from the first frame
+	uint32_t Compile(const char* Name, BuildFn Build);
+	// Queue Build for a worker, Fallback draws in its place until it is done. Build must own everything it uses.
+	uint32_t CompileAsync(const char* Name, BuildFn Build, uint32_t Fallback = NoPipeline);
+
+	// The pipeline Key describes, built on first request (asynchronously if Async, drawing Fallback meanwhile) and
+	// shared by every later request for the same state. Name only labels the stats of the first request. With the
+	// pipeline library it is fast linked from shared parts, and a link time optimized version replaces it once a
+	// worker has built that.
+	uint32_t Request(const char* Name, const PipelineStateKey& Key, bool Async = false, uint32_t Fallback = NoPipeline);
+	// Requests for an already known state, and those that built a new pipeline, kept across Reset()
+	uint32_t GetStateHits() const { return m_stateHits; }
+	uint32_t GetStateMisses() const { return m_stateMisses; }
+
+	// Rebuild every requested pipeline using ShaderFile, which changed on disk. The old pipelines keep drawing until the
+	// new ones are published, then they are destroyed once the frames using them retire. Returns how many were queued.
+	uint32_t Reload(const std::string& ShaderFile, uint64_t ChangedNs);
+
+	// Main thread, before recording: make pipelines that finished since the last call visible to Resolve(). Returns
+	// how many, commands recorded with their fallbacks or previous versions are stale then.
+	uint32_t PublishFinished();
+	// Main thread, once per frame before its Resolve() calls, so a frame resolving a pipeline more than once counts once
+	void BeginFrame() { m_frame++; }
+	// Main thread: Id's pipeline, its fallback's while it compiles, or null to skip the draws
+	vk::Pipeline Resolve(uint32_t Id);
+	// Block until every queued build is done, then publish them
+	void WaitIdle();
+	// Wait for running builds and destroy every pipeline, before the render pass they were built for goes away.
+	// Previous ids are invalid afterwards, their stats are kept for the report.
+	void Reset();
+
+	void PrintStats() const;
+
+private:
+	struct Stats {
+		std::string name;
+		bool async = false;
+		uint64_t compile_ns = 0;
+		// Building the optimized replacement of a fast linked pipeline, on a worker
+		uint64_t optimize_ns = 0;
+		// Main thread time blocked on the build, all of it for synchronous builds
+		uint64_t stall_ns = 0;
+		// From the first frame that needed the pipeline to the first that drew with it
+		uint64_t hitch_ns = 0;
+		bool hitch_measured = false;
+		uint32_t fallback_frames = 0;
+		uint32_t skipped_frames = 0;
+		// Built again after a Reset(), e.g. on resize. Only the first build is reported in detail.
+		uint32_t rebuilds = 0;
+		// Hot reloads, from the shader change to the new pipeline being published
+		uint32_t reloads = 0;
+		uint64_t reload_total_ns = 0;
+	};
+
+	struct Entry {
+		Stats stats;
+		BuildFn build;
+		// Builds a faster to draw with replacement once build is done, if set
+		BuildFn optimize;
+		uint32_t fallback = NoPipeline;
+		// Written by the worker
+		vk::Pipeline compiled;
+		// Main thread only
+		vk::Pipeline published;
+		uint64_t first_needed_ns = 0;
+		// The last frame counted in fallback_frames or skipped_frames
+		uint64_t stand_in_frame = UINT64_MAX;
+		// When the shader behind a pending reload changed, 0 if none is pending
+		uint64_t reload_changed_ns = 0;
+	};
+
+	struct Job {
+		uint32_t id;
+		bool optimize;
+	};
+
+	void WorkerMain();
+	void QueueJob(uint32_t Id, bool Optimize);
+	uint32_t AddEntry(const char* Name, BuildFn Build, BuildFn Optimize, uint32_t Fallback, bool Async);
+	void BuildNow(uint32_t Id);
+	// With m_mutex held. Replaces a finished build nobody has drawn with yet.
+	void SetCompiled(Entry& Target, vk::Pipeline Pipeline);
+
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_jobReady;
+	std::condition_variable m_jobDone;
+	// A deque so a worker's entry never moves while the main thread adds more
+	std::deque<Entry> m_entries;
+	std::deque<Job> m_queue;
+	std::vector<uint32_t> m_finished;
+	uint32_t m_running = 0;
+	bool m_quit = false;
+
+	// Stats of pipelines destroyed by Reset(), one per name
+	std::vector<Stats> m_history;
+
+	// Main thread only. Keys hold the render pass and layout, so Reset() forgets them with the pipelines.
+	std::unordered_map<PipelineStateKey, uint32_t, PipelineStateKey::Hasher> m_states;
+	uint32_t m_stateHits = 0;
+	uint32_t m_stateMisses = 0;
+	// Main thread only, advanced by BeginFrame()
+	uint64_t m_frame = 0;
+};
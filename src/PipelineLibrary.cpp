@@ -0,0 +1,261 @@
+#include "PipelineLibrary.h"
+#include "PipelineCacheFile.h"
+#include "gettime.h"
+
+#include <array>
+
+vk::Device PipelineLibrary::Device;
+bool PipelineLibrary::Enabled = false;
+bool PipelineLibrary::MeasureComplete = false;
+std::mutex PipelineLibrary::Mutex;
+std::unordered_map<std::string, vk::Pipeline> PipelineLibrary::Parts[PartCount];
+PipelineLibrary::Timing PipelineLibrary::PartTiming;
+PipelineLibrary::Timing PipelineLibrary::FastLinkTiming;
+PipelineLibrary::Timing PipelineLibrary::OptimizedLinkTiming;
+PipelineLibrary::Timing PipelineLibrary::CompleteTiming;
+bool PipelineLibrary::CompleteMeasured = false;
+
+PipelineLibrary::PipelineLibrary() {}
+PipelineLibrary::~PipelineLibrary() {}
+
+namespace {
+
+class PartKeyWriter
+{
+public:
+	void Add(uint32_t Value) { m_bytes.append(reinterpret_cast<const char*>(&Value), sizeof(Value)); }
+	template <typename T>
+	void AddHandle(T Handle)
+	{
+		m_bytes.append(reinterpret_cast<const char*>(&Handle), sizeof(Handle));
+	}
+	const std::string& Get() const { return m_bytes; }
+
+private:
+	std::string m_bytes;
+};
+
+double AverageMs(uint64_t TotalNs, uint32_t Count)
+{
+	return Count > 0 ? static_cast<double>(TotalNs) / 1e6 / Count : 0.0;
+}
+
+}
+
+void PipelineLibrary::Init(vk::Device InDevice, bool InEnabled, bool InMeasureComplete)
+{
+	Device = InDevice;
+	Enabled = InEnabled;
+	MeasureComplete = InMeasureComplete;
+	printf("Graphics pipeline library: %s\n", Enabled ? "linking pipelines from parts" : "not available, building complete pipelines");
+}
+
+void PipelineLibrary::Shutdown()
+{
+	Reset();
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	if (PartTiming.count > 0) {
+		printf("Pipeline library: %u part(s) compiled in %.3f ms avg, %u fast link(s) in %.3f ms avg, %u optimized link(s) in %.3f ms avg\n",
+			PartTiming.count, AverageMs(PartTiming.total_ns, PartTiming.count), FastLinkTiming.count,
+			AverageMs(FastLinkTiming.total_ns, FastLinkTiming.count), OptimizedLinkTiming.count,
+			AverageMs(OptimizedLinkTiming.total_ns, OptimizedLinkTiming.count));
+		if (CompleteTiming.count > 0) {
+			// Without the pipeline cache, though the driver may keep a shader cache of its own
+			printf("Pipeline library: the first optimized pipeline built whole for comparison in %.3f ms\n",
+				AverageMs(CompleteTiming.total_ns, CompleteTiming.count));
+		}
+		fflush(stdout);
+	}
+	PartTiming = Timing();
+	FastLinkTiming = Timing();
+	OptimizedLinkTiming = Timing();
+	CompleteTiming = Timing();
+	CompleteMeasured = false;
+	MeasureComplete = false;
+	Enabled = false;
+}
+
+void PipelineLibrary::Reset()
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	for (auto& parts : Parts) {
+		for (auto& part : parts) {
+			Device.destroyPipeline(part.second);
+		}
+		parts.clear();
+	}
+}
+
+vk::Pipeline PipelineLibrary::Link(const PipelineStateKey& Key, bool Optimize)
+{
+	assert(Enabled);
+
+	const PipelineStateInfo info(Key);
+	std::array<vk::Pipeline, PartCount> libraries;
+	for (uint32_t part = 0; part < PartCount; part++) {
+		libraries[part] = GetPart(Key, info, static_cast<Part>(part));
+	}
+
+	auto const library_info = vk::PipelineLibraryCreateInfoKHR().setLibraries(libraries);
+	auto const create_info = vk::GraphicsPipelineCreateInfo()
+								 .setPNext(&library_info)
+								 .setFlags(Optimize ? vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT : vk::PipelineCreateFlags())
+								 .setLayout(Key.layout);
+
+	const uint64_t start_ns = getTimeInNanoseconds();
+	const vk::Pipeline pipeline = PipelineCacheFile::CreateGraphicsPipeline(create_info);
+	const uint64_t elapsed_ns = getTimeInNanoseconds() - start_ns;
+
+	bool measure_complete = false;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Timing& timing = Optimize ? OptimizedLinkTiming : FastLinkTiming;
+		timing.count++;
+		timing.total_ns += elapsed_ns;
+		// The optimized link is what a complete build compares to, it runs on a worker when there are any
+		measure_complete = MeasureComplete && Optimize && !CompleteMeasured;
+		CompleteMeasured = CompleteMeasured || measure_complete;
+	}
+
+	if (measure_complete) {
+		// Once per run, what this pipeline costs without the library on the same driver
+		const uint64_t complete_start_ns = getTimeInNanoseconds();
+		auto complete_return = Device.createGraphicsPipelines(vk::PipelineCache(), info.GetCreateInfo());
+		const uint64_t complete_ns = getTimeInNanoseconds() - complete_start_ns;
+		VERIFY(complete_return.result == vk::Result::eSuccess);
+		Device.destroyPipeline(complete_return.value.at(0));
+
+		std::lock_guard<std::mutex> lock(Mutex);
+		CompleteTiming.count++;
+		CompleteTiming.total_ns += complete_ns;
+	}
+	return pipeline;
+}
+
+std::string PipelineLibrary::GetPartKey(const PipelineStateKey& Key, const PipelineStateInfo& Info, Part Which)
+{
+	PartKeyWriter writer;
+	writer.Add(Which);
+	switch (Which) {
+	case VertexInput:
+		writer.Add(Key.vertex_binding.binding);
+		writer.Add(Key.vertex_binding.stride);
+		writer.Add(static_cast<uint32_t>(Key.vertex_binding.inputRate));
+		for (const auto& attribute : Key.vertex_attributes) {
+			writer.Add(attribute.location);
+			writer.Add(attribute.binding);
+			writer.Add(static_cast<uint32_t>(attribute.format));
+			writer.Add(attribute.offset);
+		}
+		writer.Add(static_cast<uint32_t>(Key.topology));
+		// Vertex input doesn't depend on the render pass or layout
+		return writer.Get();
+	case PreRasterization:
+		// The module, not the file name: modules are kept per content, so a hot reloaded shader gets a new part
+		writer.AddHandle(static_cast<VkShaderModule>(Info.vertex_module));
+		for (uint32_t value : Key.specialization) {
+			writer.Add(value);
+		}
+		writer.Add(static_cast<uint32_t>(Key.polygon_mode));
+		writer.Add(static_cast<uint32_t>(Key.cull_mode));
+		writer.Add(static_cast<uint32_t>(Key.front_face));
+		writer.AddHandle(static_cast<VkPipelineLayout>(Key.layout));
+		break;
+	case FragmentShader:
+		writer.AddHandle(static_cast<VkShaderModule>(Info.fragment_module));
+		for (uint32_t value : Key.specialization) {
+			writer.Add(value);
+		}
+		writer.Add((Key.depth_test ? 1u : 0u) | (Key.depth_write ? 2u : 0u));
+		writer.Add(static_cast<uint32_t>(Key.depth_compare));
+		writer.AddHandle(static_cast<VkPipelineLayout>(Key.layout));
+		break;
+	default:
+		writer.Add(Key.blend ? 1u : 0u);
+		writer.Add(static_cast<uint32_t>(Key.src_color_blend));
+		writer.Add(static_cast<uint32_t>(Key.dst_color_blend));
+		writer.Add(static_cast<uint32_t>(Key.color_blend_op));
+		writer.Add(static_cast<uint32_t>(Key.src_alpha_blend));
+		writer.Add(static_cast<uint32_t>(Key.dst_alpha_blend));
+		writer.Add(static_cast<uint32_t>(Key.alpha_blend_op));
+		writer.Add(static_cast<uint32_t>(Key.color_write_mask));
+		break;
+	}
+	writer.AddHandle(static_cast<VkRenderPass>(Key.render_pass));
+	writer.Add(Key.subpass);
+	writer.Add(static_cast<uint32_t>(Key.color_format));
+	writer.Add(static_cast<uint32_t>(Key.depth_format));
+	return writer.Get();
+}
+
+vk::Pipeline PipelineLibrary::GetPart(const PipelineStateKey& Key, const PipelineStateInfo& Info, Part Which)
+{
+	const std::string part_key = GetPartKey(Key, Info, Which);
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		auto found = Parts[Which].find(part_key);
+		if (found != Parts[Which].end()) {
+			return found->second;
+		}
+	}
+
+	// Keep what a later optimized link needs
+	auto create_info = vk::GraphicsPipelineCreateInfo().setFlags(vk::PipelineCreateFlagBits::eLibraryKHR |
+		vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT);
+	vk::GraphicsPipelineLibraryCreateInfoEXT library_info;
+	switch (Which) {
+	case VertexInput:
+		library_info.setFlags(vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface);
+		create_info.setPVertexInputState(&Info.vertex_input).setPInputAssemblyState(&Info.input_assembly);
+		break;
+	case PreRasterization:
+		library_info.setFlags(vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders);
+		create_info.setStageCount(1)
+			.setPStages(&Info.stages[0])
+			.setPViewportState(&Info.viewport)
+			.setPRasterizationState(&Info.rasterization)
+			.setPDynamicState(&Info.dynamic)
+			.setLayout(Key.layout)
+			.setRenderPass(Key.render_pass)
+			.setSubpass(Key.subpass);
+		break;
+	case FragmentShader:
+		library_info.setFlags(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader);
+		create_info.setStageCount(1)
+			.setPStages(&Info.stages[1])
+			.setPMultisampleState(&Info.multisample)
+			.setPDepthStencilState(&Info.depth_stencil)
+			.setLayout(Key.layout)
+			.setRenderPass(Key.render_pass)
+			.setSubpass(Key.subpass);
+		break;
+	default:
+		library_info.setFlags(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface);
+		create_info.setPColorBlendState(&Info.color_blend)
+			.setPMultisampleState(&Info.multisample)
+			.setRenderPass(Key.render_pass)
+			.setSubpass(Key.subpass);
+		break;
+	}
+	if (Which != VertexInput && !Key.render_pass) {
+		// Dynamic rendering, the attachment formats stand in for the render pass
+		library_info.setPNext(&Info.rendering);
+	}
+	create_info.setPNext(&library_info);
+
+	const uint64_t start_ns = getTimeInNanoseconds();
+	const vk::Pipeline part = PipelineCacheFile::CreateGraphicsPipeline(create_info);
+	const uint64_t elapsed_ns = getTimeInNanoseconds() - start_ns;
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	auto inserted = Parts[Which].emplace(part_key, part);
+	if (!inserted.second) {
+		// Another thread compiled the same part meanwhile, keep theirs
+		Device.destroyPipeline(part);
+		return inserted.first->second;
+	}
+	PartTiming.count++;
+	PartTiming.total_ns += elapsed_ns;
+	return part;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+#include "PipelineState.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// VK_EXT_graphics_pipeline_library: every state key is split into its vertex input, pre-rasterization, fragment
+// shader and fragment output parts. Each distinct part is compiled once, pipelines are then linked from parts,
+// which is far cheaper than compiling a complete pipeline for every permutation. A fast link draws right away, a link
+// time optimized one can replace it later. Without the extension nothing here is used and pipelines are built whole.
+class PipelineLibrary
+{
+public:
+	// Enabled only if the device was created with the extension and its feature. MeasureComplete also builds the
+	// first key given a link time optimized pipeline whole, on the same thread (a compile worker unless there are
+	// none), for comparison. That build bypasses the pipeline cache, so it neither warms the cache nor counts in
+	// PipelineCacheFile's report.
+	static void Init(vk::Device Device, bool Enabled, bool MeasureComplete);
+	// Destroys every part and prints the compile and link times, next to the complete build if one was measured
+	static void Shutdown();
+	static bool IsEnabled() { return Enabled; }
+
+	// Link Key's pipeline from its parts, compiling the parts not seen before. Optimize asks for a link time optimized
+	// pipeline, slower to link but as fast to draw with as a complete one. Parts and links are created through
+	// PipelineCacheFile, so they count in its report. Any thread.
+	static vk::Pipeline Link(const PipelineStateKey& Key, bool Optimize);
+	// Destroy the parts, before the render pass or layout they were built for goes away. Linked pipelines stay valid.
+	static void Reset();
+
+private:
+	enum Part : uint32_t { VertexInput, PreRasterization, FragmentShader, FragmentOutput, PartCount };
+
+	struct Timing {
+		uint32_t count = 0;
+		uint64_t total_ns = 0;
+	};
+
+	static std::string GetPartKey(const PipelineStateKey& Key, const PipelineStateInfo& Info, Part Which);
+	static vk::Pipeline GetPart(const PipelineStateKey& Key, const PipelineStateInfo& Info, Part Which);
+
+	static vk::Device Device;
+	static bool Enabled;
+
+	static std::mutex Mutex;
+	// Keyed by the state each part depends on, serialized, so only identical parts are shared
+	static std::unordered_map<std::string, vk::Pipeline> Parts[PartCount];
+	static Timing PartTiming;
+	static Timing FastLinkTiming;
+	static Timing OptimizedLinkTiming;
+	// With MeasureComplete, the first optimized key also built whole once
+	static bool MeasureComplete;
+	static Timing CompleteTiming;
+	static bool CompleteMeasured;
+
+	PipelineLibrary();
+	~PipelineLibrary();
+};
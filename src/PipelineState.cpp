@@ -0,0 +1,204 @@
+#include "PipelineState.h"
+#include "PipelineCacheFile.h"
+#include "ShaderLoader.h"
+
+namespace {
+
+class StateHasher
+{
+public:
+	void Add(uint32_t Value)
+	{
+		m_hash ^= Value;
+		m_hash *= 1099511628211ull;
+	}
+	void Add(const std::string& Value)
+	{
+		Add(static_cast<uint32_t>(Value.size()));
+		for (char c : Value) {
+			Add(static_cast<uint32_t>(static_cast<unsigned char>(c)));
+		}
+	}
+	template <typename T>
+	void AddHandle(T Handle)
+	{
+		// Non-dispatchable handles are 64 bit on every platform
+		uint64_t value = 0;
+		static_assert(sizeof(Handle) == sizeof(value), "unexpected handle size");
+		memcpy(&value, &Handle, sizeof(value));
+		Add(static_cast<uint32_t>(value));
+		Add(static_cast<uint32_t>(value >> 32));
+	}
+	uint64_t Get() const { return m_hash; }
+
+private:
+	uint64_t m_hash = 14695981039346656037ull;
+};
+
+}
+
+bool PipelineStateKey::operator==(const PipelineStateKey& Other) const
+{
+	return vertex_shader == Other.vertex_shader && fragment_shader == Other.fragment_shader && specialization == Other.specialization &&
+		vertex_binding == Other.vertex_binding && vertex_attributes == Other.vertex_attributes && topology == Other.topology &&
+		polygon_mode == Other.polygon_mode && cull_mode == Other.cull_mode && front_face == Other.front_face &&
+		depth_test == Other.depth_test && depth_write == Other.depth_write && depth_compare == Other.depth_compare &&
+		blend == Other.blend && src_color_blend == Other.src_color_blend && dst_color_blend == Other.dst_color_blend &&
+		color_blend_op == Other.color_blend_op && src_alpha_blend == Other.src_alpha_blend && dst_alpha_blend == Other.dst_alpha_blend &&
+		alpha_blend_op == Other.alpha_blend_op && color_write_mask == Other.color_write_mask && render_pass == Other.render_pass &&
+		subpass == Other.subpass && layout == Other.layout && color_format == Other.color_format && depth_format == Other.depth_format;
+}
+
+size_t PipelineStateKey::Hash() const
+{
+	StateHasher hasher;
+	hasher.Add(vertex_shader);
+	hasher.Add(fragment_shader);
+	hasher.Add(static_cast<uint32_t>(specialization.size()));
+	for (uint32_t value : specialization) {
+		hasher.Add(value);
+	}
+
+	hasher.Add(vertex_binding.binding);
+	hasher.Add(vertex_binding.stride);
+	hasher.Add(static_cast<uint32_t>(vertex_binding.inputRate));
+	hasher.Add(static_cast<uint32_t>(vertex_attributes.size()));
+	for (const auto& attribute : vertex_attributes) {
+		hasher.Add(attribute.location);
+		hasher.Add(attribute.binding);
+		hasher.Add(static_cast<uint32_t>(attribute.format));
+		hasher.Add(attribute.offset);
+	}
+	hasher.Add(static_cast<uint32_t>(topology));
+
+	hasher.Add(static_cast<uint32_t>(polygon_mode));
+	hasher.Add(static_cast<uint32_t>(cull_mode));
+	hasher.Add(static_cast<uint32_t>(front_face));
+
+	// Flags packed into one word
+	hasher.Add((depth_test ? 1u : 0u) | (depth_write ? 2u : 0u) | (blend ? 4u : 0u));
+	hasher.Add(static_cast<uint32_t>(depth_compare));
+	if (blend) {
+		hasher.Add(static_cast<uint32_t>(src_color_blend));
+		hasher.Add(static_cast<uint32_t>(dst_color_blend));
+		hasher.Add(static_cast<uint32_t>(color_blend_op));
+		hasher.Add(static_cast<uint32_t>(src_alpha_blend));
+		hasher.Add(static_cast<uint32_t>(dst_alpha_blend));
+		hasher.Add(static_cast<uint32_t>(alpha_blend_op));
+	}
+	hasher.Add(static_cast<uint32_t>(color_write_mask));
+
+	hasher.AddHandle(static_cast<VkRenderPass>(render_pass));
+	hasher.Add(subpass);
+	hasher.AddHandle(static_cast<VkPipelineLayout>(layout));
+	hasher.Add(static_cast<uint32_t>(color_format));
+	hasher.Add(static_cast<uint32_t>(depth_format));
+
+	const uint64_t hash = hasher.Get();
+	return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+vk::Pipeline PipelineStateKey::CreatePipeline() const
+{
+	const PipelineStateInfo info(*this);
+	// Through the device's persistent pipeline cache, a warm cache skips the shader compilation
+	return PipelineCacheFile::CreateGraphicsPipeline(info.GetCreateInfo());
+}
+
+PipelineStateInfo::PipelineStateInfo(const PipelineStateKey& Key)
+	: m_key(Key)
+{
+	if (!Key.vertex_attributes.empty()) {
+		vertex_input.setVertexBindingDescriptions(Key.vertex_binding).setVertexAttributeDescriptions(Key.vertex_attributes);
+	}
+
+	input_assembly.setTopology(Key.topology);
+
+	viewport.setViewportCount(1).setScissorCount(1);
+
+	rasterization.setDepthClampEnable(VK_FALSE)
+		.setRasterizerDiscardEnable(VK_FALSE)
+		.setPolygonMode(Key.polygon_mode)
+		.setCullMode(Key.cull_mode)
+		.setFrontFace(Key.front_face)
+		.setDepthBiasEnable(VK_FALSE)
+		.setLineWidth(1.0f);
+
+	auto const stencilOp = vk::StencilOpState().setFailOp(vk::StencilOp::eKeep).setPassOp(vk::StencilOp::eKeep).setCompareOp(vk::CompareOp::eAlways);
+
+	depth_stencil.setDepthTestEnable(Key.depth_test)
+		.setDepthWriteEnable(Key.depth_write)
+		.setDepthCompareOp(Key.depth_compare)
+		.setDepthBoundsTestEnable(VK_FALSE)
+		.setStencilTestEnable(VK_FALSE)
+		.setFront(stencilOp)
+		.setBack(stencilOp);
+
+	blend_attachment.setBlendEnable(Key.blend)
+		.setSrcColorBlendFactor(Key.src_color_blend)
+		.setDstColorBlendFactor(Key.dst_color_blend)
+		.setColorBlendOp(Key.color_blend_op)
+		.setSrcAlphaBlendFactor(Key.src_alpha_blend)
+		.setDstAlphaBlendFactor(Key.dst_alpha_blend)
+		.setAlphaBlendOp(Key.alpha_blend_op)
+		.setColorWriteMask(Key.color_write_mask);
+
+	color_blend.setAttachments(blend_attachment);
+
+	dynamic_states = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+	dynamic.setDynamicStates(dynamic_states);
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(Key.specialization.size()); i++) {
+		specialization_entries.push_back(vk::SpecializationMapEntry(i, i * sizeof(uint32_t), sizeof(uint32_t)));
+	}
+	specialization.setMapEntries(specialization_entries)
+		.setDataSize(Key.specialization.size() * sizeof(uint32_t))
+		.setPData(Key.specialization.data());
+
+	vertex_module = ShaderLoader::CreateShader(Key.vertex_shader);
+	fragment_module = ShaderLoader::CreateShader(Key.fragment_shader);
+
+	const vk::SpecializationInfo* stage_specialization = Key.specialization.empty() ? nullptr : &specialization;
+	stages = {
+		vk::PipelineShaderStageCreateInfo()
+			.setStage(vk::ShaderStageFlagBits::eVertex)
+			.setModule(vertex_module)
+			.setPName("main")
+			.setPSpecializationInfo(stage_specialization),
+		vk::PipelineShaderStageCreateInfo()
+			.setStage(vk::ShaderStageFlagBits::eFragment)
+			.setModule(fragment_module)
+			.setPName("main")
+			.setPSpecializationInfo(stage_specialization)
+	};
+
+	if (!Key.render_pass) {
+		rendering.setColorAttachmentCount(Key.color_format != vk::Format::eUndefined ? 1 : 0)
+			.setPColorAttachmentFormats(&Key.color_format)
+			.setDepthAttachmentFormat(Key.depth_format);
+	}
+}
+
+PipelineStateInfo::~PipelineStateInfo()
+{
+	ShaderLoader::DestroyShader(fragment_module);
+	ShaderLoader::DestroyShader(vertex_module);
+}
+
+vk::GraphicsPipelineCreateInfo PipelineStateInfo::GetCreateInfo() const
+{
+	return vk::GraphicsPipelineCreateInfo()
+		.setPNext(m_key.render_pass ? nullptr : &rendering)
+		.setStages(stages)
+		.setPVertexInputState(&vertex_input)
+		.setPInputAssemblyState(&input_assembly)
+		.setPViewportState(&viewport)
+		.setPRasterizationState(&rasterization)
+		.setPMultisampleState(&multisample)
+		.setPDepthStencilState(&depth_stencil)
+		.setPColorBlendState(&color_blend)
+		.setPDynamicState(&dynamic)
+		.setLayout(m_key.layout)
+		.setRenderPass(m_key.render_pass)
+		.setSubpass(m_key.subpass);
+}
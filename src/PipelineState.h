@@ -0,0 +1,97 @@
+#pragma once
+
+#include "common.h"
+
+#include <string>
+
+// Everything that decides what a graphics pipeline compiles to. Two requests with equal keys get the same pipeline,
+// so scene objects and materials ask for whatever state they need without creating duplicates. Viewport and scissor
+// are always dynamic and not part of the key.
+struct PipelineStateKey {
+	// Files in PATH_SHADERS
+	std::string vertex_shader;
+	std::string fragment_shader;
+	// Values of specialization constants 0..n-1, applied to both stages
+	std::vector<uint32_t> specialization;
+
+	// A single interleaved vertex buffer
+	vk::VertexInputBindingDescription vertex_binding;
+	std::vector<vk::VertexInputAttributeDescription> vertex_attributes;
+	vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+
+	vk::PolygonMode polygon_mode = vk::PolygonMode::eFill;
+	vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eBack;
+	vk::FrontFace front_face = vk::FrontFace::eCounterClockwise;
+
+	bool depth_test = true;
+	bool depth_write = true;
+	vk::CompareOp depth_compare = vk::CompareOp::eLessOrEqual;
+
+	bool blend = false;
+	vk::BlendFactor src_color_blend = vk::BlendFactor::eSrcAlpha;
+	vk::BlendFactor dst_color_blend = vk::BlendFactor::eOneMinusSrcAlpha;
+	vk::BlendOp color_blend_op = vk::BlendOp::eAdd;
+	vk::BlendFactor src_alpha_blend = vk::BlendFactor::eOne;
+	vk::BlendFactor dst_alpha_blend = vk::BlendFactor::eZero;
+	vk::BlendOp alpha_blend_op = vk::BlendOp::eAdd;
+	vk::ColorComponentFlags color_write_mask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+		vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+
+	// Pipelines only stay valid with these, the cache is cleared whenever they are re-created
+	vk::RenderPass render_pass;
+	uint32_t subpass = 0;
+	vk::PipelineLayout layout;
+	// Dynamic rendering, when render_pass is null: the attachment formats the pipeline draws to, instead of a render
+	// pass it has to be compatible with. Undefined for no attachment.
+	vk::Format color_format = vk::Format::eUndefined;
+	vk::Format depth_format = vk::Format::eUndefined;
+
+	bool operator==(const PipelineStateKey& Other) const;
+	bool operator!=(const PipelineStateKey& Other) const { return !(*this == Other); }
+	// FNV-1a over the state, the shader names hashed by their characters
+	size_t Hash() const;
+
+	// Build the complete pipeline this key describes through the persistent pipeline cache. Only reads the key, so it
+	// can run on any thread.
+	vk::Pipeline CreatePipeline() const;
+
+	struct Hasher {
+		size_t operator()(const PipelineStateKey& Key) const { return Key.Hash(); }
+	};
+};
+
+// The create info structures a key expands to, shared by complete pipelines and pipeline library parts. They point
+// into each other and into the key, so the key has to outlive this and it can't be copied. Holds the key's shader
+// modules until destroyed.
+struct PipelineStateInfo {
+	explicit PipelineStateInfo(const PipelineStateKey& Key);
+	~PipelineStateInfo();
+
+	PipelineStateInfo(const PipelineStateInfo&) = delete;
+	PipelineStateInfo& operator=(const PipelineStateInfo&) = delete;
+
+	vk::PipelineVertexInputStateCreateInfo vertex_input;
+	vk::PipelineInputAssemblyStateCreateInfo input_assembly;
+	vk::PipelineViewportStateCreateInfo viewport;
+	vk::PipelineRasterizationStateCreateInfo rasterization;
+	vk::PipelineMultisampleStateCreateInfo multisample;
+	vk::PipelineDepthStencilStateCreateInfo depth_stencil;
+	vk::PipelineColorBlendAttachmentState blend_attachment;
+	vk::PipelineColorBlendStateCreateInfo color_blend;
+	std::array<vk::DynamicState, 2> dynamic_states;
+	vk::PipelineDynamicStateCreateInfo dynamic;
+	std::vector<vk::SpecializationMapEntry> specialization_entries;
+	vk::SpecializationInfo specialization;
+	vk::ShaderModule vertex_module;
+	vk::ShaderModule fragment_module;
+	// Vertex first, then fragment
+	std::array<vk::PipelineShaderStageCreateInfo, 2> stages;
+	// Chained by every create info that needs the attachments when the key has no render pass
+	vk::PipelineRenderingCreateInfoKHR rendering;
+
+	// Everything above in one create info, for a complete pipeline
+	vk::GraphicsPipelineCreateInfo GetCreateInfo() const;
+
+private:
+	const PipelineStateKey& m_key;
+};
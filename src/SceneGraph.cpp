@@ -0,0 +1,355 @@
+#include "SceneGraph.h"
+#include "gettime.h"
+
+#include <algorithm>
+
+uint32_t SceneGraph::Add(uint32_t Parent, const glm::vec3& Position, const glm::quat& Rotation, const glm::vec3& Scale)
+{
+	const uint32_t count = GetCount();
+	const uint32_t id = m_locals.Add(Position, Rotation, Scale);
+	assert(id == count);
+
+	uint32_t parent_position = NoParent;
+	uint32_t position = count;
+	if (Parent != NoParent) {
+		parent_position = m_position[Parent];
+		position = parent_position + m_subtreeSize[parent_position];
+	}
+
+	m_position.push_back(position);
+	m_world.push_back(glm::mat4(1.0f));
+	m_moved.push_back(1);
+	m_anyMoved = true;
+	m_changed.push_back(0);
+
+	if (position == count) {
+		m_parent.push_back(parent_position);
+		m_subtreeSize.push_back(1);
+		m_node.push_back(id);
+	} else {
+		// Inside the array, everything behind moves up by one
+		m_parent.insert(m_parent.begin() + position, parent_position);
+		m_subtreeSize.insert(m_subtreeSize.begin() + position, 1);
+		m_node.insert(m_node.begin() + position, id);
+		for (uint32_t i = position + 1; i <= count; i++) {
+			m_position[m_node[i]] = i;
+			if (m_parent[i] != NoParent && m_parent[i] >= position) {
+				m_parent[i]++;
+			}
+		}
+	}
+	AddToAncestors(position, 1);
+	return id;
+}
+
+void SceneGraph::Clear()
+{
+	m_parent.clear();
+	m_subtreeSize.clear();
+	m_node.clear();
+	m_position.clear();
+	m_locals.Clear();
+	m_world.clear();
+	m_moved.clear();
+	m_anyMoved = false;
+	m_changed.clear();
+}
+
+uint32_t SceneGraph::GetParent(uint32_t Node) const
+{
+	const uint32_t parent = m_parent[m_position[Node]];
+	return parent == NoParent ? NoParent : m_node[parent];
+}
+
+void SceneGraph::AddToAncestors(uint32_t Position, int32_t Delta)
+{
+	for (uint32_t ancestor = m_parent[Position]; ancestor != NoParent; ancestor = m_parent[ancestor]) {
+		m_subtreeSize[ancestor] = static_cast<uint32_t>(static_cast<int32_t>(m_subtreeSize[ancestor]) + Delta);
+	}
+}
+
+void SceneGraph::Reparent(uint32_t Node, uint32_t NewParent)
+{
+	const uint32_t first = m_position[Node];
+	const uint32_t size = m_subtreeSize[first];
+	const uint32_t last = first + size;
+
+	// The subtree goes behind the new parent's last descendant, or behind everything as a root
+	uint32_t target = GetCount();
+	if (NewParent != NoParent) {
+		const uint32_t parent_position = m_position[NewParent];
+		assert((parent_position < first || parent_position >= last) && "can't reparent a node under its own subtree");
+		target = parent_position + m_subtreeSize[parent_position];
+	}
+
+	// Before the ancestors' sizes change, while every subtree range is still whole
+	const uint32_t end = target > last ? RangeEnd(first, target) : RangeEnd(target, last);
+	AddToAncestors(first, -static_cast<int32_t>(size));
+	uint32_t new_first = first;
+	if (target > last) {
+		RotateRange(first, last, target, end);
+		new_first = target - size;
+	} else if (target < first) {
+		RotateRange(target, first, last, end);
+		new_first = target;
+	}
+	m_parent[new_first] = NewParent == NoParent ? NoParent : m_position[NewParent];
+	AddToAncestors(new_first, static_cast<int32_t>(size));
+
+	m_moved[Node] = 1;
+	m_anyMoved = true;
+}
+
+uint32_t SceneGraph::RangeEnd(uint32_t First, uint32_t Last) const
+{
+	// A node whose subtree reaches past Last holds the range's last node, so it's that node or one of its ancestors
+	uint32_t end = Last;
+	for (uint32_t position = Last - 1; position != NoParent && position >= First; position = m_parent[position]) {
+		end = std::max(end, position + m_subtreeSize[position]);
+	}
+	return end;
+}
+
+void SceneGraph::RotateRange(uint32_t First, uint32_t Middle, uint32_t Last, uint32_t End)
+{
+	std::rotate(m_parent.begin() + First, m_parent.begin() + Middle, m_parent.begin() + Last);
+	std::rotate(m_subtreeSize.begin() + First, m_subtreeSize.begin() + Middle, m_subtreeSize.begin() + Last);
+	std::rotate(m_node.begin() + First, m_node.begin() + Middle, m_node.begin() + Last);
+
+	// Parents always come first, so only nodes from First on can refer to a position that moved. Those past Last can
+	// too, when an ancestor inside the range has descendants beyond it, but not past that ancestor's subtree.
+	const uint32_t moved_up = Last - Middle;
+	const uint32_t moved_down = Middle - First;
+	for (uint32_t i = First; i < End; i++) {
+		const uint32_t parent = m_parent[i];
+		if (parent == NoParent || parent < First || parent >= Last) {
+			continue;
+		}
+		m_parent[i] = parent < Middle ? parent + moved_up : parent - moved_down;
+	}
+	for (uint32_t i = First; i < Last; i++) {
+		m_position[m_node[i]] = i;
+	}
+}
+
+uint32_t SceneGraph::Update()
+{
+	const uint32_t locals_changed = m_locals.Update();
+	if (locals_changed == 0 && !m_anyMoved) {
+		return 0;
+	}
+
+	// Parents come before their children, so a parent's world matrix is always final by the time a child reads it
+	uint32_t updated = 0;
+	const uint32_t count = GetCount();
+	for (uint32_t position = 0; position < count; position++) {
+		const uint32_t node = m_node[position];
+		const uint32_t parent = m_parent[position];
+		const bool changed = m_moved[node] != 0 || m_locals.WasUpdated(node) || (parent != NoParent && m_changed[parent] != 0);
+		m_changed[position] = changed ? 1 : 0;
+		if (!changed) {
+			continue;
+		}
+
+		m_moved[node] = 0;
+		// The store's "world" matrices are the nodes' local ones
+		const glm::mat4& local = m_locals.GetWorldMatrix(node);
+		m_world[node] = parent == NoParent ? local : m_world[m_node[parent]] * local;
+		updated++;
+	}
+	m_anyMoved = false;
+	return updated;
+}
+
+namespace {
+
+// Every node's world matrix composed from scratch along the chain of Parents, by id, against the graph's. Relative to
+// each matrix's largest value, deep chains of scaled nodes end up orders of magnitude apart.
+float MaxBruteForceError(const SceneGraph& Graph, const std::vector<uint32_t>& Parents)
+{
+	float max_error = 0.0f;
+	for (uint32_t node = 0; node < Graph.GetCount(); node++) {
+		glm::mat4 expected(1.0f);
+		for (uint32_t ancestor = node; ancestor != SceneGraph::NoParent; ancestor = Parents[ancestor]) {
+			expected = TransformStore::Compose(Graph.GetPosition(ancestor), Graph.GetRotation(ancestor), Graph.GetScale(ancestor)) * expected;
+		}
+		float magnitude = 1e-30f;
+		float error = 0.0f;
+		for (int column = 0; column < 4; column++) {
+			for (int row = 0; row < 4; row++) {
+				magnitude = std::max(magnitude, fabsf(expected[column][row]));
+				error = std::max(error, fabsf(Graph.GetWorldMatrix(node)[column][row] - expected[column][row]));
+			}
+		}
+		max_error = std::max(max_error, error / magnitude);
+	}
+	return max_error;
+}
+
+}
+
+void SceneGraph::Benchmark(uint32_t Count, uint32_t Frames)
+{
+	// Props of three nodes: a base on a grid, a head turning on top of it and a barrel sticking out of the head
+	SceneGraph graph;
+	const uint32_t prop_count = Count / 3;
+	std::vector<uint32_t> bases;
+	std::vector<uint32_t> heads;
+	std::vector<uint32_t> barrels;
+	// By id, kept apart from the graph to check it against
+	std::vector<uint32_t> parents;
+	for (uint32_t i = 0; i < prop_count; i++) {
+		bases.push_back(graph.Add(NoParent, glm::vec3(static_cast<float>(i % 512) * 4.0f, 0.0f, static_cast<float>(i / 512) * 4.0f)));
+		heads.push_back(graph.Add(bases.back(), glm::vec3(0.0f, 1.0f, 0.0f)));
+		barrels.push_back(graph.Add(heads.back(), glm::vec3(0.0f, 0.25f, 1.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.2f, 0.2f, 1.5f)));
+		parents.insert(parents.end(), { NoParent, bases.back(), heads.back() });
+	}
+	graph.Update();
+
+	const glm::quat turn = glm::angleAxis(glm::radians(1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	printf("Scene graph benchmark: %u props, %u nodes, %u frames\n", prop_count, graph.GetCount(), Frames);
+
+	// Every prop moving, then one head in a hundred turning
+	for (uint32_t stride : { 1u, 100u }) {
+		uint32_t updated = 0;
+		const uint64_t start_ns = getTimeInNanoseconds();
+		for (uint32_t frame = 0; frame < Frames; frame++) {
+			for (uint32_t i = frame % stride; i < prop_count; i += stride) {
+				if (stride == 1) {
+					graph.SetRotation(bases[i], turn * graph.GetRotation(bases[i]));
+				} else {
+					graph.SetRotation(heads[i], turn * graph.GetRotation(heads[i]));
+				}
+			}
+			updated += graph.Update();
+		}
+		const double ms = static_cast<double>(getTimeInNanoseconds() - start_ns) / 1e6 / Frames;
+		printf("  %-22s %8.3f ms per frame, %u world matrices recomputed per frame\n", stride == 1 ? "every base turning:" : "1 in 100 heads turning:",
+			ms, updated / Frames);
+	}
+
+	// Hand barrels to the next prop, then swap them between props at both ends. Each move rearranges the arrays in
+	// place, over the range between the node and its new parent.
+	const uint32_t reparents = prop_count < 1000 ? prop_count - 1 : 1000;
+	for (bool far : { false, true }) {
+		const uint64_t reparent_start_ns = getTimeInNanoseconds();
+		for (uint32_t i = 0; i < reparents; i++) {
+			const uint32_t head = far ? heads[prop_count - 1 - i] : heads[i + 1];
+			graph.Reparent(barrels[i], head);
+			parents[barrels[i]] = head;
+		}
+		const double reparent_us = static_cast<double>(getTimeInNanoseconds() - reparent_start_ns) / 1e3 / (reparents > 0 ? reparents : 1);
+		const uint64_t update_start_ns = getTimeInNanoseconds();
+		const uint32_t updated = graph.Update();
+		const double update_ms = static_cast<double>(getTimeInNanoseconds() - update_start_ns) / 1e6;
+
+		const float max_error = MaxBruteForceError(graph, parents);
+		printf("  %u reparents %s: %.3f us each, next update recomputed %u world matrices in %.3f ms, world matrices within %g of brute force\n",
+			reparents, far ? "across the graph" : "to the next prop", reparent_us, updated, update_ms, max_error);
+	}
+	fflush(stdout);
+}
+
+bool SceneGraph::CheckReparenting(uint32_t Count, uint32_t Reparents)
+{
+	// Fixed seed, every run checks the same moves
+	uint32_t seed = 12345;
+	auto random = [&seed](uint32_t Range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % Range;
+	};
+	auto random_float = [&seed](float Min, float Max) {
+		seed = seed * 1664525u + 1013904223u;
+		return Min + (Max - Min) * static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+	};
+	auto random_rotation = [&random_float]() {
+		const glm::vec3 axis = glm::normalize(glm::vec3(random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), random_float(0.1f, 1.0f)));
+		return glm::angleAxis(random_float(-3.14f, 3.14f), axis);
+	};
+
+	// Each node under a random earlier one, so most land inside the array, one in eight a root
+	SceneGraph graph;
+	std::vector<uint32_t> parents;
+	for (uint32_t i = 0; i < Count; i++) {
+		const uint32_t parent = i == 0 || random(8) == 0 ? NoParent : random(i);
+		parents.push_back(parent);
+		graph.Add(parent, glm::vec3(random_float(-2.0f, 2.0f), random_float(-2.0f, 2.0f), random_float(-2.0f, 2.0f)), random_rotation(),
+			glm::vec3(random_float(0.8f, 1.25f)));
+	}
+
+	auto in_subtree = [&parents](uint32_t Node, uint32_t Root) {
+		for (uint32_t ancestor = Node; ancestor != NoParent; ancestor = parents[ancestor]) {
+			if (ancestor == Root) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// The arrays against the parents: a depth-first order with every subtree the contiguous range behind its root
+	auto structure_matches = [&graph, &parents]() {
+		const uint32_t count = graph.GetCount();
+		std::vector<uint32_t> sizes(count, 0);
+		for (uint32_t node = 0; node < count; node++) {
+			for (uint32_t ancestor = node; ancestor != NoParent; ancestor = parents[ancestor]) {
+				sizes[ancestor]++;
+			}
+		}
+		for (uint32_t position = 0; position < count; position++) {
+			const uint32_t node = graph.m_node[position];
+			const uint32_t parent = graph.m_parent[position];
+			if (graph.m_position[node] != position || graph.GetParent(node) != parents[node] || graph.m_subtreeSize[position] != sizes[node]) {
+				return false;
+			}
+			if (parent != NoParent && (parent >= position || position >= parent + graph.m_subtreeSize[parent])) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	uint32_t leaves = 0;
+	uint32_t subtrees = 0;
+	uint32_t roots = 0;
+	uint32_t checks = 0;
+	bool structure_ok = true;
+	float max_error = 0.0f;
+	for (uint32_t i = 0; i < Reparents; i++) {
+		const uint32_t node = random(Count);
+		uint32_t new_parent = NoParent;
+		if (random(8) != 0) {
+			new_parent = random(Count);
+			if (in_subtree(new_parent, node)) {
+				// Can't go under itself, make it a root instead
+				new_parent = NoParent;
+			}
+		}
+		if (new_parent == NoParent) {
+			roots++;
+		} else if (graph.m_subtreeSize[graph.m_position[node]] > 1) {
+			subtrees++;
+		} else {
+			leaves++;
+		}
+		graph.Reparent(node, new_parent);
+		parents[node] = new_parent;
+
+		// Local changes between the moves, so updates see both
+		if (random(4) == 0) {
+			graph.SetRotation(random(Count), random_rotation());
+		}
+		if (i % 16 == 15 || i + 1 == Reparents) {
+			graph.Update();
+			structure_ok = structure_ok && structure_matches();
+			max_error = std::max(max_error, MaxBruteForceError(graph, parents));
+			checks++;
+		}
+	}
+
+	const bool passed = structure_ok && max_error < 1e-4f;
+	printf("Scene graph reparent check: %u nodes, %u reparents (%u leaves, %u subtrees, %u to the root), %u checks, structure %s, "
+		"world matrices within %g of brute force: %s\n",
+		Count, Reparents, leaves, subtrees, roots, checks, structure_ok ? "matches" : "MISMATCH", max_error, passed ? "passed" : "FAILED");
+	fflush(stdout);
+	return passed;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+#include "TransformStore.h"
+
+// A transform hierarchy for composite objects, a turret's head on its base or a ship's parts, at hundreds of thousands
+// of nodes. The hierarchy is a flat array in depth-first order: every node comes after its parent and a node's
+// subtree is the contiguous range behind it, each entry storing its parent's position. Update() walks that array once,
+// recomputing a world matrix only where the local transform or some ancestor's world matrix changed. Local transforms
+// live in a TransformStore and are composed in its batch pass first.
+//
+// Nodes are referred to by the id Add() returns, which stays the same when reparenting moves the node in the array.
+// World matrices are stored by id too, so nodes added together stay together for consumers like TransformBatch.
+class SceneGraph
+{
+public:
+	static constexpr uint32_t NoParent = UINT32_MAX;
+
+	// Append a node at the end of Parent's subtree, or as a root. Adding nodes depth-first only ever appends.
+	uint32_t Add(uint32_t Parent, const glm::vec3& Position, const glm::quat& Rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		const glm::vec3& Scale = glm::vec3(1.0f));
+	void Clear();
+	uint32_t GetCount() const { return static_cast<uint32_t>(m_parent.size()); }
+
+	// Move Node and its subtree under NewParent, or make it a root. Rearranges the arrays in place, nothing is
+	// reallocated. Node's world transform follows its new parent. NewParent must not be inside Node's subtree.
+	void Reparent(uint32_t Node, uint32_t NewParent);
+	uint32_t GetParent(uint32_t Node) const;
+
+	// Local transforms, relative to the parent
+	void SetPosition(uint32_t Node, const glm::vec3& Position) { m_locals.SetPosition(Node, Position); }
+	void SetRotation(uint32_t Node, const glm::quat& Rotation) { m_locals.SetRotation(Node, Rotation); }
+	void SetScale(uint32_t Node, const glm::vec3& Scale) { m_locals.SetScale(Node, Scale); }
+	glm::vec3 GetPosition(uint32_t Node) const { return m_locals.GetPosition(Node); }
+	glm::quat GetRotation(uint32_t Node) const { return m_locals.GetRotation(Node); }
+	glm::vec3 GetScale(uint32_t Node) const { return m_locals.GetScale(Node); }
+
+	// Bring the world matrices of every changed subtree up to date. Returns how many were recomputed.
+	uint32_t Update();
+	// By id, current as of the last Update()
+	const glm::mat4* GetWorldMatrices() const { return m_world.data(); }
+	const glm::mat4& GetWorldMatrix(uint32_t Node) const { return m_world[Node]; }
+	// By id, each node's local transform as a matrix, current as of the last Update()
+	const glm::mat4* GetLocalMatrices() const { return m_locals.GetWorldMatrices(); }
+
+	// Build props of a base, a head turning on it and a barrel on the head, about Count nodes in all. Time updating
+	// after a few heads turned against recomputing every world matrix, and reparenting props, and print the results.
+	static void Benchmark(uint32_t Count, uint32_t Frames);
+	// Reparent random nodes of a random hierarchy of Count nodes, leaves, whole subtrees and to the root, turning
+	// random nodes in between. After every few moves check the arrays and every world matrix against a brute-force
+	// recomputation from parents kept separately. Prints the result, returns false on any mismatch.
+	static bool CheckReparenting(uint32_t Count, uint32_t Reparents);
+
+private:
+	// Positions in depth-first order
+	std::vector<uint32_t> m_parent;
+	std::vector<uint32_t> m_subtreeSize;
+	std::vector<uint32_t> m_node;
+	// By id
+	std::vector<uint32_t> m_position;
+	TransformStore m_locals;
+	std::vector<glm::mat4> m_world;
+	// Set by Add() and Reparent(), the node's world matrix has to be recomputed even if nothing else changed
+	std::vector<uint8_t> m_moved;
+	bool m_anyMoved = false;
+	// Update() scratch by position, whether the node's world matrix changed this time
+	std::vector<uint8_t> m_changed;
+
+	// Move the ranges [First, Middle) and [Middle, Last) past each other, fixing up every position stored. Nodes
+	// referring into the range end before End, see RangeEnd().
+	void RotateRange(uint32_t First, uint32_t Middle, uint32_t Last, uint32_t End);
+	// The end of the subtrees of the nodes in [First, Last), at least Last
+	uint32_t RangeEnd(uint32_t First, uint32_t Last) const;
+	void AddToAncestors(uint32_t Position, int32_t Delta);
+};
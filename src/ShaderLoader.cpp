@@ -1,41 +1,340 @@
 #include "ShaderLoader.h"
 
+#include <algorithm>
+#include <vulkan/vulkan_format_traits.hpp>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::mutex ShaderLoader::Mutex;
+std::unordered_multimap<uint64_t, ShaderLoader::CachedModule> ShaderLoader::Modules;
+uint32_t ShaderLoader::ModulesCreated = 0;
+uint32_t ShaderLoader::CacheHits = 0;
+std::unordered_map<std::vector<uint32_t>, vk::DescriptorSetLayout, ShaderLoader::WordsHash> ShaderLoader::SetLayouts;
+std::unordered_map<std::vector<uint32_t>, vk::PipelineLayout, ShaderLoader::WordsHash> ShaderLoader::PipelineLayouts;
+uint32_t ShaderLoader::LayoutRequests = 0;
+
 ShaderLoader::ShaderLoader() {}
 ShaderLoader::~ShaderLoader() {}
 
-std::vector<char> LoadShaderFile(const std::string& FullFilePath)
+namespace {
+
+constexpr uint32_t SpirvMagic = 0x07230203;
+// Magic, version, generator, bound, schema
+constexpr size_t SpirvHeaderWords = 5;
+
+// Read-only mapping of a whole file. Mappings start on a page boundary, so the words are properly aligned for
+// vk::ShaderModuleCreateInfo::pCode, which a std::vector<char> never guaranteed.
+class MappedShaderFile
 {
-	std::ifstream File(FullFilePath, std::ios::ate | std::ios::binary);
-	if (!File.is_open())
+public:
+	explicit MappedShaderFile(const std::string& Path)
 	{
-		std::string msg = "Failed to open shader file: " + FullFilePath;
-		ERR_EXIT(FullFilePath.c_str(), "Create Shader Failed");
+#if defined(_WIN32)
+		m_file = CreateFileA(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		LARGE_INTEGER size = {};
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+			return;
+		}
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping == nullptr) {
+			return;
+		}
+		m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		m_size = m_data ? static_cast<size_t>(size.QuadPart) : 0;
+#else
+		m_fd = open(Path.c_str(), O_RDONLY);
+		if (m_fd < 0) {
+			return;
+		}
+		struct stat info = {};
+		if (fstat(m_fd, &info) != 0 || info.st_size == 0) {
+			return;
+		}
+		void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+		if (data == MAP_FAILED) {
+			return;
+		}
+		m_data = data;
+		m_size = static_cast<size_t>(info.st_size);
+#endif
+	}
+
+	~MappedShaderFile()
+	{
+#if defined(_WIN32)
+		if (m_data) {
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping) {
+			CloseHandle(m_mapping);
+		}
+		if (m_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(m_file);
+		}
+#else
+		if (m_data) {
+			munmap(m_data, m_size);
+		}
+		if (m_fd >= 0) {
+			close(m_fd);
+		}
+#endif
 	}
 
-	size_t FileSize = static_cast<size_t>(File.tellg());
-	std::vector<char> Buffer(FileSize);
-	File.seekg(0);
-	File.read(Buffer.data(), FileSize);
+	MappedShaderFile(const MappedShaderFile&) = delete;
+	MappedShaderFile& operator=(const MappedShaderFile&) = delete;
+
+	bool IsOpen() const { return m_data != nullptr; }
+	const uint32_t* GetWords() const { return static_cast<const uint32_t*>(m_data); }
+	size_t GetSize() const { return m_size; }
+
+private:
+#if defined(_WIN32)
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+	void* m_data = nullptr;
+	size_t m_size = 0;
+};
 
-	File.close();
-	return Buffer;
 }
 
 const vk::ShaderModule ShaderLoader::CreateShader(const std::string& FileName)
+{
+	return Load(FileName, true).module;
+}
+
+ShaderLoader::CachedModule& ShaderLoader::Load(const std::string& FileName, bool CreateModule)
 {
 	assert(GVulkanObjects.initialized);
 	
 	std::string FullFilePath = PATH_SHADERS;
 	FullFilePath.append(FileName);	
-	auto ShaderData = LoadShaderFile(FullFilePath);
+	MappedShaderFile File(FullFilePath);
+	if (!File.IsOpen()) {
+		std::string msg = "Failed to open shader file: " + FullFilePath;
+		ERR_EXIT(msg.c_str(), "Create Shader Failed");
+	}
+	if (File.GetSize() % sizeof(uint32_t) != 0 || File.GetSize() < SpirvHeaderWords * sizeof(uint32_t) ||
+		File.GetWords()[0] != SpirvMagic) {
+		std::string msg = "Not a SPIR-V module: " + FullFilePath;
+		ERR_EXIT(msg.c_str(), "Create Shader Failed");
+	}
+
+	const size_t WordCount = File.GetSize() / sizeof(uint32_t);
+	const uint64_t ContentHash = Hash(File.GetWords(), WordCount);
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	const auto Candidates = Modules.equal_range(ContentHash);
+	auto Found = std::find_if(Candidates.first, Candidates.second, [&File](const auto& Entry) {
+		return Entry.second.code.size() * sizeof(uint32_t) == File.GetSize() &&
+			memcmp(Entry.second.code.data(), File.GetWords(), File.GetSize()) == 0;
+	});
+	if (Found == Candidates.second) {
+		CachedModule Loaded;
+		std::string Error;
+		if (!ShaderReflection::Parse(File.GetWords(), WordCount, Loaded.reflection, Error)) {
+			std::string msg = "Failed to reflect " + FullFilePath + ": " + Error;
+			ERR_EXIT(msg.c_str(), "Create Shader Failed");
+		}
+		Loaded.code.assign(File.GetWords(), File.GetWords() + WordCount);
+		Found = Modules.emplace(ContentHash, std::move(Loaded));
+	}
 
-	const auto ShaderModuleReturn = GVulkanObjects.device.createShaderModule(vk::ShaderModuleCreateInfo().setCodeSize(ShaderData.size()).setPCode(reinterpret_cast<const uint32_t*>(ShaderData.data())));
-	VERIFY(ShaderModuleReturn.result == vk::Result::eSuccess);
+	auto& Cached = Found->second;
+	if (CreateModule) {
+		if (Cached.module) {
+			CacheHits++;
+		} else {
+			const auto ShaderModuleReturn = GVulkanObjects.device.createShaderModule(vk::ShaderModuleCreateInfo().setCodeSize(File.GetSize()).setPCode(File.GetWords()));
+			VERIFY(ShaderModuleReturn.result == vk::Result::eSuccess);
+			Cached.module = ShaderModuleReturn.value;
+			ModulesCreated++;
+		}
+	}
 
-	return ShaderModuleReturn.value;
+	// Entries are only erased by Shutdown(), the reference stays valid after the lock is released
+	return Cached;
+}
+
+const ShaderReflection& ShaderLoader::GetReflection(const std::string& FileName)
+{
+	return Load(FileName, false).reflection;
+}
+
+ShaderLoader::PipelineLayoutInfo ShaderLoader::GetPipelineLayout(const std::vector<std::string>& FileNames)
+{
+	PipelineLayoutInfo Info;
+	uint32_t PushConstantSize = 0;
+	vk::ShaderStageFlags PushConstantStages;
+
+	for (const auto& FileName : FileNames) {
+		const ShaderReflection& Reflection = GetReflection(FileName);
+		for (const auto& Binding : Reflection.bindings) {
+			auto Existing = std::find_if(Info.bindings.begin(), Info.bindings.end(), [&Binding](const ReflectedBinding& Other) {
+				return Other.set == Binding.set && Other.binding == Binding.binding;
+			});
+			if (Existing == Info.bindings.end()) {
+				Info.bindings.push_back(Binding);
+				continue;
+			}
+			if (Existing->type != Binding.type || Existing->count != Binding.count) {
+				std::string msg = FileName + ": set " + std::to_string(Binding.set) + " binding " + std::to_string(Binding.binding) + " (" +
+					Binding.name + ") is " + vk::to_string(Binding.type) + "[" + std::to_string(Binding.count) + "], another stage declares it as " +
+					vk::to_string(Existing->type) + "[" + std::to_string(Existing->count) + "]";
+				ERR_EXIT(msg.c_str(), "Pipeline Layout Failed");
+			}
+			Existing->stages |= Binding.stages;
+			Existing->size = Existing->size > Binding.size ? Existing->size : Binding.size;
+		}
+		if (Reflection.push_constant_size > 0) {
+			PushConstantSize = PushConstantSize > Reflection.push_constant_size ? PushConstantSize : Reflection.push_constant_size;
+			PushConstantStages |= Reflection.stage;
+		}
+	}
+
+	std::sort(Info.bindings.begin(), Info.bindings.end(), [](const ReflectedBinding& A, const ReflectedBinding& B) {
+		return A.set != B.set ? A.set < B.set : A.binding < B.binding;
+	});
+	if (PushConstantSize > 0) {
+		Info.push_constant_ranges.push_back(vk::PushConstantRange(PushConstantStages, 0, PushConstantSize));
+	}
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+	LayoutRequests++;
+
+	// The pipeline layout key is every set layout key in order followed by the push constant range
+	std::vector<uint32_t> PipelineKey;
+	const uint32_t SetCount = Info.bindings.empty() ? 0 : Info.bindings.back().set + 1;
+	for (uint32_t Set = 0; Set < SetCount; Set++) {
+		std::vector<uint32_t> SetKey;
+		std::vector<vk::DescriptorSetLayoutBinding> LayoutBindings;
+		for (const auto& Binding : Info.bindings) {
+			if (Binding.set != Set) {
+				continue;
+			}
+			SetKey.insert(SetKey.end(), { Binding.binding, static_cast<uint32_t>(Binding.type), Binding.count, static_cast<uint32_t>(Binding.stages) });
+			LayoutBindings.push_back(vk::DescriptorSetLayoutBinding()
+										 .setBinding(Binding.binding)
+										 .setDescriptorType(Binding.type)
+										 .setDescriptorCount(Binding.count)
+										 .setStageFlags(Binding.stages));
+		}
+
+		auto& SetLayout = SetLayouts[SetKey];
+		if (!SetLayout) {
+			const auto SetLayoutReturn = GVulkanObjects.device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo().setBindings(LayoutBindings));
+			VERIFY(SetLayoutReturn.result == vk::Result::eSuccess);
+			SetLayout = SetLayoutReturn.value;
+		}
+		Info.set_layouts.push_back(SetLayout);
+
+		PipelineKey.push_back(static_cast<uint32_t>(SetKey.size()));
+		PipelineKey.insert(PipelineKey.end(), SetKey.begin(), SetKey.end());
+	}
+	PipelineKey.insert(PipelineKey.end(), { static_cast<uint32_t>(PushConstantStages), PushConstantSize });
+
+	auto& PipelineLayout = PipelineLayouts[PipelineKey];
+	if (!PipelineLayout) {
+		const auto PipelineLayoutReturn = GVulkanObjects.device.createPipelineLayout(
+			vk::PipelineLayoutCreateInfo().setSetLayouts(Info.set_layouts).setPushConstantRanges(Info.push_constant_ranges));
+		VERIFY(PipelineLayoutReturn.result == vk::Result::eSuccess);
+		PipelineLayout = PipelineLayoutReturn.value;
+	}
+	Info.layout = PipelineLayout;
+
+	return Info;
+}
+
+std::vector<vk::VertexInputAttributeDescription> ShaderLoader::GetVertexAttributes(const std::string& FileName,
+	const std::vector<vk::VertexInputAttributeDescription>& Available)
+{
+	const ShaderReflection& Reflection = GetReflection(FileName);
+	if (Reflection.stage != vk::ShaderStageFlagBits::eVertex) {
+		std::string msg = FileName + " is not a vertex shader";
+		ERR_EXIT(msg.c_str(), "Vertex Input Failed");
+	}
+
+	std::vector<vk::VertexInputAttributeDescription> Attributes;
+	for (const auto& Input : Reflection.inputs) {
+		auto Attribute = std::find_if(Available.begin(), Available.end(), [&Input](const vk::VertexInputAttributeDescription& Description) {
+			return Description.location == Input.location;
+		});
+		if (Attribute == Available.end()) {
+			std::string msg = FileName + ": input " + Input.name + " at location " + std::to_string(Input.location) + " has no vertex attribute";
+			ERR_EXIT(msg.c_str(), "Vertex Input Failed");
+		}
+		// The shader may read fewer or more components than the attribute has, missing ones default, but the numeric
+		// type has to match: floats (normalized or not) for floats, integers of the same signedness for integers
+		const std::string ShaderType = vk::componentNumericFormat(Input.format, 0);
+		const std::string AttributeType = vk::componentNumericFormat(Attribute->format, 0);
+		const bool ShaderIntegral = ShaderType == "SINT" || ShaderType == "UINT";
+		const bool AttributeIntegral = AttributeType == "SINT" || AttributeType == "UINT";
+		if (ShaderIntegral != AttributeIntegral || (ShaderIntegral && ShaderType != AttributeType)) {
+			std::string msg = FileName + ": input " + Input.name + " at location " + std::to_string(Input.location) + " is " +
+				vk::to_string(Input.format) + ", the vertex attribute is " + vk::to_string(Attribute->format);
+			ERR_EXIT(msg.c_str(), "Vertex Input Failed");
+		}
+		Attributes.push_back(*Attribute);
+	}
+	return Attributes;
 }
 
 void ShaderLoader::DestroyShader(vk::ShaderModule& ShaderModule)
 {
-	GVulkanObjects.device.destroyShaderModule(ShaderModule);
-}
\ No newline at end of file
+	// Cached modules outlive their pipelines, destroying one here could let the driver hand its handle to different
+	// code that then matches a stale PipelineLibrary part
+	ShaderModule = vk::ShaderModule();
+}
+
+void ShaderLoader::Shutdown()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	if (ModulesCreated > 0) {
+		printf("Shader modules: %u created, %u reused from the cache\n", ModulesCreated, CacheHits);
+		printf("Layouts: %u descriptor set, %u pipeline for %u requests\n", static_cast<uint32_t>(SetLayouts.size()),
+			static_cast<uint32_t>(PipelineLayouts.size()), LayoutRequests);
+		fflush(stdout);
+	}
+
+	for (auto& Entry : Modules) {
+		GVulkanObjects.device.destroyShaderModule(Entry.second.module);
+	}
+	Modules.clear();
+	ModulesCreated = 0;
+	CacheHits = 0;
+
+	// Pipeline layouts first, they reference the set layouts
+	for (auto& Entry : PipelineLayouts) {
+		GVulkanObjects.device.destroyPipelineLayout(Entry.second);
+	}
+	PipelineLayouts.clear();
+	for (auto& Entry : SetLayouts) {
+		GVulkanObjects.device.destroyDescriptorSetLayout(Entry.second);
+	}
+	SetLayouts.clear();
+	LayoutRequests = 0;
+}
+
+uint64_t ShaderLoader::Hash(const uint32_t* Words, size_t Count)
+{
+	// FNV-1a over whole words, the file is hashed on every load so this has to be cheap
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < Count; i++) {
+		hash ^= Words[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
@@ -1,14 +1,75 @@
 #pragma once
 
 #include "common.h"
+#include "ShaderReflection.h"
 
+#include <mutex>
+#include <unordered_map>
+
+// Loads SPIR-V by memory-mapping the file and keeps one vk::ShaderModule per distinct content. Pipelines built again
+// (resize, variants) get the module created the first time instead of a new one. Modules stay alive until Shutdown(),
+// so a handle is never reused for other code while the loader lives and PipelineLibrary can key its parts by it.
+// Every module is reflected on first load, the descriptor set, pipeline and vertex input layouts are derived from what
+// the shaders declare rather than written out by hand, so a mismatch fails at load time instead of drawing garbage.
 class ShaderLoader
 {
 public:
+	struct PipelineLayoutInfo {
+		vk::PipelineLayout layout;
+		// Indexed by set number, sets no shader uses in between get an empty layout
+		std::vector<vk::DescriptorSetLayout> set_layouts;
+		// Every binding of every set merged across the stages, sorted by set and binding
+		std::vector<ReflectedBinding> bindings;
+		// A single range covering the push constant blocks of all stages, empty if none has one
+		std::vector<vk::PushConstantRange> push_constant_ranges;
+	};
+
+	// The module for FileName in PATH_SHADERS, created only if no loaded file had the same content
 	static const vk::ShaderModule CreateShader(const std::string& FileName);
+	// Hands a module back once the pipelines using it are created. It stays cached for the next build, only Shutdown()
+	// destroys it.
 	static void DestroyShader(vk::ShaderModule& ShaderModule);
 
+	// The interface FileName declares, loads and reflects the file if needed without creating a module
+	static const ShaderReflection& GetReflection(const std::string& FileName);
+	// The layout every pipeline built from any combination of these shaders can use. Set and pipeline layouts are
+	// shared between callers asking for identical ones and owned by the loader. Exits if two stages declare the same
+	// binding differently.
+	static PipelineLayoutInfo GetPipelineLayout(const std::vector<std::string>& FileNames);
+	// The subset of Available the vertex shader FileName reads, exits if it reads a location Available doesn't provide
+	// or in a format it doesn't match
+	static std::vector<vk::VertexInputAttributeDescription> GetVertexAttributes(const std::string& FileName,
+		const std::vector<vk::VertexInputAttributeDescription>& Available);
+
+	// Destroys every cached module and layout and prints how many were created, call before the device is destroyed
+	static void Shutdown();
+
 private:
+	struct CachedModule {
+		vk::ShaderModule module;
+		ShaderReflection reflection;
+		// Compared on a hash match, so a collision can't hand out another file's module
+		std::vector<uint32_t> code;
+	};
+
+	struct WordsHash {
+		size_t operator()(const std::vector<uint32_t>& Words) const { return static_cast<size_t>(Hash(Words.data(), Words.size())); }
+	};
+
+	static uint64_t Hash(const uint32_t* Words, size_t Count);
+	// Maps, validates and reflects FileName and returns its cache entry, with a module only if CreateModule is set
+	static CachedModule& Load(const std::string& FileName, bool CreateModule);
+
+	static std::mutex Mutex;
+	// By content hash, two paths with the same SPIR-V share a module
+	static std::unordered_multimap<uint64_t, CachedModule> Modules;
+	static uint32_t ModulesCreated;
+	static uint32_t CacheHits;
+	// Keyed by the full layout description, compared exactly so a hash collision can't hand out the wrong layout
+	static std::unordered_map<std::vector<uint32_t>, vk::DescriptorSetLayout, WordsHash> SetLayouts;
+	static std::unordered_map<std::vector<uint32_t>, vk::PipelineLayout, WordsHash> PipelineLayouts;
+	static uint32_t LayoutRequests;
+
 	ShaderLoader();
 	~ShaderLoader();
 };
@@ -0,0 +1,428 @@
+#include "ShaderReflection.h"
+
+#include <unordered_map>
+
+namespace {
+
+// The subset of the SPIR-V grammar the reflection needs, values from the SPIR-V specification
+enum SpvOp : uint32_t {
+	OpName = 5,
+	OpEntryPoint = 15,
+	OpTypeBool = 20,
+	OpTypeInt = 21,
+	OpTypeFloat = 22,
+	OpTypeVector = 23,
+	OpTypeMatrix = 24,
+	OpTypeImage = 25,
+	OpTypeSampler = 26,
+	OpTypeSampledImage = 27,
+	OpTypeArray = 28,
+	OpTypeRuntimeArray = 29,
+	OpTypeStruct = 30,
+	OpTypePointer = 32,
+	OpConstant = 43,
+	OpVariable = 59,
+	OpDecorate = 71,
+	OpMemberDecorate = 72,
+};
+
+enum SpvDecoration : uint32_t {
+	DecorationBlock = 2,
+	DecorationBufferBlock = 3,
+	DecorationArrayStride = 6,
+	DecorationMatrixStride = 7,
+	DecorationBuiltIn = 11,
+	DecorationLocation = 30,
+	DecorationBinding = 33,
+	DecorationDescriptorSet = 34,
+	DecorationOffset = 35,
+};
+
+enum SpvStorageClass : uint32_t {
+	StorageUniformConstant = 0,
+	StorageInput = 1,
+	StorageUniform = 2,
+	StoragePushConstant = 9,
+	StorageStorageBuffer = 12,
+};
+
+constexpr uint32_t NotSet = UINT32_MAX;
+constexpr uint32_t SpirvHeaderWords = 5;
+
+struct TypeInfo {
+	uint32_t op = 0;
+	// Int/Float: width, Vector/Matrix/Array: component or element type, Pointer: pointee, SampledImage: image
+	uint32_t inner = 0;
+	// Vector/Matrix: count, Array: id of the length constant, Int: signedness, Image: dim, Pointer: storage class
+	uint32_t count = 0;
+	// Image: the Sampled operand, 1 sampled and 2 storage
+	uint32_t sampled = 0;
+	uint32_t array_stride = 0;
+	std::vector<uint32_t> members;
+	std::vector<uint32_t> member_offsets;
+	std::vector<uint32_t> member_matrix_strides;
+	bool block = false;
+	bool buffer_block = false;
+	bool builtin_members = false;
+};
+
+struct IdInfo {
+	std::string name;
+	uint32_t location = NotSet;
+	uint32_t binding = NotSet;
+	uint32_t set = NotSet;
+	bool builtin = false;
+};
+
+struct Module {
+	std::unordered_map<uint32_t, TypeInfo> types;
+	std::unordered_map<uint32_t, IdInfo> ids;
+	std::unordered_map<uint32_t, uint32_t> constants;
+
+	uint32_t TypeSize(uint32_t Id, uint32_t MatrixStride = 0) const
+	{
+		auto it = types.find(Id);
+		if (it == types.end()) {
+			return 0;
+		}
+		const TypeInfo& type = it->second;
+		switch (type.op) {
+		case OpTypeBool:
+			return 4;
+		case OpTypeInt:
+		case OpTypeFloat:
+			return type.inner / 8;
+		case OpTypeVector:
+			return type.count * TypeSize(type.inner);
+		case OpTypeMatrix:
+			// Column major, the stride comes from the struct member
+			return type.count * (MatrixStride != 0 ? MatrixStride : TypeSize(type.inner));
+		case OpTypeArray: {
+			auto length = constants.find(type.count);
+			const uint32_t count = length != constants.end() ? length->second : 0;
+			return count * (type.array_stride != 0 ? type.array_stride : TypeSize(type.inner));
+		}
+		case OpTypeStruct: {
+			uint32_t size = 0;
+			for (size_t i = 0; i < type.members.size(); i++) {
+				const uint32_t offset = i < type.member_offsets.size() ? type.member_offsets[i] : 0;
+				const uint32_t stride = i < type.member_matrix_strides.size() ? type.member_matrix_strides[i] : 0;
+				const uint32_t end = offset + TypeSize(type.members[i], stride);
+				size = end > size ? end : size;
+			}
+			return size;
+		}
+		default:
+			return 0;
+		}
+	}
+
+	vk::Format InputFormat(uint32_t Id) const
+	{
+		auto it = types.find(Id);
+		if (it == types.end()) {
+			return vk::Format::eUndefined;
+		}
+		uint32_t components = 1;
+		const TypeInfo* scalar = &it->second;
+		if (scalar->op == OpTypeVector) {
+			components = scalar->count;
+			auto component = types.find(scalar->inner);
+			if (component == types.end()) {
+				return vk::Format::eUndefined;
+			}
+			scalar = &component->second;
+		}
+		if (scalar->inner != 32 || components < 1 || components > 4) {
+			return vk::Format::eUndefined;
+		}
+
+		static const vk::Format float_formats[] = { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat,
+			vk::Format::eR32G32B32A32Sfloat };
+		static const vk::Format sint_formats[] = { vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint,
+			vk::Format::eR32G32B32A32Sint };
+		static const vk::Format uint_formats[] = { vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint,
+			vk::Format::eR32G32B32A32Uint };
+		if (scalar->op == OpTypeFloat) {
+			return float_formats[components - 1];
+		}
+		if (scalar->op == OpTypeInt) {
+			return scalar->count != 0 ? sint_formats[components - 1] : uint_formats[components - 1];
+		}
+		return vk::Format::eUndefined;
+	}
+};
+
+// Operands each instruction the reflection reads has at least, so a malformed module can't read past its end
+uint32_t MinOperands(uint32_t Op)
+{
+	switch (Op) {
+	case OpTypeBool:
+	case OpTypeSampler:
+		return 1;
+	case OpName:
+	case OpEntryPoint:
+	case OpTypeFloat:
+	case OpTypeRuntimeArray:
+	case OpTypeSampledImage:
+	case OpDecorate:
+		return 2;
+	case OpTypeInt:
+	case OpTypeVector:
+	case OpTypeMatrix:
+	case OpTypeArray:
+	case OpTypePointer:
+	case OpConstant:
+	case OpVariable:
+	case OpMemberDecorate:
+		return 3;
+	case OpTypeImage:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+std::string ReadString(const uint32_t* Words, uint32_t WordCount)
+{
+	// Nul terminated, padded to a whole word
+	const char* chars = reinterpret_cast<const char*>(Words);
+	size_t length = 0;
+	while (length < WordCount * sizeof(uint32_t) && chars[length] != '\0') {
+		length++;
+	}
+	return std::string(chars, length);
+}
+
+}
+
+bool ShaderReflection::Parse(const uint32_t* Words, size_t WordCount, ShaderReflection& Out, std::string& Error)
+{
+	Out = ShaderReflection();
+	Module module;
+	std::vector<std::pair<uint32_t, uint32_t>> variables; // id, pointer type
+	bool has_entry_point = false;
+
+	size_t offset = SpirvHeaderWords;
+	while (offset < WordCount) {
+		const uint32_t op = Words[offset] & 0xffff;
+		const uint32_t length = Words[offset] >> 16;
+		if (length == 0 || offset + length > WordCount) {
+			Error = "truncated instruction";
+			return false;
+		}
+		const uint32_t* operands = Words + offset + 1;
+		const uint32_t operand_count = length - 1;
+		if (operand_count < MinOperands(op)) {
+			Error = "malformed instruction " + std::to_string(op);
+			return false;
+		}
+
+		switch (op) {
+		case OpName:
+			if (operand_count >= 2) {
+				module.ids[operands[0]].name = ReadString(operands + 1, operand_count - 1);
+			}
+			break;
+		case OpEntryPoint:
+			if (operand_count >= 2 && !has_entry_point) {
+				static const vk::ShaderStageFlagBits stages[] = { vk::ShaderStageFlagBits::eVertex,
+					vk::ShaderStageFlagBits::eTessellationControl, vk::ShaderStageFlagBits::eTessellationEvaluation,
+					vk::ShaderStageFlagBits::eGeometry, vk::ShaderStageFlagBits::eFragment, vk::ShaderStageFlagBits::eCompute };
+				if (operands[0] >= sizeof(stages) / sizeof(stages[0])) {
+					Error = "unsupported execution model " + std::to_string(operands[0]);
+					return false;
+				}
+				Out.stage = stages[operands[0]];
+				has_entry_point = true;
+			}
+			break;
+		case OpTypeBool:
+		case OpTypeSampler:
+			module.types[operands[0]].op = op;
+			break;
+		case OpTypeInt:
+		case OpTypeFloat: {
+			auto& type = module.types[operands[0]];
+			type.op = op;
+			type.inner = operands[1];
+			type.count = op == OpTypeInt ? operands[2] : 0;
+			break;
+		}
+		case OpTypeVector:
+		case OpTypeMatrix:
+		case OpTypeArray: {
+			auto& type = module.types[operands[0]];
+			type.op = op;
+			type.inner = operands[1];
+			type.count = operands[2];
+			break;
+		}
+		case OpTypeRuntimeArray:
+		case OpTypeSampledImage: {
+			auto& type = module.types[operands[0]];
+			type.op = op;
+			type.inner = operands[1];
+			break;
+		}
+		case OpTypeImage: {
+			auto& type = module.types[operands[0]];
+			type.op = op;
+			type.count = operands[2];
+			type.sampled = operands[6];
+			break;
+		}
+		case OpTypeStruct: {
+			auto& type = module.types[operands[0]];
+			type.op = op;
+			type.members.assign(operands + 1, operands + operand_count);
+			break;
+		}
+		case OpTypePointer: {
+			auto& type = module.types[operands[0]];
+			type.op = op;
+			type.count = operands[1];
+			type.inner = operands[2];
+			break;
+		}
+		case OpConstant:
+			// Only 32 bit constants are array lengths
+			if (operand_count == 3) {
+				module.constants[operands[1]] = operands[2];
+			}
+			break;
+		case OpVariable:
+			variables.emplace_back(operands[1], operands[0]);
+			break;
+		case OpDecorate: {
+			const uint32_t target = operands[0];
+			switch (operands[1]) {
+			case DecorationBlock:
+				module.types[target].block = true;
+				break;
+			case DecorationBufferBlock:
+				module.types[target].buffer_block = true;
+				break;
+			case DecorationArrayStride:
+				module.types[target].array_stride = operand_count > 2 ? operands[2] : 0;
+				break;
+			case DecorationBuiltIn:
+				module.ids[target].builtin = true;
+				break;
+			case DecorationLocation:
+				module.ids[target].location = operand_count > 2 ? operands[2] : NotSet;
+				break;
+			case DecorationBinding:
+				module.ids[target].binding = operand_count > 2 ? operands[2] : NotSet;
+				break;
+			case DecorationDescriptorSet:
+				module.ids[target].set = operand_count > 2 ? operands[2] : NotSet;
+				break;
+			}
+			break;
+		}
+		case OpMemberDecorate: {
+			auto& type = module.types[operands[0]];
+			const uint32_t member = operands[1];
+			if ((operands[2] == DecorationOffset || operands[2] == DecorationMatrixStride) && operand_count > 3) {
+				auto& values = operands[2] == DecorationOffset ? type.member_offsets : type.member_matrix_strides;
+				if (values.size() <= member) {
+					values.resize(member + 1, 0);
+				}
+				values[member] = operands[3];
+			} else if (operands[2] == DecorationBuiltIn) {
+				type.builtin_members = true;
+			}
+			break;
+		}
+		}
+		offset += length;
+	}
+
+	if (!has_entry_point) {
+		Error = "no entry point";
+		return false;
+	}
+
+	for (const auto& variable : variables) {
+		const uint32_t id = variable.first;
+		auto pointer = module.types.find(variable.second);
+		if (pointer == module.types.end() || pointer->second.op != OpTypePointer) {
+			continue;
+		}
+		const uint32_t storage = pointer->second.count;
+		uint32_t type_id = pointer->second.inner;
+		const IdInfo& info = module.ids[id];
+
+		if (storage == StorageInput) {
+			// Only vertex inputs are fed by the pipeline, inputs of later stages are the previous stage's outputs
+			const auto& type = module.types[type_id];
+			if (Out.stage != vk::ShaderStageFlagBits::eVertex || info.builtin || type.builtin_members || info.location == NotSet) {
+				continue;
+			}
+			ReflectedInput input;
+			input.location = info.location;
+			input.format = module.InputFormat(type_id);
+			input.name = info.name;
+			if (input.format == vk::Format::eUndefined) {
+				Error = "input " + info.name + " has a type the reflection doesn't support";
+				return false;
+			}
+			Out.inputs.push_back(input);
+			continue;
+		}
+
+		if (storage == StoragePushConstant) {
+			Out.push_constant_size = module.TypeSize(type_id);
+			continue;
+		}
+
+		if (storage != StorageUniformConstant && storage != StorageUniform && storage != StorageStorageBuffer) {
+			continue;
+		}
+
+		ReflectedBinding binding;
+		binding.set = info.set != NotSet ? info.set : 0;
+		binding.binding = info.binding != NotSet ? info.binding : 0;
+		binding.stages = Out.stage;
+		binding.name = info.name;
+
+		// Arrays of descriptors
+		const TypeInfo* type = &module.types[type_id];
+		if (type->op == OpTypeArray) {
+			auto length = module.constants.find(type->count);
+			binding.count = length != module.constants.end() ? length->second : 1;
+			type_id = type->inner;
+			type = &module.types[type_id];
+		} else if (type->op == OpTypeRuntimeArray) {
+			Error = "runtime descriptor array " + info.name + " is not supported";
+			return false;
+		}
+
+		if (storage == StorageStorageBuffer || (storage == StorageUniform && type->buffer_block)) {
+			binding.type = vk::DescriptorType::eStorageBuffer;
+			binding.size = module.TypeSize(type_id);
+		} else if (storage == StorageUniform) {
+			binding.type = vk::DescriptorType::eUniformBuffer;
+			binding.size = module.TypeSize(type_id);
+		} else if (type->op == OpTypeSampledImage) {
+			binding.type = vk::DescriptorType::eCombinedImageSampler;
+		} else if (type->op == OpTypeSampler) {
+			binding.type = vk::DescriptorType::eSampler;
+		} else if (type->op == OpTypeImage) {
+			// Dim 5 is Buffer, 6 SubpassData
+			if (type->count == 6) {
+				binding.type = vk::DescriptorType::eInputAttachment;
+			} else if (type->count == 5) {
+				binding.type = type->sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+			} else {
+				binding.type = type->sampled == 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+			}
+		} else {
+			Error = "resource " + info.name + " has a type the reflection doesn't support";
+			return false;
+		}
+		Out.bindings.push_back(binding);
+	}
+	return true;
+}
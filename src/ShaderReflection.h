@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+#include <string>
+
+// A descriptor a shader declares
+struct ReflectedBinding {
+	uint32_t set = 0;
+	uint32_t binding = 0;
+	vk::DescriptorType type = vk::DescriptorType::eUniformBuffer;
+	uint32_t count = 1;
+	vk::ShaderStageFlags stages;
+	// Bytes of a uniform or storage buffer block, 0 for everything else
+	uint32_t size = 0;
+	std::string name;
+};
+
+// A vertex shader input with an explicit location
+struct ReflectedInput {
+	uint32_t location = 0;
+	vk::Format format = vk::Format::eUndefined;
+	std::string name;
+};
+
+// The resource interface of one SPIR-V module: what the descriptor set and pipeline layouts and the vertex input have
+// to provide for it
+struct ShaderReflection {
+	vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex;
+	std::vector<ReflectedBinding> bindings;
+	// Bytes of the push constant block, 0 if the shader has none
+	uint32_t push_constant_size = 0;
+	// Vertex shaders only
+	std::vector<ReflectedInput> inputs;
+
+	// Walks the module's type declarations, decorations and variables. Returns false with a reason for modules that
+	// use something the reflection doesn't understand.
+	static bool Parse(const uint32_t* Words, size_t WordCount, ShaderReflection& Out, std::string& Error);
+};
@@ -0,0 +1,220 @@
+#include "ShaderWatcher.h"
+#include "gettime.h"
+
+#include <chrono>
+#include <filesystem>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool EndsWith(const std::string& Value, const char* Suffix)
+{
+	const size_t length = strlen(Suffix);
+	return Value.size() >= length && Value.compare(Value.size() - length, length, Suffix) == 0;
+}
+
+bool IsGlslSource(const std::string& Name)
+{
+	static const char* const extensions[] = { ".vert", ".frag", ".comp", ".geom", ".tesc", ".tese" };
+	for (const char* extension : extensions) {
+		if (EndsWith(Name, extension)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ReplaceAll(std::string& Value, const std::string& From, const std::string& To)
+{
+	for (size_t at = Value.find(From); at != std::string::npos; at = Value.find(From, at + To.size())) {
+		Value.replace(at, From.size(), To);
+	}
+}
+
+// Value as a single word of the std::system() shell, so spaces and shell metacharacters in file names reach the
+// compiler unchanged instead of being interpreted
+std::string QuoteArgument(const std::string& Value)
+{
+#if defined(_WIN32)
+	// cmd.exe: Windows file names can't contain quotes. It still expands %VAR% inside them, CompileSource() refuses
+	// names with a %.
+	return "\"" + Value + "\"";
+#else
+	// POSIX sh: nothing is special inside single quotes, a quote itself ends them, is escaped and reopens them
+	std::string quoted = "'";
+	for (char c : Value) {
+		if (c == '\'') {
+			quoted += "'\\''";
+		} else {
+			quoted += c;
+		}
+	}
+	return quoted + "'";
+#endif
+}
+
+#if !defined(__linux__)
+// The directory is rescanned this often where there is no inotify
+constexpr auto PollInterval = std::chrono::milliseconds(200);
+#endif
+
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+	Stop();
+}
+
+bool ShaderWatcher::Start(const std::string& Directory, const std::string& CompileCommand)
+{
+	assert(!IsRunning());
+	m_directory = Directory;
+	m_compileCommand = CompileCommand;
+	m_quit = false;
+
+#if defined(__linux__)
+	m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	// Editors either rewrite the file in place or write a new one and rename it over the old
+	if (m_inotify < 0 || inotify_add_watch(m_inotify, Directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		fprintf(stderr, "Can't watch %s for shader changes\n", Directory.c_str());
+		if (m_inotify >= 0) {
+			close(m_inotify);
+			m_inotify = -1;
+		}
+		return false;
+	}
+#endif
+
+	m_thread = std::thread(&ShaderWatcher::WatchMain, this);
+	printf("Watching %s for shader changes\n", Directory.c_str());
+	return true;
+}
+
+void ShaderWatcher::Stop()
+{
+	if (!IsRunning()) {
+		return;
+	}
+	m_quit = true;
+	m_thread.join();
+#if defined(__linux__)
+	close(m_inotify);
+	m_inotify = -1;
+#endif
+}
+
+std::vector<ShaderWatcher::Change> ShaderWatcher::TakeChanges()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<Change> changes;
+	changes.swap(m_changes);
+	return changes;
+}
+
+void ShaderWatcher::WatchMain()
+{
+#if defined(__linux__)
+	alignas(inotify_event) char buffer[4096];
+	while (!m_quit) {
+		// Wakes up now and then to notice Stop()
+		pollfd descriptor = { m_inotify, POLLIN, 0 };
+		if (poll(&descriptor, 1, 100) <= 0) {
+			continue;
+		}
+		const ssize_t length = read(m_inotify, buffer, sizeof(buffer));
+		if (length <= 0) {
+			continue;
+		}
+		const uint64_t now_ns = getTimeInNanoseconds();
+		for (ssize_t offset = 0; offset < length;) {
+			const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			if (event->len > 0) {
+				OnFileChanged(event->name, now_ns);
+			}
+			offset += sizeof(inotify_event) + event->len;
+		}
+	}
+#else
+	namespace fs = std::filesystem;
+	std::unordered_map<std::string, fs::file_time_type> write_times;
+	bool first_scan = true;
+	while (!m_quit) {
+		std::error_code error;
+		for (const auto& entry : fs::directory_iterator(m_directory, error)) {
+			const std::string name = entry.path().filename().string();
+			const auto write_time = entry.last_write_time(error);
+			if (error) {
+				continue;
+			}
+			auto known = write_times.find(name);
+			if (known == write_times.end() || known->second != write_time) {
+				write_times[name] = write_time;
+				// The first scan only learns what is there
+				if (!first_scan) {
+					OnFileChanged(name, getTimeInNanoseconds());
+				}
+			}
+		}
+		first_scan = false;
+		std::this_thread::sleep_for(PollInterval);
+	}
+#endif
+}
+
+void ShaderWatcher::OnFileChanged(const std::string& Name, uint64_t DetectedNs)
+{
+	if (IsGlslSource(Name)) {
+		if (!m_compileCommand.empty() && CompileSource(Name)) {
+			// The output shows up as a change of its own, report it as early as the edit
+			m_compiling[Name + ".spv"] = DetectedNs;
+		}
+		return;
+	}
+	if (!EndsWith(Name, ".spv")) {
+		return;
+	}
+
+	auto source = m_compiling.find(Name);
+	if (source != m_compiling.end()) {
+		DetectedNs = source->second;
+		m_compiling.erase(source);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const auto& change : m_changes) {
+		if (change.file == Name) {
+			// Several events for one save
+			return;
+		}
+	}
+	m_changes.push_back({ Name, DetectedNs });
+}
+
+bool ShaderWatcher::CompileSource(const std::string& Name)
+{
+#if defined(_WIN32)
+	if ((m_directory + Name).find('%') != std::string::npos) {
+		fprintf(stderr, "Not compiling %s, cmd.exe would expand the %% in its path\n", Name.c_str());
+		return false;
+	}
+#endif
+	std::string command = m_compileCommand;
+	ReplaceAll(command, "{src}", QuoteArgument(m_directory + Name));
+	ReplaceAll(command, "{dst}", QuoteArgument(m_directory + Name + ".spv"));
+
+	const uint64_t start_ns = getTimeInNanoseconds();
+	const int status = std::system(command.c_str());
+	if (status != 0) {
+		// The compiler printed why, the pipelines keep the last good SPIR-V
+		fprintf(stderr, "Shader compile failed (%d): %s\n", status, command.c_str());
+		return false;
+	}
+	printf("Compiled %s in %.3f ms\n", Name.c_str(), static_cast<double>(getTimeInNanoseconds() - start_ns) / 1e6);
+	fflush(stdout);
+	return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Development aid: watches the shader directory on a thread of its own and reports SPIR-V files that changed on disk.
+// Edited GLSL sources are compiled with an external command first, their output is then reported like any other
+// change. Linux is notified through inotify, elsewhere the directory is polled.
+class ShaderWatcher
+{
+public:
+	struct Change {
+		// Name within the watched directory, as passed to ShaderLoader
+		std::string file;
+		// When the edit was noticed, the GLSL source's for compiled files, so latencies include the compile
+		uint64_t detected_ns = 0;
+	};
+
+	ShaderWatcher() = default;
+	~ShaderWatcher();
+
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	// CompileCommand has {src} and {dst} replaced by the source and output paths, empty ignores GLSL changes
+	bool Start(const std::string& Directory, const std::string& CompileCommand);
+	void Stop();
+	bool IsRunning() const { return m_thread.joinable(); }
+
+	// Main thread: every SPIR-V file changed since the last call, once each
+	std::vector<Change> TakeChanges();
+
+private:
+	void WatchMain();
+	void OnFileChanged(const std::string& Name, uint64_t DetectedNs);
+	bool CompileSource(const std::string& Name);
+
+	std::string m_directory;
+	std::string m_compileCommand;
+	std::thread m_thread;
+	std::atomic<bool> m_quit { false };
+#if defined(__linux__)
+	int m_inotify = -1;
+#endif
+
+	// Watch thread only: when each GLSL source being compiled changed, by output name
+	std::unordered_map<std::string, uint64_t> m_compiling;
+
+	std::mutex m_mutex;
+	std::vector<Change> m_changes;
+};
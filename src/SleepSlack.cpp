@@ -0,0 +1,21 @@
+#include "SleepSlack.h"
+#include "config.h"
+#include "gettime.h"
+
+#include <chrono>
+#include <thread>
+
+uint64_t SleepSlack::Sleep(uint64_t NowNs, uint64_t SleepNs)
+{
+	std::this_thread::sleep_for(std::chrono::nanoseconds(SleepNs));
+
+	const uint64_t woke_ns = getTimeInNanoseconds();
+	const uint64_t overshoot_ns = woke_ns - NowNs > SleepNs ? woke_ns - NowNs - SleepNs : 0;
+	const uint64_t wanted_slack_ns = overshoot_ns + SLEEP_SLACK_MIN_NS;
+	if (wanted_slack_ns > m_slackNs) {
+		m_slackNs = wanted_slack_ns;
+	} else {
+		m_slackNs = (m_slackNs * 15 + wanted_slack_ns) / 16;
+	}
+	return woke_ns;
+}
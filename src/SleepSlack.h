@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// How much earlier than its deadline a sleep has to end, the OS wakes threads late by a millisecond or more. Learned
+// from the sleeps so far, rising at once when a sleep overshoots more and decaying slowly when they get more precise.
+class SleepSlack
+{
+public:
+	explicit SleepSlack(uint64_t InitialNs) : m_slackNs(InitialNs) {}
+
+	// Margin to leave before a deadline
+	uint64_t Get() const { return m_slackNs; }
+	// Sleep for SleepNs starting at NowNs, learn from how late the wake was. Returns the time after waking.
+	uint64_t Sleep(uint64_t NowNs, uint64_t SleepNs);
+
+private:
+	uint64_t m_slackNs;
+};
@@ -1,5 +1,7 @@
 #include "TextureLoader.h"
 #include "scene.h"
+#include "MemoryTracker.h"
+#include "DeviceMemoryPool.h"
 
 // Library Defines
 #define STB_IMAGE_IMPLEMENTATION
@@ -93,10 +95,16 @@ texture_object TextureLoader::CreateTexture2DBlank(uint32_t TexWidth, uint32_t T
     texture_object TexObj;
     TexObj.tex_width = TexWidth;
     TexObj.tex_height = TexHeight;
+    TexObj.format = vk::Format::eR8G8B8A8Unorm;
+
+    // Optimal tiling images can be copied by the pool's defragmenter, linear ones stay where they are
+    if (Tiling == vk::ImageTiling::eOptimal) {
+        Usage |= vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    }
 
     auto const ImageCreateInfo = vk::ImageCreateInfo()
         .setImageType(vk::ImageType::e2D)
-        .setFormat(vk::Format::eR8G8B8A8Unorm)
+        .setFormat(TexObj.format)
         .setExtent({ TexObj.tex_width, TexObj.tex_height, 1 })
         .setMipLevels(1)
         .setArrayLayers(1)
@@ -118,11 +126,8 @@ texture_object TextureLoader::CreateTexture2DBlank(uint32_t TexWidth, uint32_t T
     auto pass = MemoryTypeFromProperties(mem_reqs.memoryTypeBits, RequiredProps, TexObj.mem_alloc.memoryTypeIndex);
     VERIFY(pass == true);
 
-    Result = GVulkanObjects.device.allocateMemory(&TexObj.mem_alloc, nullptr, &TexObj.mem);
-    VERIFY(Result == vk::Result::eSuccess);
-
-    Result = GVulkanObjects.device.bindImageMemory(TexObj.image, TexObj.mem, 0);
-    VERIFY(Result == vk::Result::eSuccess);
+    TexObj.allocation = DeviceMemoryPool::BindImage(TexObj.image, ImageCreateInfo, TexObj.mem_alloc.memoryTypeIndex, MemoryCategory::Texture, "texture image");
+    VERIFY(TexObj.allocation.IsValid());
 
     TexObj.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
 
@@ -148,12 +153,11 @@ void TextureLoader::CreateTexture2DEx(const std::string& FileName, texture_objec
     vk::SubresourceLayout layout;
     GVulkanObjects.device.getImageSubresourceLayout(TexObj.image, &subres, &layout);
 
-    auto data = GVulkanObjects.device.mapMemory(TexObj.mem, 0, TexObj.mem_alloc.allocationSize);
-    VERIFY(data.result == vk::Result::eSuccess);
+    // Host-visible pool blocks are persistently mapped
+    void* data = DeviceMemoryPool::GetMappedPointer(TexObj.allocation);
+    VERIFY(data != nullptr);
 
-    CopyTextureDataToMemory(*ID, data.value, TexObj, layout);
-
-    GVulkanObjects.device.unmapMemory(TexObj.mem);
+    CopyTextureDataToMemory(*ID, data, TexObj, layout);
 
     TexObj.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
 }
@@ -189,7 +193,7 @@ void TextureLoader::CreateBuffer2D(const std::string& FileName, texture_object&
     auto pass = MemoryTypeFromProperties(mem_reqs.memoryTypeBits, requirements, TexObj.mem_alloc.memoryTypeIndex);
     VERIFY(pass == true);
 
-    Result = GVulkanObjects.device.allocateMemory(&TexObj.mem_alloc, nullptr, &(TexObj.mem));
+    Result = MemoryTracker::Allocate(TexObj.mem_alloc, MemoryCategory::Staging, TexObj.mem, FileName.c_str());
     VERIFY(Result == vk::Result::eSuccess);
 
     Result = GVulkanObjects.device.bindBufferMemory(TexObj.buffer, TexObj.mem, 0);
@@ -239,6 +243,7 @@ void TextureLoader::CreateOptimalTexture2DFromBuffer(texture_object& source_text
     SetImageLayout(dest_texture.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eTransferDstOptimal,
         dest_texture.imageLayout, vk::AccessFlagBits::eTransferWrite, vk::PipelineStageFlagBits::eTransfer,
         vk::PipelineStageFlagBits::eFragmentShader);
+    DeviceMemoryPool::SetImageLayout(dest_texture.allocation, dest_texture.imageLayout);
 }
 
 void TextureLoader::SetImageLayout(vk::Image image, vk::ImageAspectFlags aspectMask, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags srcAccessMask, vk::PipelineStageFlags src_stages, vk::PipelineStageFlags dest_stages)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "DeviceMemoryPool.h"
 
 // WIP HERE: 
 //
@@ -15,11 +16,15 @@ struct texture_object {
     vk::Sampler sampler;
 
     vk::Image image;
+    // What image was created with, views must match it
+    vk::Format format { vk::Format::eUndefined };
     vk::Buffer buffer;
     vk::ImageLayout imageLayout { vk::ImageLayout::eUndefined };
 
     vk::MemoryAllocateInfo mem_alloc;
     vk::DeviceMemory mem;
+    // Set instead of mem when the image lives in DeviceMemoryPool, image then changes if the pool moves it
+    PoolHandle allocation;
     vk::ImageView view;
 
     uint32_t tex_width { 0 };
@@ -0,0 +1,172 @@
+#include "TransformBatch.h"
+#include "gettime.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_BATCH_SSE 1
+#include <emmintrin.h>
+#endif
+
+TransformBatch::TransformBatch() {}
+TransformBatch::~TransformBatch() {}
+
+#if defined(TRANSFORM_BATCH_SSE)
+namespace {
+
+inline __m128 Broadcast(__m128 Value, int Lane)
+{
+	switch (Lane) {
+	case 0:
+		return _mm_shuffle_ps(Value, Value, _MM_SHUFFLE(0, 0, 0, 0));
+	case 1:
+		return _mm_shuffle_ps(Value, Value, _MM_SHUFFLE(1, 1, 1, 1));
+	case 2:
+		return _mm_shuffle_ps(Value, Value, _MM_SHUFFLE(2, 2, 2, 2));
+	default:
+		return _mm_shuffle_ps(Value, Value, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+}
+
+// Column of A times the vector B
+inline __m128 Transform(const __m128 A[4], __m128 B)
+{
+	__m128 result = _mm_mul_ps(A[0], Broadcast(B, 0));
+	result = _mm_add_ps(result, _mm_mul_ps(A[1], Broadcast(B, 1)));
+	result = _mm_add_ps(result, _mm_mul_ps(A[2], Broadcast(B, 2)));
+	return _mm_add_ps(result, _mm_mul_ps(A[3], Broadcast(B, 3)));
+}
+
+// xyz cross product, w comes out 0
+inline __m128 Cross(__m128 A, __m128 B)
+{
+	const __m128 a_yzx = _mm_shuffle_ps(A, A, _MM_SHUFFLE(3, 0, 2, 1));
+	const __m128 b_yzx = _mm_shuffle_ps(B, B, _MM_SHUFFLE(3, 0, 2, 1));
+	const __m128 c = _mm_sub_ps(_mm_mul_ps(A, b_yzx), _mm_mul_ps(a_yzx, B));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// xyz dot product in every lane
+inline __m128 Dot3(__m128 A, __m128 B)
+{
+	const __m128 product = _mm_mul_ps(A, B);
+	return _mm_add_ps(_mm_add_ps(Broadcast(product, 0), Broadcast(product, 1)), Broadcast(product, 2));
+}
+
+}
+#endif
+
+void TransformBatch::ComputeObjectConstants(const glm::mat4& ViewProj, const glm::mat4& Shared, const glm::mat4* Objects, size_t Count,
+	ObjectConstants* Out)
+{
+#if defined(TRANSFORM_BATCH_SSE)
+	// Loaded once for the whole batch, glm matrices are four contiguous columns
+	__m128 view_proj[4];
+	__m128 shared[4];
+	for (int column = 0; column < 4; column++) {
+		view_proj[column] = _mm_loadu_ps(&ViewProj[column][0]);
+		shared[column] = _mm_loadu_ps(&Shared[column][0]);
+	}
+
+	for (size_t i = 0; i < Count; i++) {
+		__m128 object[4];
+		for (int column = 0; column < 4; column++) {
+			object[column] = _mm_loadu_ps(&Objects[i][column][0]);
+		}
+
+		__m128 model[4];
+		for (int column = 0; column < 4; column++) {
+			model[column] = Transform(object, shared[column]);
+			_mm_storeu_ps(&Out[i].mvp[column][0], Transform(view_proj, model[column]));
+		}
+
+		// The inverse transpose of a 3x3 matrix is its cofactor matrix over the determinant, and the cofactor
+		// columns are cross products of the other two columns
+		const __m128 c0 = Cross(model[1], model[2]);
+		const __m128 c1 = Cross(model[2], model[0]);
+		const __m128 c2 = Cross(model[0], model[1]);
+		const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), Dot3(model[0], c0));
+		_mm_storeu_ps(&Out[i].normal[0][0], _mm_mul_ps(c0, inv_det));
+		_mm_storeu_ps(&Out[i].normal[1][0], _mm_mul_ps(c1, inv_det));
+		_mm_storeu_ps(&Out[i].normal[2][0], _mm_mul_ps(c2, inv_det));
+	}
+#else
+	ComputeObjectConstantsScalar(ViewProj, Shared, Objects, Count, Out);
+#endif
+}
+
+void TransformBatch::ComputeObjectConstantsScalar(const glm::mat4& ViewProj, const glm::mat4& Shared, const glm::mat4* Objects,
+	size_t Count, ObjectConstants* Out)
+{
+	for (size_t i = 0; i < Count; i++) {
+		const glm::mat4 model = Objects[i] * Shared;
+		Out[i].mvp = ViewProj * model;
+		const glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(model)));
+		for (int column = 0; column < 3; column++) {
+			Out[i].normal[column] = glm::vec4(normal[column], 0.0f);
+		}
+	}
+}
+
+void TransformBatch::Benchmark(uint32_t Count, uint32_t Iterations)
+{
+	// Fixed seed, every run checks the same transforms
+	uint32_t seed = 12345;
+	auto random = [&seed](float Min, float Max) {
+		seed = seed * 1664525u + 1013904223u;
+		return Min + (Max - Min) * static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+	};
+
+	std::vector<glm::mat4> objects(Count);
+	for (auto& object : objects) {
+		const glm::vec3 axis = glm::normalize(glm::vec3(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(0.1f, 1.0f)));
+		object = glm::translate(glm::mat4(1.0f), glm::vec3(random(-50.0f, 50.0f), random(-50.0f, 50.0f), random(-50.0f, 50.0f)));
+		object = glm::rotate(object, random(-3.14f, 3.14f), axis);
+		object = glm::scale(object, glm::vec3(random(0.1f, 4.0f), random(0.1f, 4.0f), random(0.1f, 4.0f)));
+	}
+	const glm::mat4 shared = glm::rotate(glm::mat4(1.0f), 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+	const glm::mat4 view_proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+		glm::lookAt(glm::vec3(0.0f, 3.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	std::vector<ObjectConstants> batch(Count);
+	std::vector<ObjectConstants> scalar(Count);
+	ComputeObjectConstants(view_proj, shared, objects.data(), Count, batch.data());
+	ComputeObjectConstantsScalar(view_proj, shared, objects.data(), Count, scalar.data());
+
+	// Relative to each object's largest value, the matrices' scales differ by orders of magnitude
+	auto max_difference = [](const float* A, const float* B, size_t Floats) {
+		float magnitude = 1e-30f;
+		float difference = 0.0f;
+		for (size_t i = 0; i < Floats; i++) {
+			magnitude = fabsf(B[i]) > magnitude ? fabsf(B[i]) : magnitude;
+			difference = fabsf(A[i] - B[i]) > difference ? fabsf(A[i] - B[i]) : difference;
+		}
+		return difference / magnitude;
+	};
+	float mvp_error = 0.0f;
+	float normal_error = 0.0f;
+	for (uint32_t i = 0; i < Count; i++) {
+		const float mvp = max_difference(&batch[i].mvp[0][0], &scalar[i].mvp[0][0], 16);
+		const float normal = max_difference(&batch[i].normal[0][0], &scalar[i].normal[0][0], 12);
+		mvp_error = mvp > mvp_error ? mvp : mvp_error;
+		normal_error = normal > normal_error ? normal : normal_error;
+	}
+
+	const uint64_t batch_start_ns = getTimeInNanoseconds();
+	for (uint32_t i = 0; i < Iterations; i++) {
+		ComputeObjectConstants(view_proj, shared, objects.data(), Count, batch.data());
+	}
+	const uint64_t batch_ns = getTimeInNanoseconds() - batch_start_ns;
+	const uint64_t scalar_start_ns = getTimeInNanoseconds();
+	for (uint32_t i = 0; i < Iterations; i++) {
+		ComputeObjectConstantsScalar(view_proj, shared, objects.data(), Count, scalar.data());
+	}
+	const uint64_t scalar_ns = getTimeInNanoseconds() - scalar_start_ns;
+
+	// Reading a result keeps either loop from being optimized away
+	volatile float sink = batch[Count - 1].mvp[0][0] + scalar[Count - 1].mvp[0][0];
+	(void)sink;
+	const double batch_ms = static_cast<double>(batch_ns) / 1e6 / Iterations;
+	const double scalar_ms = static_cast<double>(scalar_ns) / 1e6 / Iterations;
+	printf("Object constants: %u objects, batch %.3f ms, scalar %.3f ms (%.1fx), largest relative difference mvp %g, normal %g\n", Count,
+		batch_ms, scalar_ms, batch_ms > 0.0 ? scalar_ms / batch_ms : 0.0, mvp_error, normal_error);
+	fflush(stdout);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+
+// What the vertex shaders read per object, laid out like the std430 ObjectConstants struct in the shaders
+struct ObjectConstants {
+	glm::mat4 mvp;
+	// Inverse transpose of the model matrix's upper 3x3, columns padded to vec4 like a std430 mat3
+	glm::vec4 normal[3];
+};
+static_assert(sizeof(ObjectConstants) == 112, "ObjectConstants must match the std430 layout in the shaders");
+
+// Per-object constants for whole batches of objects at once, so the vertex shaders get a final MVP and normal matrix
+// instead of multiplying several matrices (or inverting one) for every vertex. Uses SSE where available.
+class TransformBatch
+{
+public:
+	// Out[i] for the model matrix Objects[i] * Shared, seen through ViewProj
+	static void ComputeObjectConstants(const glm::mat4& ViewProj, const glm::mat4& Shared, const glm::mat4* Objects, size_t Count,
+		ObjectConstants* Out);
+
+	// The plain glm version, the reference the SIMD path is checked against
+	static void ComputeObjectConstantsScalar(const glm::mat4& ViewProj, const glm::mat4& Shared, const glm::mat4* Objects,
+		size_t Count, ObjectConstants* Out);
+
+	// Run both versions over Count pseudo-random transforms, print the largest difference between them relative to
+	// the values' magnitude and the time per batch of each
+	static void Benchmark(uint32_t Count, uint32_t Iterations);
+
+private:
+	TransformBatch();
+	~TransformBatch();
+};
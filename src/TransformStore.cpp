@@ -0,0 +1,276 @@
+#include "TransformStore.h"
+#include "gettime.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_STORE_SSE 1
+#include <emmintrin.h>
+#endif
+
+uint32_t TransformStore::Add(const glm::vec3& Position, const glm::quat& Rotation, const glm::vec3& Scale)
+{
+	const uint32_t index = m_count++;
+	if (index % GroupSize == 0) {
+		// Start a new group of identity entries, so the batch never reads past the arrays
+		const size_t size = m_positionX.size() + GroupSize;
+		m_positionX.resize(size, 0.0f);
+		m_positionY.resize(size, 0.0f);
+		m_positionZ.resize(size, 0.0f);
+		m_rotationX.resize(size, 0.0f);
+		m_rotationY.resize(size, 0.0f);
+		m_rotationZ.resize(size, 0.0f);
+		m_rotationW.resize(size, 1.0f);
+		m_scaleX.resize(size, 1.0f);
+		m_scaleY.resize(size, 1.0f);
+		m_scaleZ.resize(size, 1.0f);
+		m_world.resize(size, glm::mat4(1.0f));
+		m_dirty.resize((size + 63) / 64, 0);
+		m_updated.resize(m_dirty.size(), 0);
+	}
+
+	SetPosition(index, Position);
+	SetRotation(index, Rotation);
+	SetScale(index, Scale);
+	return index;
+}
+
+void TransformStore::Clear()
+{
+	m_count = 0;
+	m_positionX.clear();
+	m_positionY.clear();
+	m_positionZ.clear();
+	m_rotationX.clear();
+	m_rotationY.clear();
+	m_rotationZ.clear();
+	m_rotationW.clear();
+	m_scaleX.clear();
+	m_scaleY.clear();
+	m_scaleZ.clear();
+	m_world.clear();
+	m_dirty.clear();
+	m_updated.clear();
+	m_dirtyCount = 0;
+}
+
+void TransformStore::MarkDirty(uint32_t Index)
+{
+	assert(Index < m_count);
+	uint64_t& word = m_dirty[Index / 64];
+	const uint64_t bit = 1ull << (Index % 64);
+	if ((word & bit) == 0) {
+		word |= bit;
+		m_dirtyCount++;
+	}
+}
+
+void TransformStore::SetPosition(uint32_t Index, const glm::vec3& Position)
+{
+	m_positionX[Index] = Position.x;
+	m_positionY[Index] = Position.y;
+	m_positionZ[Index] = Position.z;
+	MarkDirty(Index);
+}
+
+void TransformStore::SetRotation(uint32_t Index, const glm::quat& Rotation)
+{
+	const glm::quat rotation = glm::normalize(Rotation);
+	m_rotationX[Index] = rotation.x;
+	m_rotationY[Index] = rotation.y;
+	m_rotationZ[Index] = rotation.z;
+	m_rotationW[Index] = rotation.w;
+	MarkDirty(Index);
+}
+
+void TransformStore::SetScale(uint32_t Index, const glm::vec3& Scale)
+{
+	m_scaleX[Index] = Scale.x;
+	m_scaleY[Index] = Scale.y;
+	m_scaleZ[Index] = Scale.z;
+	MarkDirty(Index);
+}
+
+glm::vec3 TransformStore::GetPosition(uint32_t Index) const
+{
+	return glm::vec3(m_positionX[Index], m_positionY[Index], m_positionZ[Index]);
+}
+
+glm::quat TransformStore::GetRotation(uint32_t Index) const
+{
+	return glm::quat(m_rotationW[Index], m_rotationX[Index], m_rotationY[Index], m_rotationZ[Index]);
+}
+
+glm::vec3 TransformStore::GetScale(uint32_t Index) const
+{
+	return glm::vec3(m_scaleX[Index], m_scaleY[Index], m_scaleZ[Index]);
+}
+
+uint32_t TransformStore::Update()
+{
+	const uint32_t changed = m_dirtyCount;
+	for (size_t word_index = 0; changed > 0 && word_index < m_dirty.size(); word_index++) {
+		const uint64_t word = m_dirty[word_index];
+		if (word == 0) {
+			continue;
+		}
+		// Recompose whole groups, a clean entry next to a dirty one comes out the same as before
+		for (uint32_t group = 0; group < 64; group += GroupSize) {
+			if ((word >> group) & ((1ull << GroupSize) - 1)) {
+				ComposeGroup(static_cast<uint32_t>(word_index * 64) + group);
+			}
+		}
+	}
+	// This update's dirty bits become WasUpdated(), the last update's are cleared for the next
+	m_dirty.swap(m_updated);
+	std::fill(m_dirty.begin(), m_dirty.end(), 0);
+	m_dirtyCount = 0;
+	return changed;
+}
+
+void TransformStore::ComposeGroup(uint32_t First)
+{
+#if defined(TRANSFORM_STORE_SSE)
+	// Each lane is one entry, the rotation matrix of all four is built at once
+	const __m128 x = _mm_loadu_ps(&m_rotationX[First]);
+	const __m128 y = _mm_loadu_ps(&m_rotationY[First]);
+	const __m128 z = _mm_loadu_ps(&m_rotationZ[First]);
+	const __m128 w = _mm_loadu_ps(&m_rotationW[First]);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	const __m128 xx = _mm_mul_ps(x, x);
+	const __m128 yy = _mm_mul_ps(y, y);
+	const __m128 zz = _mm_mul_ps(z, z);
+	const __m128 xy = _mm_mul_ps(x, y);
+	const __m128 xz = _mm_mul_ps(x, z);
+	const __m128 yz = _mm_mul_ps(y, z);
+	const __m128 wx = _mm_mul_ps(w, x);
+	const __m128 wy = _mm_mul_ps(w, y);
+	const __m128 wz = _mm_mul_ps(w, z);
+
+	// Rows of each column, scaled by that axis' scale. Same terms as glm::mat4_cast().
+	const __m128 scale_x = _mm_loadu_ps(&m_scaleX[First]);
+	const __m128 scale_y = _mm_loadu_ps(&m_scaleY[First]);
+	const __m128 scale_z = _mm_loadu_ps(&m_scaleZ[First]);
+	__m128 columns[4][4];
+	columns[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scale_x);
+	columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scale_x);
+	columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scale_x);
+	columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scale_y);
+	columns[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scale_y);
+	columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scale_y);
+	columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scale_z);
+	columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scale_z);
+	columns[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scale_z);
+	columns[3][0] = _mm_loadu_ps(&m_positionX[First]);
+	columns[3][1] = _mm_loadu_ps(&m_positionY[First]);
+	columns[3][2] = _mm_loadu_ps(&m_positionZ[First]);
+	for (int column = 0; column < 3; column++) {
+		columns[column][3] = _mm_setzero_ps();
+	}
+	columns[3][3] = one;
+
+	// Transposing a column's four rows turns it from one row per register into one entry per register
+	for (int column = 0; column < 4; column++) {
+		_MM_TRANSPOSE4_PS(columns[column][0], columns[column][1], columns[column][2], columns[column][3]);
+		for (uint32_t lane = 0; lane < GroupSize; lane++) {
+			_mm_storeu_ps(&m_world[First + lane][column][0], columns[column][lane]);
+		}
+	}
+#else
+	for (uint32_t i = First; i < First + GroupSize; i++) {
+		m_world[i] = Compose(GetPosition(i), GetRotation(i), GetScale(i));
+	}
+#endif
+}
+
+glm::mat4 TransformStore::Compose(const glm::vec3& Position, const glm::quat& Rotation, const glm::vec3& Scale)
+{
+	glm::mat4 world = glm::mat4_cast(Rotation);
+	world[0] *= Scale.x;
+	world[1] *= Scale.y;
+	world[2] *= Scale.z;
+	world[3] = glm::vec4(Position, 1.0f);
+	return world;
+}
+
+namespace {
+
+// What every object did on its own before: position and Euler angles turned into a matrix whenever they change
+glm::mat4 ComposeEuler(const glm::vec3& Position, const glm::vec3& Degrees, const glm::vec3& Scale)
+{
+	const glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(Degrees.y), glm::vec3(0, 1, 0)) *
+		glm::rotate(glm::mat4(1.0f), glm::radians(Degrees.x), glm::vec3(1, 0, 0)) *
+		glm::rotate(glm::mat4(1.0f), glm::radians(Degrees.z), glm::vec3(0, 0, 1));
+	return glm::translate(glm::mat4(1.0f), Position) * rotation * glm::scale(glm::mat4(1.0f), Scale);
+}
+
+struct EulerObject {
+	glm::vec3 position;
+	glm::vec3 rotation;
+	glm::vec3 scale;
+	glm::mat4 model;
+};
+
+}
+
+void TransformStore::Benchmark(uint32_t Count, uint32_t Frames)
+{
+	TransformStore store;
+	std::vector<EulerObject> objects(Count);
+	for (uint32_t i = 0; i < Count; i++) {
+		const glm::vec3 position(static_cast<float>(i % 317), static_cast<float>(i % 13), static_cast<float>(i / 317));
+		const glm::vec3 degrees(static_cast<float>(i % 360), static_cast<float>((i * 7) % 360), static_cast<float>((i * 13) % 360));
+		const glm::vec3 scale(1.0f + static_cast<float>(i % 5) * 0.25f);
+		store.Add(position, glm::quat(glm::radians(degrees)), scale);
+		objects[i] = { position, degrees, scale, ComposeEuler(position, degrees, scale) };
+	}
+	store.Update();
+
+	// Both paths produce the same matrices
+	float max_error = 0.0f;
+	for (uint32_t i = 0; i < Count; i++) {
+		const glm::mat4 reference = Compose(store.GetPosition(i), store.GetRotation(i), store.GetScale(i));
+		for (int column = 0; column < 4; column++) {
+			for (int row = 0; row < 4; row++) {
+				const float error = fabsf(store.GetWorldMatrix(i)[column][row] - reference[column][row]);
+				max_error = error > max_error ? error : max_error;
+			}
+		}
+	}
+
+	printf("Transform benchmark: %u objects, %u frames, batch matches glm within %g\n", Count, Frames, max_error);
+	for (uint32_t stride : { 1u, 10u }) {
+		// Every frame spins every stride-th object about Y, the store by quaternion and the objects by Euler angle
+		const glm::quat step = glm::angleAxis(glm::radians(1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		const uint64_t object_start_ns = getTimeInNanoseconds();
+		for (uint32_t frame = 0; frame < Frames; frame++) {
+			for (uint32_t i = frame % stride; i < Count; i += stride) {
+				auto& object = objects[i];
+				object.rotation.y += 1.0f;
+				object.model = ComposeEuler(object.position, object.rotation, object.scale);
+			}
+		}
+		const uint64_t object_ns = getTimeInNanoseconds() - object_start_ns;
+
+		const uint64_t store_start_ns = getTimeInNanoseconds();
+		for (uint32_t frame = 0; frame < Frames; frame++) {
+			for (uint32_t i = frame % stride; i < Count; i += stride) {
+				store.SetRotation(i, step * store.GetRotation(i));
+			}
+			store.Update();
+		}
+		const uint64_t store_ns = getTimeInNanoseconds() - store_start_ns;
+
+		// Reading a result keeps either loop from being optimized away
+		volatile float sink = objects[Count - 1].model[0][0] + store.GetWorldMatrix(Count - 1)[0][0];
+		(void)sink;
+		const double object_ms = static_cast<double>(object_ns) / 1e6 / Frames;
+		const double store_ms = static_cast<double>(store_ns) / 1e6 / Frames;
+		printf("  1 in %-2u objects moving: per-object matrices %8.3f ms per frame, transform store %8.3f ms per frame (%.1fx)\n", stride,
+			object_ms, store_ms, store_ms > 0.0 ? object_ms / store_ms : 0.0);
+	}
+	fflush(stdout);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+
+#include <gtc/quaternion.hpp>
+
+// Position, rotation and scale of many objects in structure-of-arrays layout, one array per component, with a dirty
+// bit per entry. Setters only store the value and mark the entry, Update() then recomposes the world matrices of every
+// changed entry in one batch pass, four entries at a time with SSE where available.
+class TransformStore
+{
+public:
+	// Append an entry, dirty until the next Update(). Returns its index.
+	uint32_t Add(const glm::vec3& Position, const glm::quat& Rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& Scale = glm::vec3(1.0f));
+	void Clear();
+	uint32_t GetCount() const { return m_count; }
+
+	void SetPosition(uint32_t Index, const glm::vec3& Position);
+	// Normalized on the way in, the batch assumes unit quaternions
+	void SetRotation(uint32_t Index, const glm::quat& Rotation);
+	void SetScale(uint32_t Index, const glm::vec3& Scale);
+	glm::vec3 GetPosition(uint32_t Index) const;
+	glm::quat GetRotation(uint32_t Index) const;
+	glm::vec3 GetScale(uint32_t Index) const;
+
+	// Recompose the world matrix of every entry changed since the last call. Returns how many changed.
+	uint32_t Update();
+	// Whether Index was one of them
+	bool WasUpdated(uint32_t Index) const { return ((m_updated[Index / 64] >> (Index % 64)) & 1) != 0; }
+	// GetCount() world matrices, current as of the last Update()
+	const glm::mat4* GetWorldMatrices() const { return m_world.data(); }
+	const glm::mat4& GetWorldMatrix(uint32_t Index) const { return m_world[Index]; }
+
+	// Translation * rotation * scale the way glm builds it, the reference the batch is checked against
+	static glm::mat4 Compose(const glm::vec3& Position, const glm::quat& Rotation, const glm::vec3& Scale);
+
+	// Move Count objects every frame for Frames frames through a store and through per-object matrices built with
+	// glm, all of them and a tenth of them, and print the time per frame of each
+	static void Benchmark(uint32_t Count, uint32_t Frames);
+
+private:
+	// Entries are composed in groups of this many, the arrays are padded with identity entries to a multiple of it
+	static constexpr uint32_t GroupSize = 4;
+
+	void MarkDirty(uint32_t Index);
+	// The GroupSize entries starting at First
+	void ComposeGroup(uint32_t First);
+
+	uint32_t m_count = 0;
+	std::vector<float> m_positionX;
+	std::vector<float> m_positionY;
+	std::vector<float> m_positionZ;
+	std::vector<float> m_rotationX;
+	std::vector<float> m_rotationY;
+	std::vector<float> m_rotationZ;
+	std::vector<float> m_rotationW;
+	std::vector<float> m_scaleX;
+	std::vector<float> m_scaleY;
+	std::vector<float> m_scaleZ;
+	std::vector<glm::mat4> m_world;
+
+	// One bit per entry, 64 entries per word. Swapped at the end of Update().
+	std::vector<uint64_t> m_dirty;
+	std::vector<uint64_t> m_updated;
+	uint32_t m_dirtyCount = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer, single consumer exchange of the latest value. The producer fills the back buffer and
+// publishes it, the consumer picks up whatever was published last. Neither side ever waits for the other, values the
+// consumer is too slow to see are skipped.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Not thread safe, call before either side starts
+	void Reset(const T& Value)
+	{
+		m_buffers.fill(Value);
+		m_front = 0;
+		m_middle.store(1, std::memory_order_relaxed);
+		m_back = 2;
+	}
+
+	// Producer: the buffer to fill, it holds whatever was published three rounds ago
+	T& GetBack() { return m_buffers[m_back]; }
+	void Publish()
+	{
+		// Hand the back buffer over and take the middle one in exchange
+		const uint32_t previous = m_middle.exchange(m_back | FreshBit, std::memory_order_acq_rel);
+		m_back = previous & IndexMask;
+	}
+
+	// Consumer: make the latest published value the front buffer, returns false and keeps the current front if
+	// nothing was published since the last call
+	bool Acquire()
+	{
+		if ((m_middle.load(std::memory_order_relaxed) & FreshBit) == 0) {
+			return false;
+		}
+		const uint32_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+		m_front = previous & IndexMask;
+		return true;
+	}
+	const T& GetFront() const { return m_buffers[m_front]; }
+
+private:
+	static constexpr uint32_t IndexMask = 3;
+	static constexpr uint32_t FreshBit = 4;
+
+	std::array<T, 3> m_buffers;
+	// Each index is owned by exactly one side, only the middle one is shared
+	uint32_t m_front = 0;
+	std::atomic<uint32_t> m_middle { 1 };
+	uint32_t m_back = 2;
+};
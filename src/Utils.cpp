@@ -48,61 +48,6 @@ uint32_t Utils::findMemoryType(const vk::PhysicalDevice& physicalDevice, uint32_
     throw std::runtime_error("failed to find suitable memory type!");
 }
 
-void Utils::createBuffer(const vk::Device& device, const vk::PhysicalDevice& physicalDevice, vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buffer, vk::DeviceMemory& bufferMemory) {
-    vk::BufferCreateInfo bufferInfo({}, size, usage, vk::SharingMode::eExclusive);
-
-    if (device.createBuffer(&bufferInfo, nullptr, &buffer) != vk::Result::eSuccess) {
-        throw std::runtime_error("failed to create buffer!");
-    }
-
-    vk::MemoryRequirements memRequirements;
-    device.getBufferMemoryRequirements(buffer, &memRequirements);
-
-    vk::MemoryAllocateInfo allocInfo(memRequirements.size, findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties));
-
-    if (device.allocateMemory(&allocInfo, nullptr, &bufferMemory) != vk::Result::eSuccess) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-
-    device.bindBufferMemory(buffer, bufferMemory, 0);
-}
-
-void Utils::copyBuffer(const vk::Device& device, const vk::Queue& queue, const vk::Buffer& srcBuffer, vk::Buffer& dstBuffer, vk::DeviceSize size) {
-    vk::CommandBuffer commandBuffer = beginSingleTimeCommands(device, queue);
-
-    vk::BufferCopy copyRegion(0, 0, size);
-    commandBuffer.copyBuffer(srcBuffer, dstBuffer, 1, &copyRegion);
-
-    endSingleTimeCommands(device, queue, commandBuffer);
-}
-
-vk::CommandBuffer Utils::beginSingleTimeCommands(const vk::Device& device, const vk::Queue& queue) {
-    vk::CommandBuffer commandBuffer;
-
-    vk::CommandBufferAllocateInfo allocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
-
-    device.allocateCommandBuffers(&allocInfo, &commandBuffer);
-
-    vk::CommandBufferBeginInfo beginInfo;
-    commandBuffer.begin(&beginInfo);
-
-    return commandBuffer;
-}
-
-void Utils::endSingleTimeCommands(const vk::Device& device, const vk::Queue& queue, vk::CommandBuffer commandBuffer) {
-    commandBuffer.end();
-
-    vk::SubmitInfo submitInfo;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    queue.submit(1, &submitInfo, vk::Fence());
-
-    queue.waitIdle();
-
-    vkFreeCommandBuffers(device, commandPool, 1, reinterpret_cast<VkCommandBuffer*>(&commandBuffer));
-}
-
 float Utils::getVectorLength(const vec2& vector) {
     return sqrt((vector.x * vector.x) + (vector.y * vector.y));
 }
@@ -127,5 +72,3 @@ vec2 Utils::cubicLerp(vec2 point1, vec2 point2, vec2 point3, vec2 point4, float
     vec2 vecB = quadLerp(point2, point3, point4, alpha);
     return lerp(vecA, vecB, alpha);
 }
-
-vk::CommandPool Utils::commandPool;
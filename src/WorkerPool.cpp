@@ -0,0 +1,71 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(uint32_t ThreadCount)
+	: m_threadCount(ThreadCount > 0 ? ThreadCount : 1)
+{
+	for (uint32_t i = 1; i < m_threadCount; i++) {
+		m_threads.emplace_back(&WorkerPool::WorkerMain, this, i);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> Lock(m_mutex);
+		m_quit = true;
+	}
+	m_jobReady.notify_all();
+	for (auto& thread : m_threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::Run(const std::function<void(uint32_t)>& Job)
+{
+	if (m_threads.empty()) {
+		Job(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> Lock(m_mutex);
+		m_job = &Job;
+		m_pendingWorkers = static_cast<uint32_t>(m_threads.size());
+		m_jobGeneration++;
+	}
+	m_jobReady.notify_all();
+
+	Job(0);
+
+	std::unique_lock<std::mutex> Lock(m_mutex);
+	m_jobDone.wait(Lock, [this] { return m_pendingWorkers == 0; });
+	m_job = nullptr;
+}
+
+void WorkerPool::WorkerMain(uint32_t ThreadIndex)
+{
+	uint64_t last_generation = 0;
+	for (;;) {
+		const std::function<void(uint32_t)>* job = nullptr;
+		{
+			std::unique_lock<std::mutex> Lock(m_mutex);
+			m_jobReady.wait(Lock, [&] { return m_quit || m_jobGeneration != last_generation; });
+			if (m_quit) {
+				return;
+			}
+			last_generation = m_jobGeneration;
+			job = m_job;
+		}
+
+		(*job)(ThreadIndex);
+
+		bool last = false;
+		{
+			std::lock_guard<std::mutex> Lock(m_mutex);
+			last = --m_pendingWorkers == 0;
+		}
+		if (last) {
+			m_jobDone.notify_one();
+		}
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool of persistent threads. Run() hands the same job to every thread, each gets its own index,
+// and returns when all of them are done. The calling thread takes index 0 so a pool of N uses N-1 extra threads.
+class WorkerPool
+{
+public:
+	explicit WorkerPool(uint32_t ThreadCount);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	uint32_t GetThreadCount() const { return m_threadCount; }
+
+	void Run(const std::function<void(uint32_t)>& Job);
+
+private:
+	void WorkerMain(uint32_t ThreadIndex);
+
+	uint32_t m_threadCount = 1;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_jobReady;
+	std::condition_variable m_jobDone;
+	const std::function<void(uint32_t)>* m_job = nullptr;
+	// Bumped for every Run() so workers can tell a new job from the one they already ran
+	uint64_t m_jobGeneration = 0;
+	uint32_t m_pendingWorkers = 0;
+	bool m_quit = false;
+};
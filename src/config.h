@@ -9,12 +9,50 @@ constexpr bool ENABLE_VULKAN_VALIDATION = false;
 constexpr char APP_SHORT_NAME [] = "mds-vkcubepp";
 constexpr char PATH_TEXTURES [] = "resources/";
 constexpr char PATH_SHADERS [] = "shaders/";
+constexpr char PATH_MODELS [] = "resources/Models/";
+
+// The pipeline cache is saved here at shutdown and seeds the next run
+constexpr char PIPELINE_CACHE_FILE [] = "pipeline_cache.bin";
+
+// --hot_reload compiles edited GLSL in PATH_SHADERS with this, {src} and {dst} become the source and SPIR-V paths,
+// quoted for the shell
+constexpr char SHADER_COMPILE_COMMAND [] = "glslc {src} -o {dst}";
+
+// Background threads compiling pipelines (--sync_pipelines compiles on the main thread instead)
+constexpr uint32_t PIPELINE_COMPILE_THREADS = 2;
+
+// Device memory watermarks are written here when the scene is cleaned up
+constexpr char MEMORY_REPORT_FILE [] = "memory_report.json";
+
+// Static buffers and textures are sub-allocated from blocks of this size, larger resources get a block of their own
+constexpr uint64_t POOL_BLOCK_SIZE = 16ull * 1024 * 1024;
+// Blocks less full than this are emptied by the defragmenter
+constexpr float DEFRAG_SPARSE_OCCUPANCY = 0.5f;
+// Bytes the defragmenter may copy per frame
+constexpr uint64_t DEFRAG_BYTES_PER_FRAME = 4ull * 1024 * 1024;
+
+// Simulation rate, independent of the frame rate (--sim_hz). Rendering interpolates between the last two steps.
+constexpr uint32_t DEFAULT_SIM_HZ = 60;
+// A frame that falls further behind than this many steps drops the rest instead of trying to catch up
+constexpr uint32_t MAX_SIM_STEPS_PER_FRAME = 8;
+
+// Longest single wait for a swapchain image before the acquire is retried
+constexpr uint64_t ACQUIRE_TIMEOUT_NS = 100000000;
+// Timeouts in a row after which a stalled acquire is reported, and again every as many after that
+constexpr uint32_t ACQUIRE_TIMEOUT_REPORT = 20;
+// Rate the main loop drops to while the scene is paused or the window is minimized
+constexpr double IDLE_FPS = 10.0;
+// Least margin the frame pacer and the frame limiter leave before a deadline when sleeping, on top of the oversleep
+// they have measured so far
+constexpr uint64_t SLEEP_SLACK_MIN_NS = 250000;
 
 constexpr uint32_t WINDOW_WIDTH = 1280;
 constexpr uint32_t WINDOW_HEIGHT = 720;
 
-// Allow a maximum of two outstanding presentation operations.
-constexpr uint32_t FRAME_LAG = 2;
+// Defaults for the number of frames the CPU may run ahead of the GPU, and the number of swapchain images
+// requested. Both can be overridden on the command line (--frame_lag, --swapchain_images).
+constexpr uint32_t DEFAULT_FRAME_LAG = 2;
+constexpr uint32_t DEFAULT_SWAPCHAIN_IMAGES = 3;
 
 constexpr char const* tex_files[] = {"vulkan.png"};
 
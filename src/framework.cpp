@@ -1,4 +1,7 @@
 #include "framework.h"
+#include "gettime.h"
+
+#include <algorithm>
 
 // Store a global instance for use in the window proc call
 DemoFramework* DemoFramework::instance = nullptr;
@@ -13,7 +16,7 @@ DemoFramework::DemoFramework(int argc, char* argv[], std::unique_ptr<Scene> _sce
         }
         if (strcmp(argv[i], "--width") == 0) {
             int32_t in_width = 0;
-            if (i < argc - 1 && (in_width = std::stoi(argv[i + 1])) == 1) {
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_width) == 1) {
                 if (in_width > 0) {
                     width = static_cast<uint32_t>(in_width);
                     i++;
@@ -26,7 +29,7 @@ DemoFramework::DemoFramework(int argc, char* argv[], std::unique_ptr<Scene> _sce
         }
         if (strcmp(argv[i], "--height") == 0) {
             int32_t in_height = 0;
-            if (i < argc - 1 && (in_height = std::stoi(argv[i + 1])) == 1) {
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_height) == 1) {
                 if (in_height > 0) {
                     height = static_cast<uint32_t>(in_height);
                     i++;
@@ -41,10 +44,227 @@ DemoFramework::DemoFramework(int argc, char* argv[], std::unique_ptr<Scene> _sce
             force_errors = true;
             continue;
         }
+        if (strcmp(argv[i], "--bench_geometry") == 0) {
+            // Only needs the device, render offscreen instead of opening a window
+            bench_geometry = true;
+            headless = true;
+            scene->set_headless(true);
+            continue;
+        }
+        if (strcmp(argv[i], "--record_once") == 0) {
+            scene->set_record_once(true);
+            continue;
+        }
+        if (strcmp(argv[i], "--objects") == 0) {
+            int32_t in_objects = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_objects) == 1) {
+                if (in_objects > 0) {
+                    scene->set_object_count(static_cast<uint32_t>(in_objects));
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --objects parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --objects parameter must be followed by a number", "User Error");
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            int32_t in_threads = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_threads) == 1) {
+                if (in_threads > 0) {
+                    scene->set_render_threads(static_cast<uint32_t>(in_threads));
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --threads parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --threads parameter must be followed by a number", "User Error");
+        }
+        if (strcmp(argv[i], "--frame_lag") == 0) {
+            int32_t in_frame_lag = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_frame_lag) == 1) {
+                if (in_frame_lag > 0) {
+                    scene->set_frame_lag(static_cast<uint32_t>(in_frame_lag));
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --frame_lag parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --frame_lag parameter must be followed by a number", "User Error");
+        }
+        if (strcmp(argv[i], "--swapchain_images") == 0) {
+            int32_t in_images = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_images) == 1) {
+                if (in_images > 0) {
+                    scene->set_swapchain_image_count(static_cast<uint32_t>(in_images));
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --swapchain_images parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --swapchain_images parameter must be followed by a number", "User Error");
+        }
+        if (strcmp(argv[i], "--low_latency") == 0) {
+            scene->set_low_latency(true);
+            continue;
+        }
+        if (strcmp(argv[i], "--sync_pipelines") == 0) {
+            scene->set_pipeline_compile_threads(0);
+            continue;
+        }
+        if (strcmp(argv[i], "--hot_reload") == 0) {
+            scene->set_hot_reload(true);
+            continue;
+        }
+        if (strcmp(argv[i], "--no_pipeline_library") == 0) {
+            scene->set_pipeline_library(false);
+            continue;
+        }
+        if (strcmp(argv[i], "--bench_pipeline_library") == 0) {
+            scene->set_pipeline_library_benchmark(true);
+            continue;
+        }
+        if (strcmp(argv[i], "--no_dynamic_rendering") == 0) {
+            scene->set_dynamic_rendering(false);
+            continue;
+        }
+        if (strcmp(argv[i], "--no_pacing") == 0) {
+            scene->set_frame_pacing(false);
+            continue;
+        }
+        if (strcmp(argv[i], "--per_vertex_matrices") == 0) {
+            scene->set_per_vertex_matrices(true);
+            continue;
+        }
+        if (strcmp(argv[i], "--no_idle_throttle") == 0) {
+            idle_throttle = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--present_mode") == 0) {
+            if (i < argc - 1) {
+                const char* mode = argv[i + 1];
+                if (strcmp(mode, "fifo") == 0) {
+                    scene->set_present_mode(vk::PresentModeKHR::eFifo);
+                } else if (strcmp(mode, "fifo_relaxed") == 0) {
+                    scene->set_present_mode(vk::PresentModeKHR::eFifoRelaxed);
+                } else if (strcmp(mode, "mailbox") == 0) {
+                    scene->set_present_mode(vk::PresentModeKHR::eMailbox);
+                } else if (strcmp(mode, "immediate") == 0) {
+                    scene->set_present_mode(vk::PresentModeKHR::eImmediate);
+                } else {
+                    ERR_EXIT("The --present_mode parameter must be one of fifo, fifo_relaxed, mailbox, immediate", "User Error");
+                }
+                present_mode_set = true;
+                i++;
+                continue;
+            }
+            ERR_EXIT("The --present_mode parameter must be followed by a mode", "User Error");
+        }
+        if (strcmp(argv[i], "--fps_limit") == 0) {
+            double in_fps = 0.0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%lf", &in_fps) == 1) {
+                if (in_fps > 0.0) {
+                    frame_limiter.SetTargetFps(in_fps);
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --fps_limit parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --fps_limit parameter must be followed by a number", "User Error");
+        }
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            int32_t in_frames = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_frames) == 1) {
+                if (in_frames > 0) {
+                    benchmark_frames = static_cast<uint32_t>(in_frames);
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --benchmark parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --benchmark parameter must be followed by a number of frames", "User Error");
+        }
+        if (strcmp(argv[i], "--headless") == 0) {
+            int32_t in_frames = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_frames) == 1) {
+                if (in_frames > 0) {
+                    headless = true;
+                    benchmark_frames = static_cast<uint32_t>(in_frames);
+                    scene->set_headless(true);
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --headless parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --headless parameter must be followed by a number of frames", "User Error");
+        }
+        if (strcmp(argv[i], "--readback") == 0) {
+            if (i < argc - 1) {
+                readback_path = argv[i + 1];
+                i++;
+                continue;
+            }
+            ERR_EXIT("The --readback parameter must be followed by a file name", "User Error");
+        }
+        if (strcmp(argv[i], "--sim_hz") == 0) {
+            int32_t in_hz = 0;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%d", &in_hz) == 1) {
+                if (in_hz > 0) {
+                    scene->set_sim_hz(static_cast<uint32_t>(in_hz));
+                    i++;
+                    continue;
+                } else {
+                    ERR_EXIT("The --sim_hz parameter must be greater than 0", "User Error");
+                }
+            }
+            ERR_EXIT("The --sim_hz parameter must be followed by a number", "User Error");
+        }
+        if (strcmp(argv[i], "--single_thread") == 0) {
+            scene->set_threaded_simulation(false);
+            continue;
+        }
+        if (strcmp(argv[i], "--bench_transforms") == 0) {
+            bench_transforms = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--bench_recording") == 0) {
+            bench_recording = true;
+            continue;
+        }
         std::stringstream usage;
         usage << "Usage:\n  " << APP_SHORT_NAME
             << "\t[--width <width>] [--height <height>]: render window dimensions\n"
-            << "\t[--validate] [--force_errors]: enable validation, and test error handling\n";
+            << "\t[--validate] [--force_errors]: enable validation, and test error handling\n"
+            << "\t[--bench_geometry]: measure static geometry vertex fetch cost per memory placement without a window and exit\n"
+            << "\t[--record_once]: reuse recorded draw commands until the scene content changes\n"
+            << "\t[--objects <count>]: draw a grid of this many cubes\n"
+            << "\t[--threads <count>]: record draws on this many threads\n"
+            << "\t[--per_vertex_matrices]: combine each object's matrices in the vertex shader instead of once per object on the CPU, compare e.g. --headless 500 --objects 10000 with and without it\n"
+            << "\t[--bench_recording]: measure draw recording time per thread count and exit\n"
+            << "\t[--bench_transforms]: measure 100k transforms in a transform store against per-object matrices, the object constants batch against its scalar version, check random scene graph reparenting, time a 300k node scene graph, and exit\n"
+            << "\t[--frame_lag <count>]: frames the CPU may run ahead of the GPU (default " << DEFAULT_FRAME_LAG << ")\n"
+            << "\t[--swapchain_images <count>]: swapchain images to request (default " << DEFAULT_SWAPCHAIN_IMAGES << ")\n"
+            << "\t[--low_latency]: wait for the previous frame before sampling input\n"
+            << "\t[--sync_pipelines]: compile pipelines on the main thread instead of in the background\n"
+            << "\t[--hot_reload]: rebuild pipelines when their shaders change on disk, edited GLSL is compiled with glslc\n"
+            << "\t[--no_pipeline_library]: compile every pipeline whole instead of linking shared pipeline library parts\n"
+            << "\t[--bench_pipeline_library]: also build the first linked pipeline whole on a compile worker, compared at exit\n"
+            << "\t[--no_dynamic_rendering]: render with a render pass and framebuffers even where dynamic rendering is supported\n"
+            << "\t[--no_pacing]: block on the GPU instead of sleeping until it is predicted to finish\n"
+            << "\t[--no_idle_throttle]: keep rendering at full rate while paused or minimized, for comparing the CPU time reported at exit\n"
+            << "\t[--present_mode fifo|fifo_relaxed|mailbox|immediate]: falls back to fifo when unsupported\n"
+            << "\t[--fps_limit <fps>]: pace frames on the CPU, for the uncapped present modes\n"
+            << "\t[--benchmark <frames>]: render this many frames uncapped, print frame time stats and exit\n"
+            << "\t[--headless <frames>]: like --benchmark, but render offscreen without a window\n"
+            << "\t[--readback <file.ppm>]: with --headless, save the last frame to this file\n"
+            << "\t[--sim_hz <rate>]: fixed simulation steps per second (default " << DEFAULT_SIM_HZ << ")\n"
+            << "\t[--single_thread]: simulate on the main thread instead of pipelining it with rendering\n";
 
 #if defined(_WIN32)
         MessageBoxA(nullptr, usage.str().c_str(), "Usage Error", MB_OK);
@@ -55,16 +275,44 @@ DemoFramework::DemoFramework(int argc, char* argv[], std::unique_ptr<Scene> _sce
         exit(1);
     }
 
+    if (readback_path != nullptr && !headless) {
+        ERR_EXIT("The --readback parameter needs --headless", "User Error");
+    }
+
+    if (benchmark_frames > 0) {
+        // Vsync and the limiter would only measure the display's refresh rate
+        if (!present_mode_set) {
+            scene->set_present_mode(vk::PresentModeKHR::eImmediate);
+        }
+        frame_limiter.SetTargetFps(0.0);
+        benchmark_frame_ns.reserve(benchmark_frames);
+    }
+
     if (ENABLE_VULKAN_VALIDATION && !validate) {
         validate = true;
     }
 
     scene->init_vk(validate);
 
-    create_window();
+    if (!headless) {
+        create_window();
+    }
 
     scene->init_swapchain(window);
     scene->prepare(width, height, is_minimized, force_errors);
+
+    if (bench_geometry) {
+        scene->run_geometry_benchmark(width, height);
+        request_quit();
+    }
+    if (bench_recording) {
+        scene->run_recording_benchmark(width, height);
+        request_quit();
+    }
+    if (bench_transforms) {
+        scene->run_transform_benchmark();
+        request_quit();
+    }
 }
 
 DemoFramework::~DemoFramework() {
@@ -72,14 +320,38 @@ DemoFramework::~DemoFramework() {
     instance = nullptr;
 }
 
+void DemoFramework::request_quit() {
+    quit = true;
+    if (window) {
+        glfwSetWindowShouldClose(window, true);
+    }
+}
+
 void DemoFramework::run() {
+    if (headless) {
+        run_headless();
+        return;
+    }
+
     // Set GLFW events callbacks
     glfwSetWindowSizeCallback(window, WindowSizeCallback);
 
     glfwShowWindow(window);
 
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        const uint64_t loop_start_ns = getTimeInNanoseconds();
+        const uint64_t loop_start_cpu_ns = getProcessCpuTimeInNanoseconds();
+
+        // Nothing changes while minimized or paused, so sleep until an event arrives or the next idle frame is due
+        // instead of spinning through empty or identical frames. Input wakes the loop up right away.
+        const bool paused = is_minimized || scene->is_paused();
+        const bool idle = idle_throttle && benchmark_frames == 0 && paused;
+        scene->wait_for_previous_frame();
+        if (idle) {
+            glfwWaitEventsTimeout(1.0 / IDLE_FPS);
+        } else {
+            glfwPollEvents();
+        }
 
         // Time calculations
         // limit dt to maximum of 0.1 second, this is to mitigate large frame spikes when resizing window or Alt-TABing away
@@ -93,6 +365,21 @@ void DemoFramework::run() {
         // Run this frame
         scene->frame(dt, width, height, is_minimized, force_errors);
 
+        if (benchmark_frames > 0) {
+            // Frame to frame time, the first frame has nothing to compare against
+            const uint64_t now_ns = getTimeInNanoseconds();
+            if (benchmark_last_ns != 0) {
+                benchmark_frame_ns.push_back(now_ns - benchmark_last_ns);
+            }
+            benchmark_last_ns = now_ns;
+            if (benchmark_frame_ns.size() >= benchmark_frames) {
+                print_benchmark_results();
+                request_quit();
+            }
+        } else if (!idle) {
+            frame_limiter.Wait();
+        }
+
         // FPS
         static float fps_timer = 0.0f;
         static int fps_counter = 0;
@@ -108,8 +395,82 @@ void DemoFramework::run() {
             glfwSetWindowTitle(window, wt.c_str());
         }
 
+        // Whole iterations, so the time slept waiting for events counts too
+        CpuUsage& usage = paused ? paused_usage : active_usage;
+        usage.wall_ns += getTimeInNanoseconds() - loop_start_ns;
+        usage.cpu_ns += getProcessCpuTimeInNanoseconds() - loop_start_cpu_ns;
+
         curFrame++;
     }
+
+    print_cpu_usage();
+}
+
+void DemoFramework::run_headless() {
+    // No window and no events, just the frames and their timings. The same clamp on dt as run().
+    const float max_dt = 1.0f / 10.0f;
+    uint64_t previous_ns = getTimeInNanoseconds();
+
+    while (!quit) {
+        const uint64_t now_ns = getTimeInNanoseconds();
+        float dt = min(static_cast<float>(now_ns - previous_ns) / 1e9f, max_dt);
+        previous_ns = now_ns;
+
+        scene->wait_for_previous_frame();
+        scene->frame(dt, width, height, is_minimized, force_errors);
+
+        const uint64_t done_ns = getTimeInNanoseconds();
+        if (benchmark_last_ns != 0) {
+            benchmark_frame_ns.push_back(done_ns - benchmark_last_ns);
+        }
+        benchmark_last_ns = done_ns;
+        if (benchmark_frame_ns.size() >= benchmark_frames) {
+            print_benchmark_results();
+            quit = true;
+        }
+        curFrame++;
+    }
+
+    if (readback_path != nullptr && !scene->save_frame(readback_path, width, height)) {
+        ERR_EXIT("Saving the last frame failed", "Headless Error");
+    }
+}
+
+void DemoFramework::print_benchmark_results() {
+    std::vector<uint64_t> sorted = benchmark_frame_ns;
+    std::sort(sorted.begin(), sorted.end());
+
+    uint64_t total_ns = 0;
+    for (uint64_t frame_ns : sorted) {
+        total_ns += frame_ns;
+    }
+    auto percentile_ms = [&sorted](double p) {
+        const size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return static_cast<double>(sorted[index]) / 1e6;
+    };
+    const double avg_ms = static_cast<double>(total_ns) / static_cast<double>(sorted.size()) / 1e6;
+
+    printf("Benchmark: %zu frames, %s\n", sorted.size(),
+        scene->is_headless() ? "offscreen" : ("present mode " + vk::to_string(scene->get_present_mode())).c_str());
+    printf("  avg %.3f ms (%.1f fps), min %.3f ms, median %.3f ms, 95%% %.3f ms, 99%% %.3f ms, max %.3f ms\n", avg_ms,
+        avg_ms > 0.0 ? 1000.0 / avg_ms : 0.0, percentile_ms(0.0), percentile_ms(0.5), percentile_ms(0.95), percentile_ms(0.99),
+        percentile_ms(1.0));
+    fflush(stdout);
+}
+
+void DemoFramework::print_cpu_usage() {
+    // Process CPU time includes the worker threads, so a fully busy loop can exceed 100%
+    auto print_usage = [](const char* label, const CpuUsage& usage) {
+        if (usage.wall_ns == 0) {
+            return;
+        }
+        printf("  %-8s %8.2f s wall, %8.2f s CPU (%.1f%% of a core)\n", label, static_cast<double>(usage.wall_ns) / 1e9,
+            static_cast<double>(usage.cpu_ns) / 1e9, 100.0 * static_cast<double>(usage.cpu_ns) / static_cast<double>(usage.wall_ns));
+    };
+    printf("Process CPU time%s:\n", idle_throttle ? "" : " (idle throttle off)");
+    print_usage("active", active_usage);
+    print_usage("paused", paused_usage);
+    fflush(stdout);
 }
 
 void DemoFramework::ResizeWindow(uint32_t new_width, uint32_t new_height)
@@ -130,8 +491,10 @@ void DemoFramework::WindowSizeCallback(GLFWwindow* window, int width, int height
 void DemoFramework::cleanup() {
     scene->cleanup(is_minimized);
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 
     scene->finalize();
 }
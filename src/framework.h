@@ -1,6 +1,7 @@
 #pragma once
 
 #include "scene.h"
+#include "FrameLimiter.h"
 
 class DemoFramework {
 public:
@@ -8,6 +9,9 @@ public:
     virtual ~DemoFramework();
 
 	void run();
+	// --headless: render benchmark_frames frames offscreen, no window or event loop
+	void run_headless();
+	void request_quit();
     void ResizeWindow(uint32_t _width, uint32_t _height);
     
 	static void WindowSizeCallback(GLFWwindow* window, int width, int height);
@@ -17,6 +21,9 @@ public:
 	void create_window();
 	void resize();
 	void draw();
+	void print_benchmark_results();
+	// Process CPU time against wall time, separately while rendering and while paused or minimized
+	void print_cpu_usage();
 
 private:
 	std::unique_ptr<Scene>  scene;
@@ -28,6 +35,29 @@ private:
 	uint32_t	FPS = 0;
 	bool        validate = false;
 	bool        force_errors = false;
+	bool        bench_geometry = false;
+	bool        bench_recording = false;
+	bool        bench_transforms = false;
+	bool        present_mode_set = false;
+	bool        headless = false;
+	// --readback: where run_headless() saves the last frame
+	const char* readback_path = nullptr;
+
+	FrameLimiter	frame_limiter;
+	// --no_idle_throttle: paused or minimized, keep running frames at the full rate
+	bool		idle_throttle = true;
+
+	struct CpuUsage {
+		uint64_t	wall_ns = 0;
+		uint64_t	cpu_ns = 0;
+	};
+	CpuUsage	active_usage;
+	CpuUsage	paused_usage;
+
+	// --benchmark: frames to measure and their frame to frame times
+	uint32_t				benchmark_frames = 0;
+	uint64_t				benchmark_last_ns = 0;
+	std::vector<uint64_t>	benchmark_frame_ns;
 	bool 		is_minimized = false;
 
 	GLFWwindow* window = 0;
@@ -18,6 +18,8 @@
  * Port done by: Ian Elliott <ianelliott@google.com>
  **************************************************************************/
 
+#pragma once
+
 #include <time.h>
 #include <assert.h>
 #include <vulkan/vk_platform.h>
@@ -36,7 +38,7 @@
 
 #endif
 
-uint64_t getTimeInNanoseconds(void) {
+inline uint64_t getTimeInNanoseconds(void) {
     const long long ns_in_us = 1000;
     const long long ns_in_ms = 1000 * ns_in_us;
     const long long ns_in_s = 1000 * ns_in_ms;
@@ -75,3 +77,22 @@ uint64_t getTimeInNanoseconds(void) {
 #error getTimeInNanoseconds Not implemented for target OS
 #endif
 }
+
+// CPU time used by all threads of the process so far, user and kernel
+inline uint64_t getProcessCpuTimeInNanoseconds(void) {
+#if defined(_WIN32)
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+        return 0;
+    }
+    // 100 ns units
+    const uint64_t kernel = (uint64_t)kernel_time.dwHighDateTime << 32 | kernel_time.dwLowDateTime;
+    const uint64_t user = (uint64_t)user_time.dwHighDateTime << 32 | user_time.dwLowDateTime;
+    return (kernel + user) * 100;
+
+#else
+    struct timespec cpuTime;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuTime);
+    return (uint64_t)cpuTime.tv_sec * 1000000000ull + (uint64_t)cpuTime.tv_nsec;
+#endif
+}
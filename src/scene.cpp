@@ -2,6 +2,18 @@
 
 #include "TextureLoader.h"
 #include "ShaderLoader.h"
+#include "MemoryTracker.h"
+#include "BufferFactory.h"
+#include "DeviceMemoryPool.h"
+#include "GpuTimeline.h"
+#include "PipelineCacheFile.h"
+#include "PipelineLibrary.h"
+#include "TransformBatch.h"
+#include "TransformStore.h"
+#include "SceneGraph.h"
+#include "gettime.h"
+
+#include <algorithm>
 
 VulkanObjects GVulkanObjects;
 
@@ -77,7 +89,8 @@ void Scene::init_vk(bool validate)  {
 #endif
 	}
 
-	if (!surfaceExtFound) {
+	// Headless rendering never creates a surface, CI machines without a display may not expose the extensions
+	if (!surfaceExtFound && !headless) {
 		ERR_EXIT("vkEnumerateInstanceExtensionProperties failed to find the " VK_KHR_SURFACE_EXTENSION_NAME
 				" extension.\n\n"
 				"Do you have a compatible Vulkan installable client driver (ICD) installed?\n"
@@ -85,7 +98,7 @@ void Scene::init_vk(bool validate)  {
 				"vkCreateInstance Failure");
 	}
 
-	if (!platformSurfaceExtFound) {
+	if (!platformSurfaceExtFound && !headless) {
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
 		ERR_EXIT("vkEnumerateInstanceExtensionProperties failed to find the " VK_KHR_WIN32_SURFACE_EXTENSION_NAME
 				" extension.\n\n"
@@ -114,7 +127,7 @@ void Scene::init_vk(bool validate)  {
 						.setApplicationVersion(0)
 						.setPEngineName(APP_SHORT_NAME)
 						.setEngineVersion(0)
-						.setApiVersion(VK_API_VERSION_1_0);
+						.setApiVersion(VK_API_VERSION_1_2);
 	auto const inst_info = vk::InstanceCreateInfo()
 							.setFlags(portabilityEnumerationActive ? vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR
 																	: static_cast<vk::InstanceCreateFlagBits>(0))
@@ -207,6 +220,10 @@ void Scene::init_vk(bool validate)  {
 
 	// Look for device extensions
 	vk::Bool32 swapchainExtFound = VK_FALSE;
+	vk::Bool32 timelineSemaphoreExtFound = VK_FALSE;
+	vk::Bool32 pipelineLibraryExtFound = VK_FALSE;
+	vk::Bool32 graphicsPipelineLibraryExtFound = VK_FALSE;
+	vk::Bool32 dynamicRenderingExtFound = VK_FALSE;
 
 	auto device_extension_return = gpu.enumerateDeviceExtensionProperties();
 	VERIFY(device_extension_return.result == vk::Result::eSuccess);
@@ -217,10 +234,18 @@ void Scene::init_vk(bool validate)  {
 			enabled_device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 		} else if (!strcmp("VK_KHR_portability_subset", extension.extensionName)) {
 			enabled_device_extensions.push_back("VK_KHR_portability_subset");
+		} else if (!strcmp(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, extension.extensionName)) {
+			timelineSemaphoreExtFound = VK_TRUE;
+		} else if (!strcmp(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME, extension.extensionName)) {
+			pipelineLibraryExtFound = VK_TRUE;
+		} else if (!strcmp(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME, extension.extensionName)) {
+			graphicsPipelineLibraryExtFound = VK_TRUE;
+		} else if (!strcmp(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME, extension.extensionName)) {
+			dynamicRenderingExtFound = VK_TRUE;
 		}
 	}
 
-	if (!swapchainExtFound) {
+	if (!swapchainExtFound && !headless) {
 		ERR_EXIT("vkEnumerateDeviceExtensionProperties failed to find the " VK_KHR_SWAPCHAIN_EXTENSION_NAME
 				" extension.\n\n"
 				"Do you have a compatible Vulkan installable client driver (ICD) installed?\n"
@@ -230,6 +255,42 @@ void Scene::init_vk(bool validate)  {
 
 	gpu.getProperties(&gpu_props);
 
+	// Frame and upload synchronization runs on a timeline semaphore, core since 1.2 and an extension before
+	if (gpu_props.apiVersion < VK_API_VERSION_1_2) {
+		if (!timelineSemaphoreExtFound) {
+			ERR_EXIT("The selected GPU supports neither Vulkan 1.2 nor the " VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME " extension.\n",
+					"vkCreateDevice Failure");
+		}
+		enabled_device_extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+	}
+
+	// Pipelines are linked from separately compiled parts where the driver can, see PipelineLibrary
+	pipeline_library_supported = false;
+	if (use_pipeline_library && pipelineLibraryExtFound && graphicsPipelineLibraryExtFound && gpu_props.apiVersion >= VK_API_VERSION_1_1) {
+		auto library_features = vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT();
+		auto features = vk::PhysicalDeviceFeatures2().setPNext(&library_features);
+		gpu.getFeatures2(&features);
+		if (library_features.graphicsPipelineLibrary) {
+			pipeline_library_supported = true;
+			enabled_device_extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+			enabled_device_extensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+		}
+	}
+
+	// Rendering straight to image views, without render pass and framebuffers. The extension's own dependencies are
+	// core in 1.2.
+	dynamic_rendering_supported = false;
+	if (use_dynamic_rendering && dynamicRenderingExtFound && gpu_props.apiVersion >= VK_API_VERSION_1_2) {
+		auto rendering_features = vk::PhysicalDeviceDynamicRenderingFeaturesKHR();
+		auto features = vk::PhysicalDeviceFeatures2().setPNext(&rendering_features);
+		gpu.getFeatures2(&features);
+		if (rendering_features.dynamicRendering) {
+			dynamic_rendering_supported = true;
+			enabled_device_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+		}
+	}
+	printf("Rendering: %s\n", dynamic_rendering_supported ? "dynamic rendering" : "render pass");
+
 	// Call with nullptr data to get count
 	queue_props = gpu.getQueueFamilyProperties();
 	assert(queue_props.size() >= 1);
@@ -245,14 +306,16 @@ void Scene::init_swapchain(GLFWwindow* whandle)
 {
 	window_handle = whandle;
 
-	create_surface();
+	// Iterate over each queue to learn whether it supports presenting, headless nothing is presented
+	std::vector<vk::Bool32> supportsPresent(queue_props.size(), VK_FALSE);
+	if (!headless) {
+		create_surface();
 
-	// Iterate over each queue to learn whether it supports presenting:
-	std::vector<vk::Bool32> supportsPresent;
-	for (uint32_t i = 0; i < static_cast<uint32_t>(queue_props.size()); i++) {
-		auto supports = gpu.getSurfaceSupportKHR(i, surface);
-		VERIFY(supports.result == vk::Result::eSuccess);
-		supportsPresent.push_back(supports.value);
+		for (uint32_t i = 0; i < static_cast<uint32_t>(queue_props.size()); i++) {
+			auto supports = gpu.getSurfaceSupportKHR(i, surface);
+			VERIFY(supports.result == vk::Result::eSuccess);
+			supportsPresent[i] = supports.value;
+		}
 	}
 
 	uint32_t graphicsQueueFamilyIndex = UINT32_MAX;
@@ -283,6 +346,10 @@ void Scene::init_swapchain(GLFWwindow* whandle)
 		}
 	}
 
+	if (headless) {
+		presentQueueFamilyIndex = graphicsQueueFamilyIndex;
+	}
+
 	// Generate error if could not find both a graphics and a present queue
 	if (graphicsQueueFamilyIndex == UINT32_MAX || presentQueueFamilyIndex == UINT32_MAX) {
 		ERR_EXIT("Could not find both graphics and present queues\n", "Swapchain Initialization Failure");
@@ -301,26 +368,49 @@ void Scene::init_swapchain(GLFWwindow* whandle)
 		present_queue = device.getQueue(present_queue_family_index, 0);
 	}
 
-	// Get the list of VkFormat's that are supported:
-	auto surface_formats_return = gpu.getSurfaceFormatsKHR(surface);
-	VERIFY(surface_formats_return.result == vk::Result::eSuccess);
+	// Every submission to the graphics queue advances its timeline
+	GpuTimeline::Init(device, graphics_queue);
 
-	vk::SurfaceFormatKHR surfaceFormat = pick_surface_format(surface_formats_return.value);
-	format = surfaceFormat.format;
-	color_space = surfaceFormat.colorSpace;
+	// Decide where static geometry lives on this device
+	BufferFactory::Init(gpu, device, graphics_queue_family_index);
+	DeviceMemoryPool::Init(gpu, device, graphics_queue_family_index);
+
+	// Lives as long as the device, so swapchain re-creation reuses everything compiled so far
+	PipelineCacheFile::Init(device, gpu_props, PIPELINE_CACHE_FILE);
+	pipelineCache = PipelineCacheFile::Get();
+	PipelineLibrary::Init(device, pipeline_library_supported, bench_pipeline_library);
+	pipeline_compiler.Start(pipeline_compile_threads);
+	if (hot_reload) {
+		shader_watcher.Start(PATH_SHADERS, SHADER_COMPILE_COMMAND);
+	}
+
+	if (headless) {
+		// Required to support color attachment and transfer use on every device, and its byte order is what
+		// save_frame() writes
+		format = vk::Format::eR8G8B8A8Unorm;
+		color_space = vk::ColorSpaceKHR::eSrgbNonlinear;
+	} else {
+		// Get the list of VkFormat's that are supported:
+		auto surface_formats_return = gpu.getSurfaceFormatsKHR(surface);
+		VERIFY(surface_formats_return.result == vk::Result::eSuccess);
+
+		vk::SurfaceFormatKHR surfaceFormat = pick_surface_format(surface_formats_return.value);
+		format = surfaceFormat.format;
+		color_space = surfaceFormat.colorSpace;
+	}
 
 	// Create semaphores to synchronize acquiring presentable buffers before
 	// rendering and waiting for drawing to be complete before presenting
 	auto const semaphoreCreateInfo = vk::SemaphoreCreateInfo();
 
-	// Create fences that we can use to throttle if we get too far
-	// ahead of the image presents
-	auto const fence_ci = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
-	for (uint32_t i = 0; i < FRAME_LAG; i++) {
-		vk::Result result = device.createFence(&fence_ci, nullptr, &fences[i]);
-		VERIFY(result == vk::Result::eSuccess);
-
-		result = device.createSemaphore(&semaphoreCreateInfo, nullptr, &image_acquired_semaphores[i]);
+	// Throttling if we get too far ahead of the image presents waits on the graphics timeline, see acquire_frame()
+	frame_index = 0;
+	frame_timeline_values.assign(frame_lag, 0);
+	image_acquired_semaphores.resize(frame_lag);
+	draw_complete_semaphores.resize(frame_lag);
+	image_ownership_semaphores.resize(frame_lag);
+	for (uint32_t i = 0; i < frame_lag; i++) {
+		vk::Result result = device.createSemaphore(&semaphoreCreateInfo, nullptr, &image_acquired_semaphores[i]);
 		VERIFY(result == vk::Result::eSuccess);
 
 		result = device.createSemaphore(&semaphoreCreateInfo, nullptr, &draw_complete_semaphores[i]);
@@ -356,37 +446,32 @@ void Scene::prepare(uint32_t& width, uint32_t& height, bool& is_minimized, const
 	prepare_depth(width, height, force_errors);
 
 	prepare_textures();
-	prepare_uniform_data_buffers();
-
+	// Decides which per-image buffers there are
 	prepare_descriptor_layout();
+	prepare_image_resources();
+
 	prepare_render_pass();
 	prepare_pipeline();
 
-	for (auto &frame : frame_resources) {
+	frame_cmd_pools.resize(frame_lag);
+	frame_cmds.resize(frame_lag);
+	for (uint32_t i = 0; i < frame_lag; i++) {
+		auto frame_pool_return = device.createCommandPool(vk::CommandPoolCreateInfo()
+															.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+															.setQueueFamilyIndex(graphics_queue_family_index));
+		VERIFY(frame_pool_return.result == vk::Result::eSuccess);
+		frame_cmd_pools[i] = frame_pool_return.value;
+
 		auto alloc_return = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
-															.setCommandPool(cmd_pool)
+															.setCommandPool(frame_cmd_pools[i])
 															.setLevel(vk::CommandBufferLevel::ePrimary)
 															.setCommandBufferCount(1));
 		VERIFY(alloc_return.result == vk::Result::eSuccess);
-		frame.cmd = alloc_return.value[0];
+		frame_cmds[i] = alloc_return.value[0];
 	}
 
-	if (separate_present_queue) {
-		auto present_cmd_pool_return =
-			device.createCommandPool(vk::CommandPoolCreateInfo().setQueueFamilyIndex(present_queue_family_index));
-		VERIFY(present_cmd_pool_return.result == vk::Result::eSuccess);
-		present_cmd_pool = present_cmd_pool_return.value;
-
-		for (auto &frame : frame_resources) {
-			auto alloc_cmd_return = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
-																	.setCommandPool(present_cmd_pool)
-																	.setLevel(vk::CommandBufferLevel::ePrimary)
-																	.setCommandBufferCount(1));
-			VERIFY(alloc_cmd_return.result == vk::Result::eSuccess);
-			frame.graphics_to_present_cmd = alloc_cmd_return.value[0];
-			build_image_ownership_cmd(frame);
-		}
-	}
+	create_recording_threads();
+	prepare_present_cmds();
 
 	prepare_descriptor_pool();
 	prepare_descriptor_set();
@@ -394,10 +479,10 @@ void Scene::prepare(uint32_t& width, uint32_t& height, bool& is_minimized, const
 	prepare_framebuffers(width, height);
 
     init_scene();
+	// Once, the simulation carries on across resizes
+	start_simulation();
 
-	for (const auto &frame : frame_resources) {
-		draw_build_cmd(frame, width, height);
-	}
+	// Draw commands are recorded every frame in record_frame_commands()
 
 	// Prepare functions above may generate pipeline commands
 	// that need to be flushed before beginning the render loop
@@ -408,6 +493,7 @@ void Scene::prepare(uint32_t& width, uint32_t& height, bool& is_minimized, const
 
 	current_buffer = 0;
 	prepared = true;
+	scene_prepared = true;
 }
 
 void Scene::resize(uint32_t &width, uint32_t &height, bool &is_minimized, const bool &force_errors)
@@ -415,35 +501,114 @@ void Scene::resize(uint32_t &width, uint32_t &height, bool &is_minimized, const
 	// Don't react to resize until after first initialization.
 	if (!prepared) {
 		if (is_minimized) {
-			prepare(width, height, is_minimized, force_errors);
+			// Minimized so far, the scene is still there if it was minimized by a resize
+			if (scene_prepared) {
+				prepare_swapchain_resources(width, height, is_minimized, force_errors);
+			} else {
+				prepare(width, height, is_minimized, force_errors);
+			}
 		}
 		return;
 	}
 
-	// In order to properly resize the window, we must re-create the swapchain
-	// AND redo the command buffers, etc.
-	//
-	// First, perform part of the cleanup() function:
+	// In order to properly resize the window, we must re-create the swapchain and what renders to its images. The
+	// scene, its buffers and textures, the render pass and the pipelines don't depend on the extent and are kept.
 	prepared = false;
 	auto result = device.waitIdle();
 	VERIFY(result == vk::Result::eSuccess);
-    destroy_frame_resources();
+	destroy_swapchain_resources();
+	prepare_swapchain_resources(width, height, is_minimized, force_errors);
+}
+
+void Scene::prepare_swapchain_resources(uint32_t &width, uint32_t &height, bool &is_minimized, const bool &force_errors)
+{
+	const size_t image_count = frame_resources.size();
+	prepare_buffers(width, height, is_minimized);
+	if (is_minimized) {
+		return;
+	}
+	aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
 
-	// Second, re-perform the prepare() function, which will re-create the swapchain.
-	prepare(width, height, is_minimized, force_errors);
+	prepare_depth(width, height, force_errors);
+	if (frame_resources.size() != image_count) {
+		// The new swapchain has a different number of images, give the added ones their buffers and every image a
+		// descriptor set from a pool sized for the new count
+		prepare_image_resources();
+		device.destroyDescriptorPool(desc_pool);
+		prepare_descriptor_pool();
+		prepare_descriptor_set();
+	}
+	prepare_present_cmds();
+	prepare_framebuffers(width, height);
+
+	// Recorded commands reference the previous images and framebuffers
+	invalidate_recorded_commands();
+	current_buffer = 0;
+	prepared = true;
+}
+
+void Scene::destroy_swapchain_resources()
+{
+	for (auto &resource : frame_resources) {
+		device.destroyFramebuffer(resource.framebuffer);
+		resource.framebuffer = vk::Framebuffer();
+		device.destroyImageView(resource.view);
+		resource.view = vk::ImageView();
+		if (resource.offscreen_mem) {
+			device.destroyImage(resource.image);
+			MemoryTracker::Free(resource.offscreen_mem);
+			resource.offscreen_mem = vk::DeviceMemory();
+		}
+	}
+
+	device.destroyImageView(depth.view);
+	device.destroyImage(depth.image);
+	MemoryTracker::Free(depth.mem);
+
+	if (separate_present_queue) {
+		// Frees the image ownership command buffers with it
+		device.destroyCommandPool(present_cmd_pool);
+	}
 }
 
 void Scene::acquire_frame(uint32_t &width, uint32_t &height, bool &is_minimized, const bool &force_errors) {
-	// Ensure no more than FRAME_LAG renderings are outstanding
-	const vk::Result wait_result = device.waitForFences(fences[frame_index], VK_TRUE, UINT64_MAX);
-	VERIFY(wait_result == vk::Result::eSuccess || wait_result == vk::Result::eTimeout);
-	device.resetFences({fences[frame_index]});
+	// Ensure no more than frame_lag renderings are outstanding: wait until the GPU finished this slot's last frame
+	if (low_latency) {
+		// wait_for_previous_frame() already waited for everything submitted, this returns immediately
+		GpuTimeline::Wait(frame_timeline_values[frame_index]);
+	} else {
+		frame_pacer.WaitForGpu(frame_timeline_values[frame_index]);
+	}
+	collect_latency_samples();
+	// Resources destroyed while earlier frames were in flight
+	GpuTimeline::CollectReleases();
+
+	if (headless) {
+		// Round robin over the offscreen images. A ring at least frame_lag long never waits here.
+		current_buffer = (current_buffer + 1) % static_cast<uint32_t>(frame_resources.size());
+		GpuTimeline::Wait(frame_resources[current_buffer].last_submit_value);
+		return;
+	}
 
 	vk::Result acquire_result;
+	uint32_t timeouts = 0;
 	do {
+		// Bounded, so a presentation engine that stops handing out images (e.g. a hidden window on some platforms)
+		// gets reported below instead of hanging silently. It keeps waiting, the images may come back.
+		const uint64_t acquire_start_ns = getTimeInNanoseconds();
 		acquire_result =
-			device.acquireNextImageKHR(swapchain, UINT64_MAX, image_acquired_semaphores[frame_index], vk::Fence(), &current_buffer);
-		if (acquire_result == vk::Result::eErrorOutOfDateKHR) {
+			device.acquireNextImageKHR(swapchain, ACQUIRE_TIMEOUT_NS, image_acquired_semaphores[frame_index], vk::Fence(), &current_buffer);
+		frame_pacer.AddAcquireWait(getTimeInNanoseconds() - acquire_start_ns);
+		if (acquire_result == vk::Result::eTimeout || acquire_result == vk::Result::eNotReady) {
+			// No image yet and the semaphore wasn't touched, try again
+			timeouts++;
+			frame_pacer.AddAcquireTimeout();
+			if (timeouts % ACQUIRE_TIMEOUT_REPORT == 0) {
+				fprintf(stderr, "No swapchain image for %.1f s (%u acquire timeouts in a row), still waiting\n",
+						static_cast<double>(timeouts) * static_cast<double>(ACQUIRE_TIMEOUT_NS) / 1e9, timeouts);
+			}
+			continue;
+		} else if (acquire_result == vk::Result::eErrorOutOfDateKHR) {
 			// demo.swapchain is out of date (e.g. the window was resized) and
 			// must be recreated:
 			resize(width, height, is_minimized, force_errors);
@@ -468,13 +633,16 @@ void Scene::draw() {
     // okay to render to the image.
     vk::PipelineStageFlags const pipe_stage_flags = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 
-    auto submit_result = graphics_queue.submit(vk::SubmitInfo()
-                                                    .setWaitDstStageMask(pipe_stage_flags)
-                                                    .setWaitSemaphores(image_acquired_semaphores[frame_index])
-                                                    .setCommandBuffers(frame_resources[current_buffer].cmd)
-                                                    .setSignalSemaphores(draw_complete_semaphores[frame_index]),
-        fences[frame_index]);
-    VERIFY(submit_result == vk::Result::eSuccess);
+    auto submit_info = vk::SubmitInfo().setCommandBuffers(submit_cmd);
+    if (!headless) {
+        // Offscreen images are never handed to a presentation engine, the timeline alone orders their frames
+        submit_info.setWaitDstStageMask(pipe_stage_flags)
+            .setWaitSemaphores(image_acquired_semaphores[frame_index])
+            .setSignalSemaphores(draw_complete_semaphores[frame_index]);
+    }
+    const uint64_t submit_value = GpuTimeline::Submit(submit_info);
+    frame_timeline_values[frame_index] = submit_value;
+    frame_resources[current_buffer].last_submit_value = submit_value;
 
     if (separate_present_queue) {
             // If we are using separate queues, change image ownership to the
@@ -491,6 +659,12 @@ void Scene::draw() {
 }
 
 void Scene::present(uint32_t &width, uint32_t &height, bool &is_minimized, const bool &force_errors) {
+	if (headless) {
+		frame_index += 1;
+		frame_index %= frame_lag;
+		return;
+	}
+
 	const auto presentInfo = vk::PresentInfoKHR()
 								.setWaitSemaphores(separate_present_queue ? image_ownership_semaphores[frame_index]
 																		: draw_complete_semaphores[frame_index])
@@ -501,7 +675,7 @@ void Scene::present(uint32_t &width, uint32_t &height, bool &is_minimized, const
 	// otherwise wait for draw complete
 	auto present_result = present_queue.presentKHR(&presentInfo);
 	frame_index += 1;
-	frame_index %= FRAME_LAG;
+	frame_index %= frame_lag;
 	if (present_result == vk::Result::eErrorOutOfDateKHR) {
 		// swapchain is out of date (e.g. the window was resized) and
 		// must be recreated:
@@ -524,19 +698,31 @@ void Scene::present(uint32_t &width, uint32_t &height, bool &is_minimized, const
 }
 
 void Scene::cleanup(const bool &is_minimized) {
+	// A resize that ended up minimized already released the swapchain resources, the scene's are still there
+	const bool swapchain_resources_prepared = prepared;
 	prepared = false;
 	auto result = device.waitIdle();
 	VERIFY(result == vk::Result::eSuccess);
 
+	stop_simulation();
+
+	print_recording_stats();
+	print_latency_stats();
+	frame_pacer.PrintStats();
+	printf("Simulation (%s): %" PRIu64 " steps at %u Hz, %" PRIu64 " dropped\n", threaded_simulation ? "own thread" : "main thread",
+		sim_steps, sim_hz, sim_dropped_steps);
+
 	cleanup_scene();
 
-	if (!is_minimized) {
+	if (swapchain_resources_prepared) {
+		destroy_swapchain_resources();
+	}
+	if (scene_prepared) {
 		destroy_frame_resources();
+		scene_prepared = false;
 	}
 
-	// Wait for fences from present operations
-	for (uint32_t i = 0; i < FRAME_LAG; i++) {
-		device.destroyFence(fences[i]);
+	for (uint32_t i = 0; i < frame_lag; i++) {
 		device.destroySemaphore(image_acquired_semaphores[i]);
 		device.destroySemaphore(draw_complete_semaphores[i]);
 		if (separate_present_queue) {
@@ -544,13 +730,39 @@ void Scene::cleanup(const bool &is_minimized) {
 		}
 	}
 
-	device.destroySwapchainKHR(swapchain);
+	if (swapchain) {
+		device.destroySwapchainKHR(swapchain);
+	}
+
+	DeviceMemoryPool::Shutdown();
+	BufferFactory::Shutdown();
+	GpuTimeline::Shutdown();
+	frame_timeline_values.clear();
+
+	// Before the cache is saved, so every pipeline that finished compiling is in it
+	shader_watcher.Stop();
+	pipeline_compiler.Stop();
+	pipeline_compiler.PrintStats();
+	PipelineLibrary::Shutdown();
+	PipelineCacheFile::Shutdown();
+	pipelineCache = vk::PipelineCache();
+	ShaderLoader::Shutdown();
+
+	// Every allocation should have been released by now, dump the watermarks and flag anything left over
+	MemoryTracker::DumpJson(MEMORY_REPORT_FILE);
+	size_t leaked_allocations = MemoryTracker::ReportLeaks();
+	if (leaked_allocations > 0) {
+		fprintf(stderr, "%zu device memory allocation(s) were never freed\n", leaked_allocations);
+	}
+	MemoryTracker::Reset();
 
 	// Clear vulkan objects
 	GVulkanObjects = VulkanObjects{};
 
 	device.destroy();
-	inst.destroySurfaceKHR(surface);
+	if (surface) {
+		inst.destroySurfaceKHR(surface);
+	}
 }
 
 void Scene::finalize() {
@@ -561,6 +773,72 @@ void Scene::finalize() {
 }
 
 
+void Scene::run_geometry_benchmark(uint32_t width, uint32_t height) {
+	// 64 MiB is well past any cache, so every draw really reads the buffer's memory
+	constexpr vk::DeviceSize size = 64ull * 1024 * 1024;
+	constexpr uint32_t draws = 20;
+	const uint32_t vertex_count = static_cast<uint32_t>(size / sizeof(VertexStandard));
+
+	const auto vertex_attributes = VertexStandard::GetAttributeDescriptions();
+	PipelineStateKey key;
+	key.vertex_shader = "vertex_fetch.vert.spv";
+	key.fragment_shader = "vertex_fetch.frag.spv";
+	key.vertex_binding = VertexStandard::GetBindingDescription();
+	key.vertex_attributes = ShaderLoader::GetVertexAttributes(key.vertex_shader,
+		std::vector<vk::VertexInputAttributeDescription>(vertex_attributes.begin(), vertex_attributes.end()));
+	key.topology = vk::PrimitiveTopology::ePointList;
+	key.cull_mode = vk::CullModeFlagBits::eNone;
+	key.depth_test = false;
+	key.depth_write = false;
+	set_render_target(key);
+	key.layout = pipeline_layout;
+	const uint32_t fetch_pipeline = pipeline_compiler.Request("vertex fetch", key);
+	// Time the link time optimized pipeline, not a fast linked one
+	pipeline_compiler.WaitIdle();
+	const vk::Pipeline pipeline = pipeline_compiler.Resolve(fetch_pipeline);
+	VERIFY(pipeline);
+
+	// Draws into the current frame's target outside the frame loop, nothing may be in flight. Inline draws, the
+	// secondaries belong to the frame loop.
+	GpuTimeline::WaitIdle();
+	const bool saved_record_once = record_once;
+	record_once = true;
+	const auto &frame = frame_resources[current_buffer];
+
+	BufferFactory::BenchmarkPlacements(size, draws, [&](vk::CommandBuffer cmd, vk::Buffer vertices) {
+		begin_rendering(cmd, frame, width, height, vk::ClearColorValue(std::array<float, 4>({{0.0f, 0.0f, 0.0f, 0.0f}})));
+		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+		cmd.setViewport(0, vk::Viewport().setWidth(static_cast<float>(width)).setHeight(static_cast<float>(height)).setMinDepth(0.0f).setMaxDepth(1.0f));
+		cmd.setScissor(0, vk::Rect2D(vk::Offset2D{}, vk::Extent2D(width, height)));
+		cmd.bindVertexBuffers(0, vertices, vk::DeviceSize(0));
+		for (uint32_t i = 0; i < draws; i++) {
+			cmd.draw(vertex_count, 1, 0, 0);
+		}
+		end_rendering(cmd, frame);
+	});
+
+	record_once = saved_record_once;
+}
+
+void Scene::run_transform_benchmark() {
+	// Far more objects than any scene here draws, so the per-frame cost dominates the timer's resolution
+	TransformStore::Benchmark(100000, 100);
+	TransformBatch::Benchmark(100000, 100);
+	if (!SceneGraph::CheckReparenting(2000, 2000)) {
+		ERR_EXIT("The scene graph doesn't match its brute-force recomputation after reparenting", "Scene Graph Check Failed");
+	}
+	// Props of three nodes each, enough of them to reach hundreds of thousands of nodes
+	SceneGraph::Benchmark(300000, 100);
+}
+
+void Scene::wait_for_previous_frame() {
+	if (!low_latency || !is_prepared()) {
+		return;
+	}
+	frame_pacer.WaitForGpu(GpuTimeline::GetLastSubmitted());
+	collect_latency_samples();
+}
+
 void Scene::frame(float dt, uint32_t& width, uint32_t& height, bool& is_minimized, const bool& force_errors) {
 	// If we're puased, pass scene delta time = 0.0f
 	float scene_dt = pause? 0.0f : dt;
@@ -568,14 +846,97 @@ void Scene::frame(float dt, uint32_t& width, uint32_t& height, bool& is_minimize
     new_frame();
 
 	if (is_prepared()) {
+			if (DeviceMemoryPool::IsDefragmenting() && DeviceMemoryPool::DefragmentStep(DEFRAG_BYTES_PER_FRAME)) {
+				// All copies have landed. Switch over once no frame in flight reads the old copies,
+				// then point descriptors and command buffers at the new ones
+				GpuTimeline::WaitIdle();
+				DeviceMemoryPool::CommitDefragment();
+				write_descriptor_sets();
+				invalidate_recorded_commands();
+			}
 			acquire_frame(width, height, is_minimized, force_errors);
-			update(scene_dt, frame_resources[current_buffer].uniform_memory_ptr);
+			const uint64_t input_ns = getTimeInNanoseconds();
+			process_input(scene_dt, sim_frame_input.data.data());
+			auto &uniform_buffer = frame_resources[current_buffer].uniform_buffer;
+			void *uniform_memory = uses_uniform_buffer ? uniform_buffer.GetMappedPointer() : nullptr;
+			if (threaded_simulation) {
+				// Hand this frame's input to the simulation thread, which turns it into the state of the next frame
+				// while this one renders the latest state it finished
+				sim_time += scene_dt;
+				{
+					std::lock_guard<std::mutex> lock(sim_wake_mutex);
+					if (sim_input_pending) {
+						// Still unconsumed, its time now covers this frame too
+						merge_sim_input(sim_pending_input.data.data(), sim_frame_input.data.data());
+					} else {
+						sim_pending_input.data = sim_frame_input.data;
+						sim_input_pending = true;
+					}
+					sim_pending_input.time = sim_time;
+				}
+				sim_wake.notify_one();
+
+				// Keeps the previous snapshot if the simulation hasn't finished a new one
+				sim_states.Acquire();
+				const auto &snapshot = sim_states.GetFront();
+				update(scene_dt, snapshot.alpha, snapshot.data.data(), uniform_memory);
+			} else {
+				const float alpha = step_simulation(scene_dt, sim_frame_input.data.data());
+				update(scene_dt, alpha, sim_working_state.data(), uniform_memory);
+			}
+			if (uses_uniform_buffer) {
+				uniform_buffer.MarkDirty(0, get_uniform_buffer_size());
+			}
+			const size_t object_size = get_object_buffer_size();
+			if (object_size > 0) {
+				auto &object_buffer = frame_resources[current_buffer].object_buffer;
+				write_object_constants(object_buffer.GetMappedPointer());
+				object_buffer.MarkDirty(0, object_size);
+			}
+			// One flush for everything written this frame, a no-op on coherent memory
+			MappedBuffer::FlushPending();
+			if (hot_reload) {
+				reload_changed_shaders();
+			}
+			// Swap pipelines that finished compiling in for their fallbacks or previous versions, commands recorded
+			// with those are stale
+			pipeline_compiler.BeginFrame();
+			if (pipeline_compiler.PublishFinished() > 0) {
+				invalidate_recorded_commands();
+			}
+			record_frame_commands(width, height);
 			draw();
+			const uint64_t submit_value = GpuTimeline::GetLastSubmitted();
 			present(width, height, is_minimized, force_errors);
+
+			latency_stats.frames++;
+			latency_stats.to_present_total_ns += getTimeInNanoseconds() - input_ns;
+			pending_latency_samples.push_back({submit_value, input_ns});
     }
 }
 
 
+void Scene::reload_changed_shaders() {
+	const auto changes = shader_watcher.TakeChanges();
+	if (changes.empty()) {
+		return;
+	}
+
+	// New code swaps in, a new interface can't: the descriptor sets were written for the current layout
+	if (ShaderLoader::GetPipelineLayout(get_pipeline_shaders()).layout != pipeline_layout) {
+		printf("Shader interface changed, restart to pick it up\n");
+		fflush(stdout);
+		return;
+	}
+
+	for (const auto &change : changes) {
+		if (pipeline_compiler.Reload(change.file, change.detected_ns) == 0) {
+			printf("%s changed, no pipeline uses it\n", change.file.c_str());
+			fflush(stdout);
+		}
+	}
+}
+
 vk::Bool32 Scene::check_layers(const std::vector<const char *> &check_names, const std::vector<vk::LayerProperties> &layers) {
 	for (const auto &name : check_names) {
 		vk::Bool32 found = VK_FALSE;
@@ -615,7 +976,25 @@ void Scene::create_device() {
 			vk::DeviceQueueCreateInfo().setQueueFamilyIndex(present_queue_family_index).setQueuePriorities(priorities));
 	}
 
-	auto deviceInfo = vk::DeviceCreateInfo().setQueueCreateInfos(queues).setPEnabledExtensionNames(enabled_device_extensions);
+	// Same structure whether timeline semaphores come from 1.2 or the extension
+	auto timeline_features = vk::PhysicalDeviceTimelineSemaphoreFeatures().setTimelineSemaphore(VK_TRUE);
+	// Optional features chained behind it, for what init_vk() found supported
+	void* optional_features = nullptr;
+	auto rendering_features = vk::PhysicalDeviceDynamicRenderingFeaturesKHR().setDynamicRendering(VK_TRUE);
+	if (dynamic_rendering_supported) {
+		rendering_features.setPNext(optional_features);
+		optional_features = &rendering_features;
+	}
+	auto library_features = vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT().setGraphicsPipelineLibrary(VK_TRUE);
+	if (pipeline_library_supported) {
+		library_features.setPNext(optional_features);
+		optional_features = &library_features;
+	}
+	timeline_features.setPNext(optional_features);
+	auto deviceInfo = vk::DeviceCreateInfo()
+						  .setPNext(&timeline_features)
+						  .setQueueCreateInfos(queues)
+						  .setPEnabledExtensionNames(enabled_device_extensions);
 	auto device_return = gpu.createDevice(deviceInfo);
 	VERIFY(device_return.result == vk::Result::eSuccess);
 	device = device_return.value;
@@ -642,6 +1021,11 @@ vk::SurfaceFormatKHR Scene::pick_surface_format(const std::vector<vk::SurfaceFor
 }
 
 void Scene::prepare_buffers(uint32_t& width, uint32_t& height, bool& is_minimized) {
+	if (headless) {
+		prepare_offscreen_images(width, height);
+		return;
+	}
+
 	vk::SwapchainKHR oldSwapchain = swapchain;
 
 	// Check the surface capabilities and formats
@@ -713,14 +1097,17 @@ void Scene::prepare_buffers(uint32_t& width, uint32_t& height, bool& is_minimize
 		}
 	}
 
-	if (swapchainPresentMode != presentMode) {
-		ERR_EXIT("Present mode specified is not supported\n", "Present mode unsupported");
+	if (swapchainPresentMode != presentMode && !present_mode_fallback_reported) {
+		// Only reported once, resizes keep ending up here
+		present_mode_fallback_reported = true;
+		fprintf(stderr, "Present mode %s is not supported by the surface, falling back to %s\n", vk::to_string(presentMode).c_str(),
+				vk::to_string(swapchainPresentMode).c_str());
 	}
+	active_present_mode = swapchainPresentMode;
 
 	// Determine the number of VkImages to use in the swap chain.
-	// Application desires to acquire 3 images at a time for triple
-	// buffering
-	uint32_t desiredNumOfSwapchainImages = 3;
+	// Defaults to 3 for triple buffering, see set_swapchain_image_count()
+	uint32_t desiredNumOfSwapchainImages = desired_swapchain_images;
 	if (desiredNumOfSwapchainImages < surfCapabilities.minImageCount) {
 		desiredNumOfSwapchainImages = surfCapabilities.minImageCount;
 	}
@@ -783,6 +1170,10 @@ void Scene::prepare_buffers(uint32_t& width, uint32_t& height, bool& is_minimize
 
 	auto swapchain_images_return = device.getSwapchainImagesKHR(swapchain);
 	VERIFY(swapchain_images_return.result == vk::Result::eSuccess);
+	for (size_t i = swapchain_images_return.value.size(); i < frame_resources.size(); i++) {
+		// Re-created with fewer images
+		destroy_image_resources(frame_resources[i]);
+	}
 	frame_resources.resize(swapchain_images_return.value.size());
 
 	for (uint32_t i = 0; i < frame_resources.size(); ++i) {
@@ -802,8 +1193,56 @@ void Scene::prepare_buffers(uint32_t& width, uint32_t& height, bool& is_minimize
 
 }
 
+void Scene::prepare_offscreen_images(uint32_t width, uint32_t height) {
+	// Same count as a swapchain would have, so frames in flight and recorded commands behave the same
+	uint32_t image_count = desired_swapchain_images > frame_lag ? desired_swapchain_images : frame_lag;
+	frame_resources.resize(image_count);
+
+	for (auto &frame : frame_resources) {
+		auto const image_info = vk::ImageCreateInfo()
+									.setImageType(vk::ImageType::e2D)
+									.setFormat(format)
+									.setExtent({width, height, 1})
+									.setMipLevels(1)
+									.setArrayLayers(1)
+									.setSamples(vk::SampleCountFlagBits::e1)
+									.setTiling(vk::ImageTiling::eOptimal)
+									.setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc)
+									.setSharingMode(vk::SharingMode::eExclusive)
+									.setInitialLayout(vk::ImageLayout::eUndefined);
+
+		auto result = device.createImage(&image_info, nullptr, &frame.image);
+		VERIFY(result == vk::Result::eSuccess);
+
+		vk::MemoryRequirements mem_reqs;
+		device.getImageMemoryRequirements(frame.image, &mem_reqs);
+
+		auto mem_alloc = vk::MemoryAllocateInfo().setAllocationSize(mem_reqs.size).setMemoryTypeIndex(0);
+		auto const pass =
+			MemoryTypeFromProperties(mem_reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal, mem_alloc.memoryTypeIndex);
+		VERIFY(pass);
+
+		result = MemoryTracker::Allocate(mem_alloc, MemoryCategory::Other, frame.offscreen_mem, "offscreen color");
+		VERIFY(result == vk::Result::eSuccess);
+
+		result = device.bindImageMemory(frame.image, frame.offscreen_mem, 0);
+		VERIFY(result == vk::Result::eSuccess);
+
+		auto const view_return = device.createImageView(vk::ImageViewCreateInfo()
+															.setImage(frame.image)
+															.setViewType(vk::ImageViewType::e2D)
+															.setFormat(format)
+															.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+		VERIFY(view_return.result == vk::Result::eSuccess);
+		frame.view = view_return.value;
+	}
+}
+
 void Scene::prepare_init_cmd() {
-	auto cmd_pool_return = device.createCommandPool(vk::CommandPoolCreateInfo().setQueueFamilyIndex(graphics_queue_family_index));
+	// Per-image command buffers are re-recorded individually when recording once
+	auto cmd_pool_return = device.createCommandPool(vk::CommandPoolCreateInfo()
+														.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+														.setQueueFamilyIndex(graphics_queue_family_index));
 	VERIFY(cmd_pool_return.result == vk::Result::eSuccess);
 	cmd_pool = cmd_pool_return.value;
 
@@ -846,7 +1285,7 @@ void Scene::prepare_depth(uint32_t width, uint32_t height, bool force_errors) {
 													depth.mem_alloc.memoryTypeIndex);
 	VERIFY(pass);
 
-	result = device.allocateMemory(&depth.mem_alloc, nullptr, &depth.mem);
+	result = MemoryTracker::Allocate(depth.mem_alloc, MemoryCategory::Depth, depth.mem, "depth buffer");
 	VERIFY(result == vk::Result::eSuccess);
 
 	result = device.bindImageMemory(depth.image, depth.mem, 0);
@@ -884,6 +1323,7 @@ void Scene::prepare_textures() {
 		// Nothing in the pipeline needs to be complete to start, and don't allow fragment
 		// shader to run until layout transition completes
 		TextureLoader::SetImageLayout(textures[0].image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::ePreinitialized, textures[0].imageLayout, vk::AccessFlagBits(), vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eFragmentShader);
+		DeviceMemoryPool::SetImageLayout(textures[0].allocation, textures[0].imageLayout);
 
 		// staging_texture is not used when we create a linear texture
 		staging_texture.image = vk::Image();
@@ -922,76 +1362,108 @@ void Scene::prepare_textures() {
 	auto result = device.createSampler(&samplerInfo, nullptr, &textures[0].sampler);
 	VERIFY(result == vk::Result::eSuccess);
 
+	create_texture_view(textures[0]);
+
+	// The view is tied to the image, re-create it when the defragmenter moves the image
+	DeviceMemoryPool::SetMoveCallback(textures[0].allocation, [this](PoolHandle) {
+		device.destroyImageView(textures[0].view);
+		textures[0].image = DeviceMemoryPool::GetImage(textures[0].allocation);
+		create_texture_view(textures[0]);
+	});
+}
+
+void Scene::create_texture_view(texture_object &tex_obj) {
 	auto const viewInfo = vk::ImageViewCreateInfo()
-							.setImage(textures[0].image)
+							.setImage(tex_obj.image)
 							.setViewType(vk::ImageViewType::e2D)
-							.setFormat(tex_format)
+							.setFormat(tex_obj.format)
 							.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
 
-	result = device.createImageView(&viewInfo, nullptr, &textures[0].view);
+	auto result = device.createImageView(&viewInfo, nullptr, &tex_obj.view);
 	VERIFY(result == vk::Result::eSuccess);
 }
 
 void Scene::prepare_uniform_data_buffers() {
-	auto [data, data_size] = create_uniform_data();
-
-	auto const buf_info = vk::BufferCreateInfo().setSize(data_size).setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
+	const size_t object_size = get_object_buffer_size();
 
+	// Images kept from before a resize already have theirs
 	for (auto &frame : frame_resources) {
-		auto result = device.createBuffer(&buf_info, nullptr, &frame.uniform_buffer);
-		VERIFY(result == vk::Result::eSuccess);
-
-		vk::MemoryRequirements mem_reqs;
-		device.getBufferMemoryRequirements(frame.uniform_buffer, &mem_reqs);
-
-		auto mem_alloc = vk::MemoryAllocateInfo().setAllocationSize(mem_reqs.size).setMemoryTypeIndex(0);
-
-		bool const pass = MemoryTypeFromProperties(
-			mem_reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-			mem_alloc.memoryTypeIndex);
-		VERIFY(pass);
+		if (uses_uniform_buffer && !frame.uniform_buffer.GetBuffer()) {
+			auto [data, data_size] = create_uniform_data();
+			// Persistently mapped, possibly non-coherent: written every frame and flushed explicitly
+			frame.uniform_buffer.Create(data_size, vk::BufferUsageFlagBits::eUniformBuffer, MemoryCategory::Uniform, "frame uniforms");
+			frame.uniform_buffer.Write(0, data, data_size);
+		}
 
-		result = device.allocateMemory(&mem_alloc, nullptr, &frame.uniform_memory);
-		VERIFY(result == vk::Result::eSuccess);
+		if (object_size > 0 && !frame.object_buffer.GetBuffer()) {
+			frame.object_buffer.Create(object_size, vk::BufferUsageFlagBits::eStorageBuffer, MemoryCategory::Uniform, "frame object constants");
+			memset(frame.object_buffer.GetMappedPointer(), 0, object_size);
+			frame.object_buffer.MarkDirty(0, object_size);
+		}
+	}
+	MappedBuffer::FlushPending();
+}
 
-		result = device.mapMemory(frame.uniform_memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(),
-								&frame.uniform_memory_ptr);
-		VERIFY(result == vk::Result::eSuccess);
+void Scene::prepare_image_resources() {
+	prepare_uniform_data_buffers();
 
-		memcpy(frame.uniform_memory_ptr, data, data_size);
+	for (auto &frame : frame_resources) {
+		if (frame.cmd) {
+			continue;
+		}
+		auto alloc_return = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+															.setCommandPool(cmd_pool)
+															.setLevel(vk::CommandBufferLevel::ePrimary)
+															.setCommandBufferCount(1));
+		VERIFY(alloc_return.result == vk::Result::eSuccess);
+		frame.cmd = alloc_return.value[0];
+	}
+}
 
-		result = device.bindBufferMemory(frame.uniform_buffer, frame.uniform_memory, 0);
-		VERIFY(result == vk::Result::eSuccess);
+void Scene::destroy_image_resources(FrameResources &frame) {
+	if (frame.cmd) {
+		device.freeCommandBuffers(cmd_pool, {frame.cmd});
+		frame.cmd = vk::CommandBuffer();
 	}
+	frame.uniform_buffer.Destroy();
+	frame.object_buffer.Destroy();
 }
 
 void Scene::prepare_descriptor_layout() {
-	std::array<vk::DescriptorSetLayoutBinding, 2> const layout_bindings = {
-		vk::DescriptorSetLayoutBinding()
-			.setBinding(0)
-			.setDescriptorType(vk::DescriptorType::eUniformBuffer)
-			.setDescriptorCount(1)
-			.setStageFlags(vk::ShaderStageFlagBits::eVertex)
-			.setPImmutableSamplers(nullptr),
-		vk::DescriptorSetLayoutBinding()
-			.setBinding(1)
-			.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-			.setDescriptorCount(texture_count)
-			.setStageFlags(vk::ShaderStageFlagBits::eFragment)
-			.setPImmutableSamplers(nullptr)};
-
-	auto const descriptor_layout = vk::DescriptorSetLayoutCreateInfo().setBindings(layout_bindings);
-
-	auto result = device.createDescriptorSetLayout(&descriptor_layout, nullptr, &desc_layout);
-	VERIFY(result == vk::Result::eSuccess);
-
-	auto const pPipelineLayoutCreateInfo = vk::PipelineLayoutCreateInfo().setSetLayouts(desc_layout);
+	const auto layout_info = ShaderLoader::GetPipelineLayout(get_pipeline_shaders());
+
+	// write_descriptor_sets() fills one set with whichever of its descriptors the shaders use
+	bool layout_matches = layout_info.set_layouts.size() == 1;
+	for (const auto &binding : layout_info.bindings) {
+		if (binding.binding == 0) {
+			layout_matches &= binding.type == vk::DescriptorType::eUniformBuffer && binding.count == 1 && binding.size <= get_uniform_buffer_size();
+		} else if (binding.binding == 1) {
+			layout_matches &= binding.type == vk::DescriptorType::eCombinedImageSampler && binding.count == static_cast<uint32_t>(texture_count);
+		} else if (binding.binding == 2) {
+			layout_matches &= binding.type == vk::DescriptorType::eStorageBuffer && binding.count == 1 && get_object_buffer_size() > 0 &&
+				binding.size <= get_object_buffer_size();
+		} else {
+			layout_matches = false;
+		}
+	}
+	if (!layout_matches) {
+		ERR_EXIT("The scene's shaders declare descriptors the scene doesn't provide", "Pipeline Layout Failed");
+	}
 
-	result = device.createPipelineLayout(&pPipelineLayoutCreateInfo, nullptr, &pipeline_layout);
-	VERIFY(result == vk::Result::eSuccess);
+	desc_layout = layout_info.set_layouts[0];
+	desc_bindings = layout_info.bindings;
+	uses_uniform_buffer = std::any_of(desc_bindings.begin(), desc_bindings.end(), [](const auto &binding) { return binding.binding == 0; });
+	pipeline_layout = layout_info.layout;
+	push_constant_stages = layout_info.push_constant_ranges.empty() ? vk::ShaderStageFlags() : layout_info.push_constant_ranges[0].stageFlags;
 }
 
 void Scene::prepare_render_pass() {
+	if (dynamic_rendering_supported) {
+		// Pipelines are built for the attachment formats, begin_rendering() does the layout transitions below
+		render_pass = vk::RenderPass();
+		return;
+	}
+
 	// The initial layout for the color and depth attachments will be LAYOUT_UNDEFINED
 	// because at the start of the renderpass, we don't care about their contents.
 	// At the start of the subpass, the color attachment's layout will be transitioned
@@ -999,7 +1471,8 @@ void Scene::prepare_render_pass() {
 	// will be transitioned to LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL.  At the end of
 	// the renderpass, the color attachment's layout will be transitioned to
 	// LAYOUT_PRESENT_SRC_KHR to be ready to present.  This is all done as part of
-	// the renderpass, no barriers are necessary.
+	// the renderpass, no barriers are necessary. Headless there is nothing to present,
+	// the offscreen images end up ready to be copied back instead.
 	std::array<vk::AttachmentDescription, 2> const attachments = {
 		vk::AttachmentDescription()
 			.setFormat(format)
@@ -1009,7 +1482,7 @@ void Scene::prepare_render_pass() {
 			.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
 			.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
 			.setInitialLayout(vk::ImageLayout::eUndefined)
-			.setFinalLayout(vk::ImageLayout::ePresentSrcKHR),
+			.setFinalLayout(headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR),
 		vk::AttachmentDescription()
 			.setFormat(depth.format)
 			.setSamples(vk::SampleCountFlagBits::e1)
@@ -1061,13 +1534,17 @@ void Scene::prepare_pipeline() {
 }
 
 void Scene::prepare_descriptor_pool() {
-	std::array<vk::DescriptorPoolSize, 2> const poolSizes = {
-		vk::DescriptorPoolSize()
-			.setType(vk::DescriptorType::eUniformBuffer)
-			.setDescriptorCount(static_cast<uint32_t>(frame_resources.size())),
-		vk::DescriptorPoolSize()
-			.setType(vk::DescriptorType::eCombinedImageSampler)
-			.setDescriptorCount(static_cast<uint32_t>(frame_resources.size()) * texture_count)};
+	// One set per frame, sized by what the reflected layout holds
+	std::vector<vk::DescriptorPoolSize> poolSizes;
+	for (const auto &binding : desc_bindings) {
+		auto pool_size = std::find_if(poolSizes.begin(), poolSizes.end(),
+			[&binding](const vk::DescriptorPoolSize &size) { return size.type == binding.type; });
+		if (pool_size == poolSizes.end()) {
+			poolSizes.push_back(vk::DescriptorPoolSize().setType(binding.type));
+			pool_size = poolSizes.end() - 1;
+		}
+		pool_size->descriptorCount += static_cast<uint32_t>(frame_resources.size()) * binding.count;
+	}
 
 	auto const descriptor_pool =
 		vk::DescriptorPoolCreateInfo().setMaxSets(static_cast<uint32_t>(frame_resources.size())).setPoolSizes(poolSizes);
@@ -1079,7 +1556,17 @@ void Scene::prepare_descriptor_pool() {
 void Scene::prepare_descriptor_set() {
 	auto const alloc_info = vk::DescriptorSetAllocateInfo().setDescriptorPool(desc_pool).setSetLayouts(desc_layout);
 
+	for (auto &frame : frame_resources) {
+		auto result = device.allocateDescriptorSets(&alloc_info, &frame.descriptor_set);
+		VERIFY(result == vk::Result::eSuccess);
+	}
+
+	write_descriptor_sets();
+}
+
+void Scene::write_descriptor_sets() {
 	auto buffer_info = vk::DescriptorBufferInfo().setOffset(0).setRange(get_uniform_buffer_size());
+	auto object_info = vk::DescriptorBufferInfo().setOffset(0).setRange(VK_WHOLE_SIZE);
 
 	std::array<vk::DescriptorImageInfo, texture_count> tex_descs;
 	for (uint32_t i = 0; i < texture_count; i++) {
@@ -1088,25 +1575,50 @@ void Scene::prepare_descriptor_set() {
 		tex_descs[i].setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
 	}
 
-	std::array<vk::WriteDescriptorSet, 2> writes;
-	writes[0].setDescriptorCount(1).setDescriptorType(vk::DescriptorType::eUniformBuffer).setPBufferInfo(&buffer_info);
-	writes[1]
-		.setDstBinding(1)
-		.setDescriptorCount(texture_count)
-		.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-		.setImageInfo(tex_descs);
+	// Only the bindings the reflected layout has, writing any other is invalid
+	std::vector<vk::WriteDescriptorSet> writes;
+	for (const auto &binding : desc_bindings) {
+		auto write = vk::WriteDescriptorSet().setDstBinding(binding.binding).setDescriptorType(binding.type);
+		if (binding.binding == 0) {
+			write.setDescriptorCount(1).setPBufferInfo(&buffer_info);
+		} else if (binding.binding == 1) {
+			write.setImageInfo(tex_descs);
+		} else {
+			write.setDescriptorCount(1).setPBufferInfo(&object_info);
+		}
+		writes.push_back(write);
+	}
 
 	for (auto &frame : frame_resources) {
-		auto result = device.allocateDescriptorSets(&alloc_info, &frame.descriptor_set);
-		VERIFY(result == vk::Result::eSuccess);
-
-		buffer_info.setBuffer(frame.uniform_buffer);
-		writes[0].setDstSet(frame.descriptor_set);
-		writes[1].setDstSet(frame.descriptor_set);
+		buffer_info.setBuffer(frame.uniform_buffer.GetBuffer());
+		object_info.setBuffer(frame.object_buffer.GetBuffer());
+		for (auto &write : writes) {
+			write.setDstSet(frame.descriptor_set);
+		}
 		device.updateDescriptorSets(writes, {});
 	}
 }
 
+void Scene::prepare_present_cmds() {
+	if (!separate_present_queue) {
+		return;
+	}
+
+	auto present_cmd_pool_return = device.createCommandPool(vk::CommandPoolCreateInfo().setQueueFamilyIndex(present_queue_family_index));
+	VERIFY(present_cmd_pool_return.result == vk::Result::eSuccess);
+	present_cmd_pool = present_cmd_pool_return.value;
+
+	for (auto &frame : frame_resources) {
+		auto alloc_cmd_return = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+																.setCommandPool(present_cmd_pool)
+																.setLevel(vk::CommandBufferLevel::ePrimary)
+																.setCommandBufferCount(1));
+		VERIFY(alloc_cmd_return.result == vk::Result::eSuccess);
+		frame.graphics_to_present_cmd = alloc_cmd_return.value[0];
+		build_image_ownership_cmd(frame);
+	}
+}
+
 void Scene::build_image_ownership_cmd(const FrameResources &frame) {
 	auto result = frame.graphics_to_present_cmd.begin(
 		vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse));
@@ -1132,6 +1644,11 @@ void Scene::build_image_ownership_cmd(const FrameResources &frame) {
 }
 
 void Scene::prepare_framebuffers(uint32_t width, uint32_t height) {
+	if (dynamic_rendering_supported) {
+		// begin_rendering() uses the image views directly
+		return;
+	}
+
 	std::array<vk::ImageView, 2> attachments;
 	attachments[1] = depth.view;
 
@@ -1148,10 +1665,496 @@ void Scene::prepare_framebuffers(uint32_t width, uint32_t height) {
 	}
 }
 
-void Scene::draw_build_cmd(const FrameResources &frame, uint32_t width, uint32_t height) {
-	const auto commandBuffer = frame.cmd;
+void Scene::record_frame_commands(uint32_t width, uint32_t height) {
+	auto &frame = frame_resources[current_buffer];
+	const uint64_t start_ns = getTimeInNanoseconds();
+
+	if (record_once) {
+		const uint64_t version = get_content_version();
+		if (frame.recorded_version == version && frame.recorded_generation == commands_generation) {
+			submit_cmd = frame.cmd;
+			recording_stats.reused_frames++;
+			return;
+		}
+
+		// The image's previous submission may still be executing, acquire doesn't guarantee it finished
+		GpuTimeline::Wait(frame.last_submit_value);
+
+		// Resubmitted every time this image comes around, possibly while an earlier submission is pending
+		draw_build_cmd(frame.cmd, frame, vk::CommandBufferUsageFlagBits::eSimultaneousUse, width, height);
+		frame.recorded_version = version;
+		frame.recorded_generation = commands_generation;
+		submit_cmd = frame.cmd;
+	} else {
+		// acquire_frame() waited for this slot's last frame, nothing recorded from its pool is in flight anymore
+		auto result = device.resetCommandPool(frame_cmd_pools[frame_index]);
+		VERIFY(result == vk::Result::eSuccess);
+
+		draw_build_cmd(frame_cmds[frame_index], frame, vk::CommandBufferUsageFlagBits::eOneTimeSubmit, width, height);
+		submit_cmd = frame_cmds[frame_index];
+	}
+
+	const uint64_t elapsed_ns = getTimeInNanoseconds() - start_ns;
+	recording_stats.recorded_frames++;
+	recording_stats.total_ns += elapsed_ns;
+	if (elapsed_ns > recording_stats.max_ns) {
+		recording_stats.max_ns = elapsed_ns;
+	}
+}
+
+float Scene::step_simulation(float dt, const void* sim_input) {
+	const double step_dt = 1.0 / static_cast<double>(sim_hz);
+	sim_accumulator += dt;
+
+	uint32_t steps = 0;
+	while (sim_accumulator >= step_dt) {
+		if (steps == MAX_SIM_STEPS_PER_FRAME) {
+			// Simulating costs more than the time it covers, let the simulation slow down instead of spiraling
+			const uint64_t dropped = static_cast<uint64_t>(sim_accumulator / step_dt);
+			sim_dropped_steps += dropped;
+			sim_accumulator -= static_cast<double>(dropped) * step_dt;
+			break;
+		}
+		simulate(static_cast<float>(step_dt), sim_input, sim_working_state.data());
+		sim_accumulator -= step_dt;
+		steps++;
+	}
+	sim_steps += steps;
+
+	return static_cast<float>(sim_accumulator / step_dt);
+}
+
+void Scene::start_simulation() {
+	if (simulation_started) {
+		return;
+	}
+	simulation_started = true;
+
+	sim_working_state.assign(get_sim_state_size(), 0);
+	init_sim_state(sim_working_state.data());
+
+	sim_frame_input.time = 0.0;
+	sim_frame_input.data.assign(get_sim_input_size(), 0);
+	sim_pending_input = sim_frame_input;
+	sim_input_pending = false;
+	SimStateFrame initial_state;
+	initial_state.data = sim_working_state;
+	sim_states.Reset(initial_state);
+
+	sim_time = 0.0;
+	sim_consumed_time = 0.0;
+	sim_quit = false;
+	if (threaded_simulation) {
+		sim_thread = std::thread(&Scene::simulation_thread_main, this);
+	}
+}
+
+void Scene::stop_simulation() {
+	if (sim_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(sim_wake_mutex);
+			sim_quit = true;
+		}
+		sim_wake.notify_one();
+		sim_thread.join();
+	}
+	simulation_started = false;
+}
+
+void Scene::simulation_thread_main() {
+	SimInputFrame input;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(sim_wake_mutex);
+			sim_wake.wait(lock, [&] { return sim_quit || sim_input_pending; });
+			if (sim_quit) {
+				return;
+			}
+			// Holds every frame handed over since the last round, merged, and its time covers all of them
+			input.time = sim_pending_input.time;
+			input.data = sim_pending_input.data;
+			sim_input_pending = false;
+		}
+
+		const double dt = input.time - sim_consumed_time;
+		sim_consumed_time = input.time;
+		const float alpha = step_simulation(static_cast<float>(dt), input.data.data());
+
+		auto &snapshot = sim_states.GetBack();
+		snapshot.alpha = alpha;
+		// Same size every time, copying never reallocates
+		snapshot.data = sim_working_state;
+		sim_states.Publish();
+	}
+}
+
+void Scene::collect_latency_samples() {
+	if (pending_latency_samples.empty()) {
+		return;
+	}
+
+	const uint64_t completed = GpuTimeline::GetCompleted();
+	const uint64_t now_ns = getTimeInNanoseconds();
+	size_t count = 0;
+	while (count < pending_latency_samples.size() && pending_latency_samples[count].timeline_value <= completed) {
+		const uint64_t latency_ns = now_ns - pending_latency_samples[count].input_ns;
+		latency_stats.to_gpu_done_total_ns += latency_ns;
+		if (latency_ns > latency_stats.to_gpu_done_max_ns) {
+			latency_stats.to_gpu_done_max_ns = latency_ns;
+		}
+		count++;
+	}
+	pending_latency_samples.erase(pending_latency_samples.begin(), pending_latency_samples.begin() + count);
+}
+
+void Scene::print_latency_stats() const {
+	const uint64_t measured = latency_stats.frames - pending_latency_samples.size();
+	if (latency_stats.frames == 0 || measured == 0) {
+		return;
+	}
+	printf("Input latency (%s, %u frame(s) in flight, %zu swapchain images): to present %.2f ms, to GPU done avg %.2f ms, max %.2f ms\n",
+		low_latency ? "low latency" : "throughput", frame_lag, frame_resources.size(),
+		static_cast<double>(latency_stats.to_present_total_ns) / static_cast<double>(latency_stats.frames) / 1e6,
+		static_cast<double>(latency_stats.to_gpu_done_total_ns) / static_cast<double>(measured) / 1e6,
+		static_cast<double>(latency_stats.to_gpu_done_max_ns) / 1e6);
+	fflush(stdout);
+}
+
+void Scene::print_recording_stats() const {
+	const double avg_us = recording_stats.recorded_frames > 0
+							  ? static_cast<double>(recording_stats.total_ns) / static_cast<double>(recording_stats.recorded_frames) / 1000.0
+							  : 0.0;
+	printf("Command recording (%s, %u thread(s)): %" PRIu64 " frames recorded, avg %.1f us, max %.1f us, %" PRIu64 " frames reused\n",
+		record_once ? "record once" : "every frame", is_recording_parallel() ? render_threads : 1u, recording_stats.recorded_frames, avg_us,
+		static_cast<double>(recording_stats.max_ns) / 1000.0, recording_stats.reused_frames);
+	fflush(stdout);
+}
+
+void Scene::set_render_threads(uint32_t count) {
+	count = count > 0 ? count : 1;
+	if (count == render_threads) {
+		return;
+	}
+	render_threads = count;
+
+	if (prepared) {
+		// The current pools may still back secondaries in flight
+		GpuTimeline::WaitIdle();
+		destroy_recording_threads();
+		create_recording_threads();
+	}
+}
+
+void Scene::create_recording_threads() {
+	if (render_threads <= 1) {
+		return;
+	}
+
+	record_workers = std::make_unique<WorkerPool>(render_threads);
+	recording_threads.resize(render_threads);
+	for (auto &thread : recording_threads) {
+		thread.pools.resize(frame_lag);
+		thread.cmds.resize(frame_lag);
+		for (uint32_t i = 0; i < frame_lag; i++) {
+			auto pool_return = device.createCommandPool(vk::CommandPoolCreateInfo()
+															.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+															.setQueueFamilyIndex(graphics_queue_family_index));
+			VERIFY(pool_return.result == vk::Result::eSuccess);
+			thread.pools[i] = pool_return.value;
+
+			auto alloc_return = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+																.setCommandPool(thread.pools[i])
+																.setLevel(vk::CommandBufferLevel::eSecondary)
+																.setCommandBufferCount(1));
+			VERIFY(alloc_return.result == vk::Result::eSuccess);
+			thread.cmds[i] = alloc_return.value[0];
+		}
+	}
+}
+
+void Scene::destroy_recording_threads() {
+	for (auto &thread : recording_threads) {
+		for (auto &pool : thread.pools) {
+			device.destroyCommandPool(pool);
+		}
+	}
+	recording_threads.clear();
+	record_workers.reset();
+}
+
+void Scene::begin_rendering(const vk::CommandBuffer &cmd, const FrameResources &frame, uint32_t width, uint32_t height,
+							const vk::ClearColorValue &clear_color) {
+	auto const render_area = vk::Rect2D(vk::Offset2D{}, vk::Extent2D(width, height));
+	auto const clear_depth = vk::ClearDepthStencilValue(1.0f, 0u);
+
+	if (!dynamic_rendering_supported) {
+		vk::ClearValue const clear_values[2] = {clear_color, clear_depth};
+		cmd.beginRenderPass(vk::RenderPassBeginInfo()
+								.setRenderPass(render_pass)
+								.setFramebuffer(frame.framebuffer)
+								.setRenderArea(render_area)
+								.setClearValueCount(2)
+								.setPClearValues(clear_values),
+							is_recording_parallel() ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline);
+		return;
+	}
+
+	// What the render pass' initial layouts and subpass dependencies did. The previous contents are cleared anyway, and
+	// the depth buffer shared between images waits for the previous frame's depth writes.
+	std::array<vk::ImageMemoryBarrier, 2> const barriers = {
+		vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlags())
+			.setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite)
+			.setOldLayout(vk::ImageLayout::eUndefined)
+			.setNewLayout(vk::ImageLayout::eColorAttachmentOptimal)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(frame.image)
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
+		vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+			.setOldLayout(vk::ImageLayout::eUndefined)
+			.setNewLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(depth.image)
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1))};
+	vk::PipelineStageFlags const depth_stages = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput | depth_stages,
+						vk::PipelineStageFlagBits::eColorAttachmentOutput | depth_stages, vk::DependencyFlagBits(), {}, {}, barriers);
+
+	auto const color_attachment = vk::RenderingAttachmentInfoKHR()
+									  .setImageView(frame.view)
+									  .setImageLayout(vk::ImageLayout::eColorAttachmentOptimal)
+									  .setLoadOp(vk::AttachmentLoadOp::eClear)
+									  .setStoreOp(vk::AttachmentStoreOp::eStore)
+									  .setClearValue(clear_color);
+	auto const depth_attachment = vk::RenderingAttachmentInfoKHR()
+									  .setImageView(depth.view)
+									  .setImageLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+									  .setLoadOp(vk::AttachmentLoadOp::eClear)
+									  .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+									  .setClearValue(clear_depth);
+	cmd.beginRenderingKHR(vk::RenderingInfoKHR()
+							  .setFlags(is_recording_parallel() ? vk::RenderingFlagBits::eContentsSecondaryCommandBuffers : vk::RenderingFlags())
+							  .setRenderArea(render_area)
+							  .setLayerCount(1)
+							  .setColorAttachments(color_attachment)
+							  .setPDepthAttachment(&depth_attachment));
+}
+
+void Scene::end_rendering(const vk::CommandBuffer &cmd, const FrameResources &frame) {
+	if (!dynamic_rendering_supported) {
+		// Ending the render pass changes the image's layout from COLOR_ATTACHMENT_OPTIMAL to its final layout
+		cmd.endRenderPass();
+		return;
+	}
 
-	auto result = commandBuffer.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse));
+	cmd.endRenderingKHR();
+	// The render pass' final layout, presenting needs no access mask while the readback's copy does
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
+						headless ? vk::PipelineStageFlagBits::eTransfer : vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlagBits(), {},
+						{},
+						vk::ImageMemoryBarrier()
+							.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+							.setDstAccessMask(headless ? vk::AccessFlagBits::eTransferRead : vk::AccessFlags())
+							.setOldLayout(vk::ImageLayout::eColorAttachmentOptimal)
+							.setNewLayout(headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR)
+							.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+							.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+							.setImage(frame.image)
+							.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+}
+
+void Scene::set_render_target(PipelineStateKey &key) const {
+	key.render_pass = render_pass;
+	key.subpass = 0;
+	if (dynamic_rendering_supported) {
+		key.color_format = format;
+		key.depth_format = depth.format;
+	}
+}
+
+void Scene::record_parallel(const vk::CommandBuffer &primary, const FrameResources &frame, uint32_t draw_count, const RecordDrawsFn &record_draws) {
+	if (!is_recording_parallel()) {
+		if (draw_count > 0) {
+			record_draws(primary, 0, draw_count);
+		}
+		return;
+	}
+
+	const uint32_t thread_count = static_cast<uint32_t>(recording_threads.size());
+	// Dynamic rendering inherits the attachment formats instead of the render pass
+	auto const color_format = format;
+	auto const rendering_inheritance = vk::CommandBufferInheritanceRenderingInfoKHR()
+										   .setColorAttachmentFormats(color_format)
+										   .setDepthAttachmentFormat(depth.format)
+										   .setRasterizationSamples(vk::SampleCountFlagBits::e1);
+	const auto inheritance = vk::CommandBufferInheritanceInfo()
+								 .setPNext(dynamic_rendering_supported ? &rendering_inheritance : nullptr)
+								 .setRenderPass(render_pass)
+								 .setSubpass(0)
+								 .setFramebuffer(frame.framebuffer);
+
+	record_workers->Run([&](uint32_t thread_index) {
+		auto &thread = recording_threads[thread_index];
+		// Only this thread touches its pools, and acquire_frame() waited for the slot's last frame
+		auto result = device.resetCommandPool(thread.pools[frame_index]);
+		VERIFY(result == vk::Result::eSuccess);
+
+		const vk::CommandBuffer secondary = thread.cmds[frame_index];
+		result = secondary.begin(vk::CommandBufferBeginInfo()
+									 .setFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+									 .setPInheritanceInfo(&inheritance));
+		VERIFY(result == vk::Result::eSuccess);
+
+		// Contiguous ranges keep the draw order, the first threads take one draw more when it doesn't divide evenly
+		const uint32_t base = draw_count / thread_count;
+		const uint32_t remainder = draw_count % thread_count;
+		const uint32_t first = thread_index * base + (thread_index < remainder ? thread_index : remainder);
+		const uint32_t count = base + (thread_index < remainder ? 1 : 0);
+		if (count > 0) {
+			record_draws(secondary, first, count);
+		}
+
+		result = secondary.end();
+		VERIFY(result == vk::Result::eSuccess);
+	});
+
+	std::vector<vk::CommandBuffer> secondaries;
+	secondaries.reserve(thread_count);
+	for (const auto &thread : recording_threads) {
+		secondaries.push_back(thread.cmds[frame_index]);
+	}
+	primary.executeCommands(secondaries);
+}
+
+void Scene::run_recording_benchmark(uint32_t width, uint32_t height) {
+	constexpr uint32_t warmup_frames = 10;
+	constexpr uint32_t measured_frames = 200;
+
+	// Records the current slot over and over without submitting, nothing may be in flight
+	GpuTimeline::WaitIdle();
+	// Measure the real draws, not fallbacks
+	pipeline_compiler.WaitIdle();
+
+	const bool saved_record_once = record_once;
+	const uint32_t saved_threads = render_threads;
+	record_once = false;
+
+	uint32_t hardware_threads = std::thread::hardware_concurrency();
+	if (hardware_threads == 0) {
+		hardware_threads = 1;
+	}
+	std::vector<uint32_t> thread_counts;
+	for (uint32_t count = 1; count < hardware_threads; count *= 2) {
+		thread_counts.push_back(count);
+	}
+	thread_counts.push_back(hardware_threads);
+
+	printf("Command recording benchmark: %u objects, %u frames per thread count\n", object_count, measured_frames);
+	double single_thread_us = 0.0;
+	for (uint32_t count : thread_counts) {
+		set_render_threads(count);
+
+		uint64_t total_ns = 0;
+		for (uint32_t i = 0; i < warmup_frames + measured_frames; i++) {
+			const uint64_t start_ns = getTimeInNanoseconds();
+			auto result = device.resetCommandPool(frame_cmd_pools[frame_index]);
+			VERIFY(result == vk::Result::eSuccess);
+			draw_build_cmd(frame_cmds[frame_index], frame_resources[current_buffer], vk::CommandBufferUsageFlagBits::eOneTimeSubmit, width, height);
+			if (i >= warmup_frames) {
+				total_ns += getTimeInNanoseconds() - start_ns;
+			}
+		}
+
+		const double avg_us = static_cast<double>(total_ns) / static_cast<double>(measured_frames) / 1000.0;
+		if (count == 1) {
+			single_thread_us = avg_us;
+		}
+		printf("  %2u thread(s): %9.1f us per frame, %.2fx speedup\n", count, avg_us, avg_us > 0.0 ? single_thread_us / avg_us : 0.0);
+	}
+	fflush(stdout);
+
+	set_render_threads(saved_threads);
+	record_once = saved_record_once;
+}
+
+bool Scene::save_frame(const char* path, uint32_t width, uint32_t height) {
+	if (!headless || !prepared) {
+		return false;
+	}
+
+	// The render pass left the image in TRANSFER_SRC, all that's missing is making the frame's writes visible
+	GpuTimeline::WaitIdle();
+	const auto &frame = frame_resources[current_buffer];
+
+	MappedBuffer readback;
+	readback.Create(static_cast<vk::DeviceSize>(width) * height * 4, vk::BufferUsageFlagBits::eTransferDst, MemoryCategory::Staging,
+		"frame readback", HostAccess::Readback);
+
+	auto cmd_return = device.allocateCommandBuffers(
+		vk::CommandBufferAllocateInfo().setCommandPool(cmd_pool).setLevel(vk::CommandBufferLevel::ePrimary).setCommandBufferCount(1));
+	VERIFY(cmd_return.result == vk::Result::eSuccess);
+	auto readback_cmd = cmd_return.value[0];
+
+	auto result = readback_cmd.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	VERIFY(result == vk::Result::eSuccess);
+	readback_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlagBits(), {}, {},
+		vk::ImageMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+			.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(frame.image)
+			.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+	readback_cmd.copyImageToBuffer(frame.image, vk::ImageLayout::eTransferSrcOptimal, readback.GetBuffer(),
+		vk::BufferImageCopy()
+			.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+			.setImageExtent({width, height, 1}));
+	readback_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlagBits(),
+		vk::MemoryBarrier().setSrcAccessMask(vk::AccessFlagBits::eTransferWrite).setDstAccessMask(vk::AccessFlagBits::eHostRead), {},
+		{});
+	result = readback_cmd.end();
+	VERIFY(result == vk::Result::eSuccess);
+
+	GpuTimeline::Wait(GpuTimeline::Submit(vk::SubmitInfo().setCommandBuffers(readback_cmd)));
+	device.freeCommandBuffers(cmd_pool, readback_cmd);
+	readback.Invalidate();
+
+	bool written = false;
+	FILE *file = fopen(path, "wb");
+	if (file) {
+		// RGBA to RGB, PPM has no alpha
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+		const auto *pixels = static_cast<const uint8_t *>(readback.GetMappedPointer());
+		std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				const uint8_t *pixel = pixels + (static_cast<size_t>(y) * width + x) * 4;
+				row[x * 3 + 0] = pixel[0];
+				row[x * 3 + 1] = pixel[1];
+				row[x * 3 + 2] = pixel[2];
+			}
+			fwrite(row.data(), 1, row.size(), file);
+		}
+		written = ferror(file) == 0;
+		written = fclose(file) == 0 && written;
+	}
+	if (!written) {
+		fprintf(stderr, "Failed to write %s\n", path);
+	}
+
+	readback.Destroy();
+	return written;
+}
+
+void Scene::draw_build_cmd(vk::CommandBuffer commandBuffer, const FrameResources &frame, vk::CommandBufferUsageFlags usage, uint32_t width, uint32_t height) {
+	auto result = commandBuffer.begin(vk::CommandBufferBeginInfo().setFlags(usage));
 	VERIFY(result == vk::Result::eSuccess);
 
 	populate_command_buffer(commandBuffer, frame, width, height);
@@ -1183,29 +2186,22 @@ void Scene::flush_init_cmd(const bool &force_errors) {
 	auto result = cmd.end();
 	VERIFY(result == vk::Result::eSuccess);
 
-	auto fenceInfo = vk::FenceCreateInfo();
+	auto submitInfo = vk::SubmitInfo().setCommandBuffers(cmd);
 	if (force_errors) {
 		// Remove sType to intentionally force validation layer errors.
-		fenceInfo.sType = vk::StructureType::eRenderPassBeginInfo;
+		submitInfo.sType = vk::StructureType::eRenderPassBeginInfo;
 	}
-	auto fence_return = device.createFence(fenceInfo);
-	VERIFY(fence_return.result == vk::Result::eSuccess);
-	auto fence = fence_return.value;
-
-	result = graphics_queue.submit(vk::SubmitInfo().setCommandBuffers(cmd), fence);
-	VERIFY(result == vk::Result::eSuccess);
-
-	result = device.waitForFences(fence, VK_TRUE, UINT64_MAX);
-	VERIFY(result == vk::Result::eSuccess);
+	GpuTimeline::Wait(GpuTimeline::Submit(submitInfo));
 
 	device.freeCommandBuffers(cmd_pool, cmd);
-	device.destroyFence(fence);
 }
 
 void Scene::destroy_texture(texture_object &tex_objs) {
 	// clean up staging resources
-	device.freeMemory(tex_objs.mem);
-	if (tex_objs.image) {
+	MemoryTracker::Free(tex_objs.mem);
+	if (tex_objs.allocation.IsValid()) {
+		DeviceMemoryPool::Destroy(tex_objs.allocation);
+	} else if (tex_objs.image) {
 		device.destroyImage(tex_objs.image);
 	}
 	if (tex_objs.buffer) {
@@ -1216,34 +2212,27 @@ void Scene::destroy_texture(texture_object &tex_objs) {
 void Scene::destroy_frame_resources() {
 	device.destroyDescriptorPool(desc_pool);
 
-	device.destroyPipeline(pipeline);
-	device.destroyPipelineCache(pipelineCache);
+	if (render_pass) {
+		// Waits for builds still using the render pass
+		pipeline_compiler.Reset();
+		PipelineLibrary::Reset();
+	}
 	device.destroyRenderPass(render_pass);
-	device.destroyPipelineLayout(pipeline_layout);
-	device.destroyDescriptorSetLayout(desc_layout);
 
-	for (const auto &tex : textures) {
+	for (auto &tex : textures) {
 		device.destroyImageView(tex.view);
-		device.destroyImage(tex.image);
-		device.freeMemory(tex.mem);
+		DeviceMemoryPool::Destroy(tex.allocation);
 		device.destroySampler(tex.sampler);
 	}
 
-	device.destroyImageView(depth.view);
-	device.destroyImage(depth.image);
-	device.freeMemory(depth.mem);
-
-	for (const auto &resource : frame_resources) {
-		device.destroyFramebuffer(resource.framebuffer);
-		device.destroyImageView(resource.view);
-		device.freeCommandBuffers(cmd_pool, {resource.cmd});
-		device.destroyBuffer(resource.uniform_buffer);
-		device.unmapMemory(resource.uniform_memory);
-		device.freeMemory(resource.uniform_memory);
+	for (auto &resource : frame_resources) {
+		destroy_image_resources(resource);
 	}
 
 	device.destroyCommandPool(cmd_pool);
-	if (separate_present_queue) {
-		device.destroyCommandPool(present_cmd_pool);
+	for (auto &frame_pool : frame_cmd_pools) {
+		// Frees the slot's command buffer with it
+		device.destroyCommandPool(frame_pool);
 	}
+	destroy_recording_threads();
 }
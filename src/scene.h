@@ -4,6 +4,18 @@
 #include "TextureLoader.h"
 #include "scene_data.h"
 #include "MeshModel.h"
+#include "MappedBuffer.h"
+#include "WorkerPool.h"
+#include "TripleBuffer.h"
+#include "FramePacer.h"
+#include "PipelineCompiler.h"
+#include "ShaderReflection.h"
+#include "ShaderWatcher.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 // Originally named: SwapchainImageResources, holds data required by frames-in-flight hence renamed to FrameResources
 // The number of FrameResources is the number of Swapchain images.
@@ -11,16 +23,62 @@
 // as possible. We duplicate any resources that are accessed and modified during rendering a frame.
 struct FrameResources {
 	vk::Image image;
+	// Headless only: the memory of the offscreen image, swapchain images belong to the swapchain
+	vk::DeviceMemory offscreen_mem;
+	// Only used when recording once: this image's commands, kept until the scene content changes
 	vk::CommandBuffer cmd;
+	uint64_t recorded_version = UINT64_MAX;
+	uint64_t recorded_generation = UINT64_MAX;
+	// Graphics timeline value of the last submission that rendered to this image
+	uint64_t last_submit_value = 0;
 	vk::CommandBuffer graphics_to_present_cmd;
 	vk::ImageView view;
-	vk::Buffer uniform_buffer;
-	vk::DeviceMemory uniform_memory;
-	void *uniform_memory_ptr = nullptr;
+	MappedBuffer uniform_buffer;
+	// Only with Scene::get_object_buffer_size() > 0, bound as a storage buffer at binding 2
+	MappedBuffer object_buffer;
 	vk::Framebuffer framebuffer;
 	vk::DescriptorSet descriptor_set;
 };
 
+struct CommandRecordingStats {
+	uint64_t recorded_frames = 0;
+	uint64_t reused_frames = 0;
+	uint64_t total_ns = 0;
+	uint64_t max_ns = 0;
+};
+
+// Secondary command buffers of one recording thread, one transient pool per frame-in-flight slot
+struct RecordingThreadResources {
+	std::vector<vk::CommandPool>	pools;
+	std::vector<vk::CommandBuffer>	cmds;
+};
+
+// Records draws [first, first + count) into cmd
+using RecordDrawsFn = std::function<void(const vk::CommandBuffer& cmd, uint32_t first, uint32_t count)>;
+
+// Simulation input of one frame, handed from the main thread to the simulation
+struct SimInputFrame {
+	// Scene time up to the end of this frame, the simulation steps through whatever it hasn't consumed yet
+	double time = 0.0;
+	std::vector<uint8_t> data;
+};
+
+// Simulation state handed to the render stage
+struct SimStateFrame {
+	float alpha = 0.0f;
+	std::vector<uint8_t> data;
+};
+
+// Proxies for input-to-photon latency, measured from the moment process_input() samples input
+struct LatencyStats {
+	uint64_t frames = 0;
+	// Until vkQueuePresentKHR returned
+	uint64_t to_present_total_ns = 0;
+	// Until the frame's GPU work was seen complete, the image is shown on the next vblank after that
+	uint64_t to_gpu_done_total_ns = 0;
+	uint64_t to_gpu_done_max_ns = 0;
+};
+
 struct DepthBuffer {
 	vk::Format format;
 	vk::Image image;
@@ -42,6 +100,72 @@ public:
 	virtual void finalize();
 	virtual void frame(float dt, uint32_t& width, uint32_t& height, bool& is_minimized, const bool& force_errors);
 
+	// Compare the vertex fetch cost of static geometry in each memory placement by drawing it as points into the
+	// current frame's target, prints results to stdout
+	void run_geometry_benchmark(uint32_t width, uint32_t height);
+	// Compare updating many transforms through a TransformStore with building each object's matrix on its own, check
+	// the object constants batch against its scalar version, check random SceneGraph reparenting against a brute-force
+	// recomputation, and time incremental SceneGraph updates and reparenting
+	void run_transform_benchmark();
+
+	// Reuse each swapchain image's recorded commands until get_content_version() changes instead of recording every frame
+	void set_record_once(bool enable) { record_once = enable; }
+	void print_recording_stats() const;
+
+	// Frames the CPU may run ahead of the GPU and swapchain images requested, set before init_swapchain()
+	void set_frame_lag(uint32_t count) { frame_lag = count > 0 ? count : 1; }
+	void set_swapchain_image_count(uint32_t count) { desired_swapchain_images = count > 0 ? count : 1; }
+	// Wait for the previous frame's GPU work before sampling input. Trades throughput for input latency.
+	void set_low_latency(bool enable) { low_latency = enable; }
+	// With low latency, let the GPU finish the previous frame. Called before the events are polled and frame() runs,
+	// so the frame's input is as fresh as possible when it reaches the screen. Returns right away otherwise.
+	void wait_for_previous_frame();
+	void print_latency_stats() const;
+	// Sleep until shortly before the GPU is predicted to free the next frame slot instead of blocking on it (default)
+	void set_frame_pacing(bool enable) { frame_pacer.SetEnabled(enable); }
+	// Paused scenes don't change, the framework renders them at a low rate
+	bool is_paused() const { return pause; }
+
+	// Fixed simulation steps per second
+	void set_sim_hz(uint32_t hz) { sim_hz = hz > 0 ? hz : 1; }
+	// Simulate on a thread of its own, pipelined with rendering (default), or inline on the main thread.
+	// Set before prepare().
+	void set_threaded_simulation(bool enable) { threaded_simulation = enable; }
+
+	// Requested before init_swapchain(), falls back to FIFO when the surface doesn't support it
+	void set_present_mode(vk::PresentModeKHR mode) { presentMode = mode; }
+	// The mode the swapchain actually uses
+	vk::PresentModeKHR get_present_mode() const { return active_present_mode; }
+
+	// Record draws on this many threads into secondary command buffers, 1 records inline on the main thread
+	void set_render_threads(uint32_t count);
+	// Number of objects scenes that support it spread over a synthetic grid, set before prepare()
+	void set_object_count(uint32_t count) { object_count = count > 0 ? count : 1; }
+	// Combine each object's matrices in the vertex shader instead of once per object on the CPU, for comparing the two
+	void set_per_vertex_matrices(bool enable) { per_vertex_matrices = enable; }
+	// Time draw recording for 1, 2, 4... up to the hardware thread count, prints the speedup over one thread
+	void run_recording_benchmark(uint32_t width, uint32_t height);
+
+	// Threads compiling pipelines in the background, 0 compiles them synchronously. Set before init_swapchain().
+	void set_pipeline_compile_threads(uint32_t count) { pipeline_compile_threads = count; }
+	// Development mode: watch PATH_SHADERS and rebuild the pipelines whose shaders change, without restarting. Set
+	// before init_swapchain().
+	void set_hot_reload(bool enable) { hot_reload = enable; }
+	// Link pipelines from VK_EXT_graphics_pipeline_library parts when the device supports it, otherwise or when
+	// disabled every pipeline is compiled whole. Set before init_vk().
+	void set_pipeline_library(bool enable) { use_pipeline_library = enable; }
+	// Also build the first linked pipeline whole on a compile worker, its time is reported at exit
+	void set_pipeline_library_benchmark(bool enable) { bench_pipeline_library = enable; }
+	// Render with VK_KHR_dynamic_rendering when the device supports it: no render pass or framebuffers. Otherwise or
+	// when disabled a render pass is used. Set before init_vk().
+	void set_dynamic_rendering(bool enable) { use_dynamic_rendering = enable; }
+
+	// Render into a ring of offscreen images instead of a window's swapchain, no window or surface needed. Set before
+	// init_vk(), then pass a null window to init_swapchain().
+	void set_headless(bool enable) { headless = enable; }
+	bool is_headless() const { return headless; }
+	// Headless only: copy the last rendered image back and write it to a binary PPM file
+	bool save_frame(const char* path, uint32_t width, uint32_t height);
 
 protected:
 	// Init and create actual scene objects (geometry, buffers, etc)
@@ -52,23 +176,63 @@ protected:
 	// Setup graphics pipelines here
     virtual void create_graphics_pipelines() = 0;
 	
-	// Setup command buffer/draw commands here, called per swapchain frame
+	// Setup command buffer/draw commands here, called every frame after update() for the acquired swapchain image
 	// No need to call cmd.begin()/.end()
     virtual void populate_command_buffer(const vk::CommandBuffer& cmd, const FrameResources& frame, uint32_t width, uint32_t height) = 0;
+	// Change the returned value whenever populate_command_buffer() would record something different (objects added or
+	// removed, different draw counts). Only consulted when recording once.
+	virtual uint64_t get_content_version() { return 0; }
+	// Every shader the scene's pipelines are built from. The shared descriptor set and pipeline layouts are reflected
+	// from these. Set 0 may only hold what the scene provides: the uniform buffer at binding 0, the textures at
+	// binding 1 and the per-object storage buffer at binding 2.
+	virtual std::vector<std::string> get_pipeline_shaders() = 0;
 
-	// This is called once to prepare the uniform data buffer for device mapping
+	// This is called once to prepare the uniform data buffer for device mapping, only if a shader reads binding 0
 	virtual std::pair<void*, size_t> create_uniform_data() = 0;
     virtual size_t get_uniform_buffer_size() = 0;
+	// Bytes of per-object constants rewritten every frame, 0 for none. Each frame resource has its own buffer, so
+	// recorded commands stay valid while the contents change. Known before init_scene(), e.g. from object_count.
+	virtual size_t get_object_buffer_size() { return 0; }
+	// Called on the main thread after update(), write all get_object_buffer_size() bytes. Flushed like the uniforms.
+	virtual void write_object_constants(void* object_memory_ptr) {}
 
 	// Called at start of a new frame for any preliminary code
 	virtual void new_frame() {}
-	// Main update function takes place before drawing, should update uniform buffer memory if anything is changing
-	virtual void update(float dt, void* uniform_memory_ptr) = 0;
+	// The simulation only sees two blobs of these sizes: the input the main thread samples each frame, and the state it
+	// advances. Both are copied between threads by value, so they must be trivially copyable.
+	virtual size_t get_sim_input_size() { return 0; }
+	virtual size_t get_sim_state_size() { return 0; }
+	// Called once before the first frame to set up the initial state
+	virtual void init_sim_state(void* sim_state) {}
+	// Called on the main thread once per frame, sample input here and write all of sim_input
+	virtual void process_input(float dt, void* sim_input) {}
+	// The simulation thread may fall behind and see several frames' input at once, each new one is folded into the
+	// input it hasn't consumed yet. The default keeps the latest, override to keep short presses from being lost.
+	virtual void merge_sim_input(void* pending_input, const void* latest_input) {
+		memcpy(pending_input, latest_input, get_sim_input_size());
+	}
+	// Advance sim_state by one fixed step of step_dt seconds. Runs zero or more times per frame, so the simulation
+	// only depends on the number of steps and never on the frame rate. May run on the simulation thread, so it must
+	// only touch sim_state.
+	virtual void simulate(float step_dt, const void* sim_input, void* sim_state) {}
+	// Main update function takes place before drawing, should update uniform buffer memory if anything is changing.
+	// sim_state is a snapshot of the simulation, alpha in [0, 1) is how far this frame lies between its previous and
+	// latest step, render transforms are interpolated with it.
+	// The memory stays mapped and may be non-coherent, the scene flushes it once update() returns. Null when no shader
+	// reads the uniform buffer, there is none then.
+	virtual void update(float dt, float alpha, const void* sim_state, void* uniform_memory_ptr) = 0;
 	
 protected:
 	bool is_prepared() const { return prepared; }
     void acquire_frame(uint32_t& width, uint32_t& height, bool& is_minimized, const bool& force_errors);
 	void draw();
+	// Run the fixed steps dt covers on sim_working_state, returns the interpolation factor for update()
+	float step_simulation(float dt, const void* sim_input);
+	void start_simulation();
+	void stop_simulation();
+	void simulation_thread_main();
+	// Record the input-to-GPU-done latency of frames whose work completed
+	void collect_latency_samples();
 	void present(uint32_t &width, uint32_t &height, bool &is_minimized, const bool &force_errors);
 
 protected:
@@ -77,10 +241,19 @@ protected:
 	void create_device();
 	vk::SurfaceFormatKHR pick_surface_format(const std::vector<vk::SurfaceFormatKHR> &surface_formats);
 	void prepare_buffers(uint32_t& width, uint32_t& height, bool& is_minimized);
+	// Resize: the swapchain and what depends on its images or extent, the scene and its resources are kept
+	void prepare_swapchain_resources(uint32_t& width, uint32_t& height, bool& is_minimized, const bool& force_errors);
+	void destroy_swapchain_resources();
+	// Command buffer, uniform and object buffers of each image that has none yet, e.g. added by a re-created swapchain
+	void prepare_image_resources();
+	void destroy_image_resources(FrameResources &frame);
+	void prepare_present_cmds();
+	void prepare_offscreen_images(uint32_t width, uint32_t height);
 	void prepare_init_cmd();
 	void prepare_depth(uint32_t width, uint32_t height, bool force_errors);
 	bool memory_type_from_properties(uint32_t typeBits, vk::MemoryPropertyFlags requirements_mask, uint32_t &typeIndex);
 	void prepare_textures();
+	void create_texture_view(texture_object &tex_obj);
     void prepare_texture_image(const char *filename, texture_object &tex_obj, vk::ImageTiling tiling, vk::ImageUsageFlags usage,
 		vk::MemoryPropertyFlags required_props);
 	void set_image_layout(vk::Image image, vk::ImageAspectFlags aspectMask, vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
@@ -97,15 +270,48 @@ protected:
 
 	void prepare_descriptor_pool();
 	void prepare_descriptor_set();
+	void write_descriptor_sets();
 
 	void build_image_ownership_cmd(const FrameResources &frame);
 	void prepare_framebuffers(uint32_t width, uint32_t height);
-	void draw_build_cmd(const FrameResources &frame, uint32_t width, uint32_t height);
+	void draw_build_cmd(vk::CommandBuffer commandBuffer, const FrameResources &frame, vk::CommandBufferUsageFlags usage, uint32_t width, uint32_t height);
+	void record_frame_commands(uint32_t width, uint32_t height);
+	// Force every recorded command buffer to be recorded again, e.g. after buffers they reference moved
+	void invalidate_recorded_commands() { commands_generation++; }
+	// Hot reload: queue rebuilds of the pipelines using shaders changed on disk, they swap in with PublishFinished()
+	void reload_changed_shaders();
+	// Called from populate_command_buffer() between begin_rendering() and end_rendering(). Splits draw_count draws
+	// evenly over the render threads, each records its share into a secondary command buffer that the primary then
+	// executes in order. record_draws may run on any thread in a buffer that inherits no state, so it binds everything
+	// it uses. Records inline into primary when running single threaded.
+	void record_parallel(const vk::CommandBuffer& primary, const FrameResources& frame, uint32_t draw_count, const RecordDrawsFn& record_draws);
+	// Start rendering to frame's image and the depth buffer, both cleared. Begins the render pass, or with dynamic
+	// rendering transitions the attachments itself and renders to their views directly.
+	void begin_rendering(const vk::CommandBuffer& cmd, const FrameResources& frame, uint32_t width, uint32_t height,
+		const vk::ClearColorValue& clear_color);
+	// Leaves frame's image ready to present, or to copy back headless
+	void end_rendering(const vk::CommandBuffer& cmd, const FrameResources& frame);
+	// Point key at what begin_rendering() renders to: the render pass, or the attachment formats with dynamic rendering
+	void set_render_target(PipelineStateKey& key) const;
+	bool is_recording_parallel() const { return !recording_threads.empty() && !record_once; }
+	void create_recording_threads();
+	void destroy_recording_threads();
 	void flush_init_cmd(const bool &force_errors);
 	void destroy_texture(texture_object &tex_objs);
 	void destroy_frame_resources();
 
 	vk::PresentModeKHR 	presentMode = vk::PresentModeKHR::eFifo;
+	vk::PresentModeKHR 	active_present_mode = vk::PresentModeKHR::eFifo;
+	bool				present_mode_fallback_reported = false;
+	bool				headless = false;
+	uint32_t			pipeline_compile_threads = PIPELINE_COMPILE_THREADS;
+	bool				hot_reload = false;
+	bool				use_pipeline_library = true;
+	bool				pipeline_library_supported = false;
+	bool				bench_pipeline_library = false;
+	bool				use_dynamic_rendering = true;
+	bool				dynamic_rendering_supported = false;
+	ShaderWatcher		shader_watcher;
 	int32_t 			gpu_number = -1;
 
 	// Vulkan needs arrays of const char*
@@ -117,6 +323,10 @@ protected:
 	bool invalid_gpu_selection = false;
 	bool in_callback = false;
 	bool prepared = false;
+	// Everything prepare() creates besides the swapchain resources, kept while a resize re-creates those
+	bool scene_prepared = false;
+	// The reflected layout has the uniform buffer at binding 0, without it the frames have none
+	bool uses_uniform_buffer = false;
 
 	vk::Instance 							inst;
 	vk::DebugUtilsMessengerEXT 				debug_messenger;
@@ -127,10 +337,11 @@ protected:
 	vk::Queue 								present_queue;
 	vk::Format 								format;
 	vk::ColorSpaceKHR 						color_space;
-	std::array<vk::Fence, FRAME_LAG> 		fences;
-	std::array<vk::Semaphore, FRAME_LAG> 	image_acquired_semaphores;
-	std::array<vk::Semaphore, FRAME_LAG> 	draw_complete_semaphores;
-	std::array<vk::Semaphore, FRAME_LAG> 	image_ownership_semaphores;
+	// Graphics timeline value of each slot's last frame, the slot is free again once the timeline reaches it
+	std::vector<uint64_t> 					frame_timeline_values;
+	std::vector<vk::Semaphore> 				image_acquired_semaphores;
+	std::vector<vk::Semaphore> 				draw_complete_semaphores;
+	std::vector<vk::Semaphore> 				image_ownership_semaphores;
 	vk::PhysicalDeviceMemoryProperties 		memory_properties;
 	vk::SwapchainKHR 						swapchain;
 	std::vector<FrameResources> 			frame_resources;
@@ -144,6 +355,42 @@ protected:
 	uint32_t 	graphics_queue_family_index = 0;
 	uint32_t 	present_queue_family_index = 0;
 	uint32_t	frame_index = 0;
+	uint32_t	frame_lag = DEFAULT_FRAME_LAG;
+	uint32_t	desired_swapchain_images = DEFAULT_SWAPCHAIN_IMAGES;
+	bool		low_latency = false;
+	FramePacer	frame_pacer;
+
+	uint32_t	sim_hz = DEFAULT_SIM_HZ;
+	// Simulation time owed, always less than one step after the frame's steps ran
+	double		sim_accumulator = 0.0;
+	uint64_t	sim_steps = 0;
+	uint64_t	sim_dropped_steps = 0;
+
+	bool		threaded_simulation = true;
+	bool		simulation_started = false;
+	// Scene time handed to the simulation so far (main thread) and stepped through (simulation side)
+	double		sim_time = 0.0;
+	double		sim_consumed_time = 0.0;
+	// Only touched by whoever runs simulate()
+	std::vector<uint8_t>			sim_working_state;
+	// Written by process_input() on the main thread each frame
+	SimInputFrame					sim_frame_input;
+	TripleBuffer<SimStateFrame>		sim_states;
+	// Guards the input the simulation thread hasn't consumed yet and wakes it when one is pending
+	std::thread						sim_thread;
+	std::mutex						sim_wake_mutex;
+	std::condition_variable			sim_wake;
+	SimInputFrame					sim_pending_input;
+	bool							sim_input_pending = false;
+	bool							sim_quit = false;
+
+	// Frames submitted but not yet seen complete, with the time their input was sampled
+	struct PendingLatencySample {
+		uint64_t timeline_value = 0;
+		uint64_t input_ns = 0;
+	};
+	std::vector<PendingLatencySample>	pending_latency_samples;
+	LatencyStats						latency_stats;
 	bool 		separate_present_queue = false;
 	uint32_t	current_buffer = 0;
 
@@ -157,7 +404,24 @@ protected:
 	vk::CommandPool			present_cmd_pool;
 
 	vk::CommandBuffer		cmd;  // Buffer for initialization commands
+
+	// One transient pool per frame-in-flight slot, reset in bulk once the timeline passed the slot's last frame
+	std::vector<vk::CommandPool>	frame_cmd_pools;
+	std::vector<vk::CommandBuffer>	frame_cmds;
+	// What draw() submits this frame
+	vk::CommandBuffer		submit_cmd;
+	bool					record_once = false;
+	uint64_t				commands_generation = 0;
+	CommandRecordingStats	recording_stats;
+	uint32_t				render_threads = 1;
+	uint32_t				object_count = 1;
+	bool					per_vertex_matrices = false;
+	// Only created when recording on more than one thread
+	std::unique_ptr<WorkerPool>				record_workers;
+	std::vector<RecordingThreadResources>	recording_threads;
+	// Owned by the ShaderLoader, shared with any other scene reflecting the same interface
 	vk::DescriptorSetLayout desc_layout;
+	std::vector<ReflectedBinding> desc_bindings;
 
     vk::Device			device;
     vk::PhysicalDevice	gpu;
@@ -165,9 +429,13 @@ protected:
     GLFWwindow*			window_handle = nullptr;
 
     vk::RenderPass		render_pass;
-    vk::Pipeline		pipeline;
     vk::PipelineCache	pipelineCache;
+    // Owns every pipeline: create_graphics_pipelines() requests them by state, identical states share one, and they
+    // build off the main thread with their fallbacks drawing meanwhile
+    PipelineCompiler	pipeline_compiler;
     vk::PipelineLayout	pipeline_layout;
+    // The stages reading push constants, what pushConstants() has to name for the shared range
+    vk::ShaderStageFlags	push_constant_stages;
 
     bool				pause = false;
     float				aspect_ratio = 1.0f;
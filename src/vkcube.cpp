@@ -33,7 +33,7 @@ VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 #include "DemoScene.h"
 
 int main(int argc, char** argv) {
-	DemoFramework demo(0, nullptr, std::make_unique<DemoScene>());
+	DemoFramework demo(argc, argv, std::make_unique<DemoScene>());
 	demo.run();
 
 	return validation_error;